@@ -0,0 +1,353 @@
+/*
+ *  Microbenchmarks for the containers in src/, each next to its std::
+ *  equivalent, and the scanner's vectorized loops next to its scalar ones.
+ *
+ *      make microbench && ./build/microbench [filter]
+ *
+ *  prints ns per operation for both and the ratio (sting / std, lower is
+ *  better), the scanner rows under their own header (vectorized / scalar).
+ *  only the cases whose name contains filter run. the scanner
+ *  reads bench/*.sting from the current directory, run it from the repo
+ *  root. that both scanners give the same tokens is make test's job.
+ */
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "utilities.hpp"
+#include "dynarray.hpp"
+#include "hashmap.hpp"
+#include "string.hpp"
+#include "scanner.hpp"
+
+using namespace sting;
+
+namespace {
+
+// keep the optimizer from deleting the work being measured.
+template <typename T>
+void keep(const T& v) {
+    asm volatile("" : : "r"(&v) : "memory");
+}
+
+const char* filter = nullptr;
+
+// ns per op of fn(), which does ops operations. best of a few rounds.
+template <typename Fn>
+f64 measure(u64 ops, Fn fn) {
+    f64 best = 1e300;
+    for (u32 round = 0; round < 5; round++) {
+        const auto start = std::chrono::steady_clock::now();
+        fn();
+        const std::chrono::duration<f64, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        if (elapsed.count() / ops < best)
+            best = elapsed.count() / ops;
+    }
+    return best;
+}
+
+bool selected(const std::string& name) {
+    return filter == nullptr || name.find(filter) != std::string::npos;
+}
+
+// the columns of the rows after it, printed with the first of them.
+const char* columns[2] = { nullptr, nullptr };
+bool columns_shown = false;
+bool any_rows = false;
+
+void header(const char* first, const char* second) {
+    columns[0] = first;
+    columns[1] = second;
+    columns_shown = false;
+}
+
+template <typename Sting, typename Std>
+void bench(const std::string& name, u64 ops, Sting sting_fn, Std std_fn) {
+    if (!selected(name))
+        return;
+    const f64 a = measure(ops, sting_fn);
+    const f64 b = measure(ops, std_fn);
+    if (!columns_shown) {
+        if (any_rows) std::cout << "\n";
+        std::cout << std::left << std::setw(46) << "case" << std::right
+                  << std::setw(10) << columns[0] << std::setw(10) << columns[1]
+                  << std::setw(10) << "ratio" << "\n";
+        columns_shown = any_rows = true;
+    }
+    std::cout << std::left << std::setw(46) << name << std::right << std::fixed
+              << std::setprecision(2) << std::setw(10) << a << std::setw(10) << b
+              << std::setw(9) << a / b << "x\n" << std::flush;
+}
+
+// xorshift, so both sides see the same "random" indices and keys.
+struct rng {
+    u64 state = 0x9e3779b97f4a7c15;
+    u64 next() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+};
+
+// i in base 26, padded to length. distinct for distinct i.
+std::string make_key(u64 i, u64 length) {
+    std::string key(length, 'a');
+    for (u64 j = 0; j < length && i > 0; j++, i /= 26)
+        key[length - 1 - j] = 'a' + i % 26;
+    return key;
+}
+
+void dynarray_benches() {
+    const u64 n = 1 << 20;
+
+    bench("dynarray push_back", n, [&] {
+        dynarray<u64> a;
+        for (u64 i{}; i < n; i++) a.push_back(i);
+        keep(a.data()[n - 1]);
+    }, [&] {
+        std::vector<u64> a;
+        for (u64 i{}; i < n; i++) a.push_back(i);
+        keep(a[n - 1]);
+    });
+
+    dynarray<u64> da;
+    std::vector<u64> sa;
+    for (u64 i{}; i < n; i++) {
+        da.push_back(i);
+        sa.push_back(i);
+    }
+
+    bench("dynarray pop_back", n, [&] {
+        dynarray<u64> a = da;
+        u64 sum = 0;
+        for (u64 i{}; i < n; i++) sum += a.pop_back();
+        keep(sum);
+    }, [&] {
+        std::vector<u64> a = sa;
+        u64 sum = 0;
+        for (u64 i{}; i < n; i++) {
+            sum += a.back();
+            a.pop_back();
+        }
+        keep(sum);
+    });
+
+    bench("dynarray at (random)", n, [&] {
+        rng r;
+        u64 sum = 0;
+        for (u64 i{}; i < n; i++) sum += da.at(r.next() & (n - 1));
+        keep(sum);
+    }, [&] {
+        rng r;
+        u64 sum = 0;
+        for (u64 i{}; i < n; i++) sum += sa.at(r.next() & (n - 1));
+        keep(sum);
+    });
+}
+
+// capacity is fixed so the load factor is what the case says, the map
+// never grows during the measurement.
+void hashmap_benches(f64 load, u64 key_length) {
+    const u64 capacity = 1 << 14;
+    const u64 n = capacity * load;
+
+    std::vector<std::string> std_keys;
+    dynarray<string> keys;
+    dynarray<string> missing;
+    for (u64 i{}; i < n; i++) {
+        std_keys.push_back(make_key(i, key_length));
+        keys.push_back(string(std_keys.back().data(), key_length));
+        const std::string miss = make_key(i + n, key_length);
+        missing.push_back(string(miss.data(), key_length));
+    }
+    std::vector<std::string> std_missing;
+    for (u64 i{}; i < n; i++) std_missing.push_back(make_key(i + n, key_length));
+
+    std::ostringstream suffix;
+    suffix << " (load " << load << ", key " << key_length << ")";
+
+    bench("hashmap insert" + suffix.str(), n, [&] {
+        hashmap<string, u64> m(capacity);
+        for (u64 i{}; i < n; i++) m.insert(keys.data()[i], i);
+        keep(m);
+    }, [&] {
+        std::unordered_map<std::string, u64> m(capacity);
+        for (u64 i{}; i < n; i++) m.insert_or_assign(std_keys[i], i);
+        keep(m);
+    });
+
+    hashmap<string, u64> m(capacity);
+    std::unordered_map<std::string, u64> sm(capacity);
+    for (u64 i{}; i < n; i++) {
+        m.insert(keys.data()[i], i);
+        sm.insert_or_assign(std_keys[i], i);
+    }
+
+    bench("hashmap lookup hit" + suffix.str(), n, [&] {
+        u64 sum = 0;
+        for (u64 i{}; i < n; i++) sum += m.at(keys.data()[i]);
+        keep(sum);
+    }, [&] {
+        u64 sum = 0;
+        for (u64 i{}; i < n; i++) sum += sm.at(std_keys[i]);
+        keep(sum);
+    });
+
+    bench("hashmap lookup miss" + suffix.str(), n, [&] {
+        u64 found = 0;
+        for (u64 i{}; i < n; i++) found += m.contains(missing.data()[i]);
+        keep(found);
+    }, [&] {
+        u64 found = 0;
+        for (u64 i{}; i < n; i++) found += sm.count(std_missing[i]);
+        keep(found);
+    });
+
+    // remove everything then put it back, so every round starts full.
+    bench("hashmap remove + insert" + suffix.str(), 2 * n, [&] {
+        for (u64 i{}; i < n; i++) m.remove(keys.data()[i]);
+        for (u64 i{}; i < n; i++) m.insert(keys.data()[i], i);
+    }, [&] {
+        for (u64 i{}; i < n; i++) sm.erase(std_keys[i]);
+        for (u64 i{}; i < n; i++) sm.insert_or_assign(std_keys[i], i);
+    });
+}
+
+void string_benches(u64 length) {
+    const u64 n = 1 << 16;
+    const std::string sa(length, 'a');
+    std::string sb(length, 'a');
+    sb[length - 1] = 'b';
+    const string a(sa.data(), length);
+    const string b(sb.data(), length);
+    const string a2(sa.data(), length);
+
+    std::ostringstream suffix;
+    suffix << " (length " << length << ")";
+
+    bench("string concat" + suffix.str(), n, [&] {
+        for (u64 i{}; i < n; i++) {
+            string c = a + b;
+            keep(c);
+        }
+    }, [&] {
+        for (u64 i{}; i < n; i++) {
+            std::string c = sa + sb;
+            keep(c);
+        }
+    });
+
+    // equal contents in different strings, the slow case for both.
+    bench("string compare equal" + suffix.str(), n, [&] {
+        u64 same = 0;
+        for (u64 i{}; i < n; i++) same += a.compare(a2);
+        keep(same);
+    }, [&] {
+        const std::string sa2 = sa;
+        u64 same = 0;
+        for (u64 i{}; i < n; i++) same += sa == sa2;
+        keep(same);
+    });
+
+    bench("string compare differ at end" + suffix.str(), n, [&] {
+        u64 same = 0;
+        for (u64 i{}; i < n; i++) same += a.compare(b);
+        keep(same);
+    }, [&] {
+        u64 same = 0;
+        for (u64 i{}; i < n; i++) same += sa == sb;
+        keep(same);
+    });
+
+    // sting caches the hash, building the string is where it's paid.
+    bench("string construct + hash" + suffix.str(), n, [&] {
+        u64 h = 0;
+        for (u64 i{}; i < n; i++) {
+            string s(sa.data(), length);
+            h += fnv_1a_hash(s);
+        }
+        keep(h);
+    }, [&] {
+        u64 h = 0;
+        for (u64 i{}; i < n; i++) {
+            std::string s(sa.data(), length);
+            h += std::hash<std::string>()(s);
+        }
+        keep(h);
+    });
+
+    bench("string hash (cached)" + suffix.str(), n, [&] {
+        u64 h = 0;
+        for (u64 i{}; i < n; i++) h += fnv_1a_hash(a);
+        keep(h);
+    }, [&] {
+        u64 h = 0;
+        for (u64 i{}; i < n; i++) h += std::hash<std::string>()(sa);
+        keep(h);
+    });
+}
+
+dynarray<token> tokenize(std::string& source, bool vectorized) {
+    dynarray<token> tokens;
+    scanner scan(source.data(), source.size(), vectorized);
+    scan.tokenize(tokens);
+    return tokens;
+}
+
+void scanner_benches() {
+    const std::string corpus_name = "scanner tokenize bench/ (per byte)";
+    const std::string code_name = "scanner tokenize generated (per byte)";
+    if (!selected(corpus_name) && !selected(code_name))
+        return;
+
+    std::string corpus;
+    for (const char* name : { "calls", "closures", "fib", "globals", "sieve", "strings" }) {
+        const std::filesystem::path path = std::filesystem::path("bench") / (std::string(name) + ".sting");
+        if (std::filesystem::exists(path)) corpus += read_file(path);
+    }
+    header("vector ns", "scalar ns");
+    if (corpus.empty())
+        std::cout << "(no bench/*.sting here, the bench/ case times the generated code)\n";
+
+    // indented code with comments, what most scripts look like.
+    std::string code;
+    for (u64 i{}; i < 2000; i++) {
+        code += "    // add the next one to the running total\n";
+        code += "    var running_total_" + std::to_string(i) + " = previous_value + 12345.5;\n";
+        code += "    print \"the running total is now\";\n\n";
+    }
+    if (corpus.empty()) corpus = code;
+    // big enough to time.
+    for (const std::string piece = corpus; corpus.size() < code.size();) corpus += piece;
+
+    for (std::string* source : { &corpus, &code }) {
+        const u64 n = source->size();
+        bench(source == &code ? code_name : corpus_name, n, [&] {
+            keep(tokenize(*source, true));
+        }, [&] {
+            keep(tokenize(*source, false));
+        });
+    }
+}
+
+} // namespace
+
+i32 main(i32 argc, char** argv) {
+    if (argc > 1) filter = argv[1];
+
+    header("sting ns", "std ns");
+
+    dynarray_benches();
+    for (f64 load : {0.25, 0.5, 0.7}) {
+        for (u64 key_length : {8, 64}) {
+            hashmap_benches(load, key_length);
+        }
+    }
+    for (u64 length : {8, 64, 1024}) {
+        string_benches(length);
+    }
+    scanner_benches();
+}
@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+"""
+benchmark runner for the .sting workloads in this directory.
+
+    python3 bench/run.py ./sting [--runs N] [--warmup N] [--json out.json]
+                                 [--compare old.json] [workload ...]
+
+every workload is run --warmup times untimed, then --runs times timed
+(wall clock of the whole process). its output is checked against the
+"// expect:" lines at the top of the file. instructions retired come from
+`perf stat` when perf is installed, null otherwise.
+
+the json has one entry per workload, run it on two revisions and pass
+the old one to --compare to get the ratios.
+"""
+
+import argparse
+import json
+import math
+import os
+import shutil
+import statistics
+import subprocess
+import sys
+import time
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+
+
+def workloads(names):
+    found = sorted(f[:-len(".sting")] for f in os.listdir(BENCH_DIR) if f.endswith(".sting"))
+    if not names:
+        return found
+    missing = [n for n in names if n not in found]
+    if missing:
+        sys.exit("unknown workload(s): " + ", ".join(missing))
+    return names
+
+
+def expected_output(path):
+    lines = []
+    with open(path) as f:
+        for line in f:
+            if line.startswith("// expect:"):
+                lines.append(line[len("// expect:"):].strip())
+    return lines
+
+
+def run_once(binary, path):
+    start = time.perf_counter()
+    proc = subprocess.run([binary, path], capture_output=True, text=True)
+    elapsed = time.perf_counter() - start
+    if proc.returncode != 0:
+        sys.exit("%s failed (exit %d):\n%s" % (path, proc.returncode, proc.stderr))
+    return elapsed, [line.strip() for line in proc.stdout.splitlines()]
+
+
+def instructions_retired(binary, path):
+    if shutil.which("perf") is None:
+        return None
+    proc = subprocess.run(["perf", "stat", "-x", ",", "-e", "instructions:u", binary, path],
+                          capture_output=True, text=True)
+    for line in proc.stderr.splitlines():
+        fields = line.split(",")
+        if len(fields) > 2 and fields[2].startswith("instructions"):
+            try:
+                return int(fields[0])
+            except ValueError:
+                return None  # <not supported> / <not counted>
+    return None
+
+
+# nearest rank
+def percentile(samples, p):
+    ordered = sorted(samples)
+    return ordered[max(0, math.ceil(p / 100.0 * len(ordered)) - 1)]
+
+
+def git_revision():
+    try:
+        return subprocess.run(["git", "rev-parse", "--short", "HEAD"], cwd=BENCH_DIR,
+                              capture_output=True, text=True).stdout.strip() or None
+    except OSError:
+        return None
+
+
+def main():
+    args = argparse.ArgumentParser(description="run the sting benchmarks")
+    args.add_argument("binary")
+    args.add_argument("workloads", nargs="*")
+    args.add_argument("--runs", type=int, default=10)
+    args.add_argument("--warmup", type=int, default=2)
+    args.add_argument("--json", help="write the results here")
+    args.add_argument("--compare", help="results of an earlier run to compare against")
+    opts = args.parse_intermixed_args()
+
+    binary = os.path.abspath(opts.binary)
+    previous = None
+    if opts.compare:
+        with open(opts.compare) as f:
+            previous = json.load(f)["workloads"]
+
+    results = {}
+    print("%-10s %10s %10s %16s" % ("workload", "median ms", "p95 ms", "instructions")
+          + ("   vs old" if previous else ""))
+    for name in workloads(opts.workloads):
+        path = os.path.join(BENCH_DIR, name + ".sting")
+        expect = expected_output(path)
+
+        for _ in range(opts.warmup):
+            run_once(binary, path)
+
+        times = []
+        for _ in range(opts.runs):
+            elapsed, output = run_once(binary, path)
+            if output != expect:
+                sys.exit("%s: wrong output %s, expected %s" % (name, output, expect))
+            times.append(elapsed * 1000.0)
+
+        result = {
+            "runs": opts.runs,
+            "median_ms": round(statistics.median(times), 3),
+            "p95_ms": round(percentile(times, 95), 3),
+            "min_ms": round(min(times), 3),
+            "instructions": instructions_retired(binary, path),
+        }
+        results[name] = result
+
+        line = "%-10s %10.2f %10.2f %16s" % (name, result["median_ms"], result["p95_ms"],
+                                             result["instructions"] if result["instructions"] is not None else "-")
+        if previous and name in previous:
+            line += "   %6.2fx" % (previous[name]["median_ms"] / result["median_ms"])
+        print(line, flush=True)
+
+    if opts.json:
+        with open(opts.json, "w") as f:
+            json.dump({"revision": git_revision(), "binary": opts.binary, "workloads": results},
+                      f, indent=2, sort_keys=True)
+            f.write("\n")
+
+
+if __name__ == "__main__":
+    main()
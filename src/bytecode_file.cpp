@@ -0,0 +1,506 @@
+#include "bytecode_file.hpp"
+#include "native_function.hpp"
+#include "registers.hpp"
+#include "stack_depth.hpp"
+#include "gc.hpp"
+#include "mapped_file.hpp"
+
+#ifdef STING_MMAP
+#include <unistd.h>
+#endif
+
+namespace sting {
+
+namespace {
+
+const u8 MAGIC[8] = { 'S', 'T', 'I', 'N', 'G', 'C', '\0', '\0' };
+
+u64 fnv(const u8* data, u64 size) {
+    u64 hash = DEFAULT_FNV_OFFSET;
+    for (u64 i{}; i < size; i++) {
+        hash ^= static_cast<uint8_t>(data[i]);
+        hash *= DEFAULT_FNV_PRIME;
+    }
+    return hash;
+}
+
+class writer {
+public:
+    writer() : out(), ok(true) {}
+
+    std::string out;
+    bool ok; // false once there was something it can't write
+
+    template <typename T>
+    void put(const T& x) { out.append(reinterpret_cast<const u8*>(&x), sizeof(x)); }
+
+    void bytes(const u8* data, u64 size) {
+        put(static_cast<u32>(size));
+        out.append(data, size);
+    }
+
+    void str(const string& s) { bytes(s.data(), s.size()); }
+
+    void val(const value& v) {
+        put(static_cast<u8>(v.type()));
+        switch (v.type()) {
+            case vtype::BOOLEAN:
+                put(v.byte());
+                break;
+            case vtype::NIL:
+                break;
+            case vtype::NUMBER:
+                put(v.number());
+                break;
+            case vtype::STRING:
+                str(*static_cast<string*>(v.obj()));
+                break;
+            case vtype::FUNCTION:
+                fn(*static_cast<function*>(v.obj()));
+                break;
+            default:
+                ok = false; // natives and closures are never constants
+        }
+    }
+
+    void fn(function& f) {
+        str(f.get_name());
+        put(static_cast<u64>(f.get_arity()));
+        chunk& chk = f.get_chunk();
+        bytes(chk.name.data(), chk.name.size());
+        bytes(chk.bytecode.data(), chk.bytecode.size());
+        put(static_cast<u32>(chk.constant_pool.size()));
+        for (u64 i{}; i < chk.constant_pool.size(); i++) {
+            val(chk.constant_pool.at(i));
+        }
+        put(static_cast<u32>(chk.lines.size()));
+        for (u64 i{}; i < chk.lines.size(); i++) {
+            put(chk.lines.at(i).offset);
+            put(chk.lines.at(i).line);
+        }
+        put(chk.max_stack);
+        put(static_cast<u32>(chk.call_cache.size()));
+    }
+};
+
+// reads what writer wrote. running past the end, or into something that
+// doesn't make sense, clears ok and everything after reads as zero.
+class reader {
+public:
+    reader(const u8* at, const u8* end) : ok(true), at(at), end(end) {}
+
+    bool ok;
+
+    bool done() const { return at == end; }
+
+    // hash of what's left to read.
+    u64 rest_hash() const { return fnv(at, end - at); }
+
+    template <typename T>
+    T get() {
+        T x{};
+        if (has(sizeof(T))) {
+            memcpy(&x, at, sizeof(T));
+            at += sizeof(T);
+        }
+        return x;
+    }
+
+    // the next size bytes, nullptr if there aren't that many.
+    const u8* take(u64 size) {
+        if (!has(size)) return nullptr;
+        const u8* bytes = at;
+        at += size;
+        return bytes;
+    }
+
+    // a count of things that take at least size bytes each.
+    u32 count(u64 size) {
+        const u32 n = get<u32>();
+        if (static_cast<u64>(n) * size > static_cast<u64>(end - at)) {
+            ok = false;
+            return 0;
+        }
+        return n;
+    }
+
+    string str() {
+        const u32 size = count(1);
+        return string(take(size), size);
+    }
+
+    value val() {
+        switch (static_cast<vtype>(get<u8>())) {
+            case vtype::BOOLEAN:
+                return value(static_cast<u8>(get<u8>() != 0));
+            case vtype::NIL:
+                return value();
+            case vtype::NUMBER:
+                return value(get<f32>());
+            case vtype::STRING: {
+                const string s = str();
+                return value(&s, vtype::STRING);
+            }
+            case vtype::FUNCTION: {
+                const string name = str();
+                const u64 arity = get<u64>();
+                function* f = gc.make<function>(name, arity);
+                read_chunk(f->get_chunk());
+                return value::heap_object(f, vtype::FUNCTION);
+            }
+            default:
+                ok = false;
+                return value();
+        }
+    }
+
+    void read_chunk(chunk& chk) {
+        const u32 name_size = count(1);
+        if (const u8* name = take(name_size)) chk.name = std::string(name, name_size);
+        const u32 code_size = count(1);
+        const u8* code = take(code_size);
+        for (u32 i{}; i < code_size; i++) {
+            chk.bytecode.push_back(code[i]);
+        }
+        const u32 constants = count(1);
+        for (u32 i{}; i < constants && ok; i++) {
+            chk.constant_pool.push_back(val());
+        }
+        const u32 lines = count(2 * sizeof(u64));
+        for (u32 i{}; i < lines; i++) {
+            const u64 offset = get<u64>();
+            chk.lines.push_back(line_run{ .offset = offset, .line = get<u64>() });
+        }
+        chk.max_stack = get<u32>();
+        // every call site is a call instruction in the bytecode.
+        const u32 call_sites = get<u32>();
+        if (call_sites > code_size) ok = false;
+        for (u32 i{}; i < call_sites && ok; i++) {
+            chk.add_call_site();
+        }
+    }
+
+private:
+    const u8* at;
+    const u8* end;
+
+    bool has(u64 size) {
+        if (static_cast<u64>(end - at) < size) ok = false;
+        return ok;
+    }
+};
+
+// checks code read back from a file before anything runs it. the checksum
+// catches a damaged file, this catches code the vm would trip over anyway:
+// every instruction is a known op that ends inside the chunk, its operands
+// index into what they index, branches land on instructions and the stack
+// stays between the frame base and max_stack, with the same depth on every
+// path. what's left to the vm is what it checks itself, like types.
+class verifier {
+public:
+    verifier(u64 globals, bool registers) : globals(globals), registers(registers) {}
+
+    // f's closures have upvalues upvalues, the script is called with none.
+    bool check(function& f, u64 upvalues, bool script) {
+        chunk& chk = f.get_chunk();
+        const u64 size = chk.bytecode.size();
+        const u64 arity = f.get_arity();
+        if (size == 0 || arity > UINT32_MAX || (script && arity != 0)) return false;
+
+        // upvalues of the closures made from each function constant, the
+        // fewest when there's more than one MAKE_CLOSURE.
+        dynarray<u64> closed;
+        for (u64 i{}; i < chk.constant_pool.size(); i++) {
+            closed.push_back(UINT64_MAX);
+        }
+        if (!decode(chk, upvalues, closed) || !check_depths(chk, arity, script)) return false;
+
+        for (u64 i{}; i < chk.constant_pool.size(); i++) {
+            const value& v = chk.constant_pool.at(i);
+            if (v.type() != vtype::FUNCTION) continue;
+            const u64 n = closed.at(i) == UINT64_MAX ? 0 : closed.at(i);
+            if (!check(*static_cast<function*>(v.obj()), n, false)) return false;
+        }
+        // the register code isn't in the file, it's translated again from
+        // the code that just passed.
+        return !registers || translate_to_registers(chk, arity);
+    }
+
+private:
+    u64 globals;
+    bool registers;
+    dynarray<bool> starts; // instruction boundaries, one more than the code
+    dynarray<bool> targets; // where branches land, the same size
+    dynarray<i64> depth_at;
+
+    // one pass over every instruction, reachable or not, the jit compiles
+    // them all.
+    bool decode(chunk& chk, u64 upvalues, dynarray<u64>& closed) {
+        const u8* code = chk.bytecode.data();
+        const u64 size = chk.bytecode.size();
+        const u64 pool = chk.constant_pool.size();
+        const u64 sites = chk.call_cache.size();
+        starts = dynarray<bool>();
+        targets = dynarray<bool>();
+        for (u64 i{}; i <= size; i++) {
+            starts.push_back(false);
+            targets.push_back(false);
+        }
+
+        u64 previous = size; // the instruction before, MAKE_CLOSURE's function
+        for (u64 offset{}; offset < size; offset += instruction_size(code + offset)) {
+            const u8* at = code + offset;
+            if (static_cast<uint8_t>(*at) >= static_cast<uint8_t>(opcode::OPCODE_COUNT)) return false;
+            const opcode raw = static_cast<opcode>(*at);
+            // files are written before anything ran, so nothing's quickened.
+            if (generic_form(raw) != raw) return false;
+            const u64 width = operand_width(raw);
+            if (size - offset < 1 + width || size - offset < instruction_size(at)) return false;
+            starts.at(offset) = true;
+
+            const u32 a = read_operand(at + 1, width);
+            const u32 b = read_operand(at + 1 + width, width);
+            const u32 c = read_operand(at + 1 + 2 * width, width);
+            switch (short_form(raw)) {
+                case opcode::LOAD_CONST:
+                    if (a >= pool) return false;
+                    break;
+                case opcode::GET_LOCAL_CONST:
+                case opcode::ADD_LOCAL_CONST:
+                    if (b >= pool) return false;
+                    break;
+                case opcode::DEFINE_GLOBAL:
+                case opcode::GET_GLOBAL:
+                case opcode::SET_GLOBAL:
+                case opcode::GET_GLOBAL_CHECKED:
+                case opcode::SET_GLOBAL_CHECKED:
+                case opcode::SET_GLOBAL_POP:
+                    if (a >= globals) return false;
+                    break;
+                case opcode::CALL:
+                    if (b >= sites) return false;
+                    break;
+                case opcode::CALL_LOCAL:
+                    if (c >= sites) return false;
+                    break;
+                case opcode::CALL_GLOBAL:
+                    if (a >= globals || c >= sites) return false;
+                    break;
+                case opcode::GET_UPVALUE:
+                case opcode::SET_UPVALUE:
+                    if (a >= upvalues) return false;
+                    break;
+                case opcode::MAKE_CLOSURE: {
+                    // the compiler loads the function right before.
+                    if (previous == size) return false;
+                    const opcode load = static_cast<opcode>(code[previous]);
+                    const u64 load_width = operand_width(load);
+                    u64 index = 0;
+                    if (short_form(load) == opcode::LOAD_CONST)
+                        index = read_operand(code + previous + 1, load_width);
+                    else if (load == opcode::GET_LOCAL_CONST)
+                        index = read_operand(code + previous + 1 + load_width, load_width);
+                    else
+                        return false;
+                    if (chk.constant_pool.at(index).type() != vtype::FUNCTION) return false;
+                    for (u32 i{}; i < a; i++) {
+                        const u8* pair = at + 1 + width + 2 * i * width;
+                        const u32 local = read_operand(pair, width);
+                        if (local > 1 || (!local && read_operand(pair + width, width) >= upvalues)) return false;
+                    }
+                    if (a < closed.at(index)) closed.at(index) = a;
+                    break;
+                }
+                default:
+                    break;
+            }
+            previous = offset;
+        }
+
+        // branches only once every boundary is known.
+        for (u64 offset{}; offset < size; offset += instruction_size(code + offset)) {
+            if (!is_branch(static_cast<opcode>(code[offset]))) continue;
+            if (!lands(chk, offset)) return false;
+            targets.at(target_of(chk, offset)) = true;
+        }
+        return true;
+    }
+
+    // the stack depths, see find_stack_depths. max_stack has to cover
+    // them, and locals are read below the values the instruction takes.
+    bool check_depths(chunk& chk, u64 arity, bool script) {
+        const u8* code = chk.bytecode.data();
+        u32 peak = 0;
+        if (!find_stack_depths(chk, arity, script, depth_at, peak) || peak > chk.max_stack) return false;
+
+        for (u64 offset{}; offset < chk.bytecode.size(); offset += instruction_size(code + offset)) {
+            const i64 depth = depth_at.at(offset);
+            if (depth == -1) continue;
+            const u8* at = code + offset;
+            const opcode raw = static_cast<opcode>(*at);
+            const u64 width = operand_width(raw);
+            const u32 a = read_operand(at + 1, width);
+            const u32 b = read_operand(at + 1 + width, width);
+            switch (short_form(raw)) {
+                case opcode::GET_LOCAL:
+                case opcode::SET_LOCAL:
+                case opcode::GET_LOCAL_CONST:
+                case opcode::ADD_LOCAL_CONST:
+                case opcode::CALL_LOCAL:
+                    if (a >= depth) return false;
+                    break;
+                case opcode::GET_LOCALS:
+                    // b may be the local the first half just pushed.
+                    if (a >= depth || b > depth) return false;
+                    break;
+                case opcode::SET_LOCAL_POP:
+                    if (static_cast<i64>(a) + 1 >= depth) return false;
+                    break;
+                case opcode::MAKE_CLOSURE:
+                    // the function is on top, and no branch lands between
+                    // it and its load.
+                    if (targets.at(offset)) return false;
+                    for (u32 i{}; i < a; i++) {
+                        const u8* pair = at + 1 + width + 2 * i * width;
+                        if (read_operand(pair, width) && static_cast<i64>(read_operand(pair + width, width)) + 1 >= depth)
+                            return false;
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+        return true;
+    }
+
+    bool lands(chunk& chk, u64 offset) const {
+        const u8* at = chk.bytecode.data() + offset;
+        const u64 end = offset + instruction_size(at);
+        const u32 distance = read_operand(at + 1, operand_width(static_cast<opcode>(*at)));
+        if (short_form(static_cast<opcode>(*at)) == opcode::LOOP)
+            return distance <= end && starts.at(end - distance);
+        return end + distance < chk.bytecode.size() && starts.at(end + distance);
+    }
+
+    static u64 target_of(chunk& chk, u64 offset) {
+        const u8* at = chk.bytecode.data() + offset;
+        const u64 end = offset + instruction_size(at);
+        const u32 distance = read_operand(at + 1, operand_width(static_cast<opcode>(*at)));
+        return short_form(static_cast<opcode>(*at)) == opcode::LOOP ? end - distance : end + distance;
+    }
+
+    static bool is_branch(opcode op) {
+        switch (short_form(op)) {
+            case opcode::BRANCH:
+            case opcode::LOOP:
+            case opcode::BRANCH_FALSE:
+            case opcode::POP_BRANCH_FALSE:
+            case opcode::LESS_BRANCH_FALSE:
+            case opcode::LESS_BRANCH_TRUE:
+            case opcode::GREATER_BRANCH_FALSE:
+            case opcode::GREATER_BRANCH_TRUE:
+            case opcode::EQUAL_BRANCH_FALSE:
+            case opcode::EQUAL_BRANCH_TRUE:
+                return true;
+            default:
+                return false;
+        }
+    }
+};
+
+void write_header(writer& out, u64 hash, u8 flags, const std::string& payload) {
+    out.out.append(MAGIC, sizeof(MAGIC));
+    out.put(BYTECODE_FILE_VERSION);
+    out.put(static_cast<u32>(opcode::OPCODE_COUNT));
+    out.put(static_cast<u32>(regop::REGOP_COUNT));
+    out.put(static_cast<u32>(native_functions().size()));
+    out.put(hash);
+    out.put(flags);
+    out.put(fnv(payload.data(), payload.size()));
+}
+
+bool read_header(reader& in, u64 hash, u8 flags) {
+    const u8* magic = in.take(sizeof(MAGIC));
+    return magic != nullptr && memcmp(magic, MAGIC, sizeof(MAGIC)) == 0 &&
+           in.get<u32>() == BYTECODE_FILE_VERSION &&
+           in.get<u32>() == static_cast<u32>(opcode::OPCODE_COUNT) &&
+           in.get<u32>() == static_cast<u32>(regop::REGOP_COUNT) &&
+           in.get<u32>() == static_cast<u32>(native_functions().size()) &&
+           in.get<u64>() == hash &&
+           in.get<u8>() == static_cast<u8>(flags) &&
+           in.get<u64>() == in.rest_hash() && in.ok;
+}
+
+bool load(const u8* data, u64 size, u64 hash, u8 flags,
+          function& script, dynarray<value>& global_names) {
+    reader in(data, data + size);
+    if (!read_header(in, hash, flags)) return false;
+
+    dynarray<value> names;
+    const u32 count = in.count(sizeof(u32));
+    for (u32 i{}; i < count; i++) {
+        const string name = in.str();
+        names.push_back(value(&name, vtype::STRING));
+    }
+    const string name = in.str();
+    const u64 arity = in.get<u64>();
+    function f(name, arity);
+    in.read_chunk(f.get_chunk());
+    if (!in.ok || !in.done()) return false;
+    if (!verifier(names.size(), flags & BYTECODE_REGISTERS).check(f, 0, true)) return false;
+
+    script = stealable(f);
+    global_names = stealable(names);
+    return true;
+}
+
+} // namespace
+
+u64 source_hash(const u8* source, u64 size) {
+    return fnv(source, size);
+}
+
+bool write_bytecode_file(const std::filesystem::path& path, u64 hash, u8 flags,
+                         function& script, const dynarray<value>& global_names) {
+    writer payload;
+    payload.put(static_cast<u32>(global_names.size()));
+    for (u64 i{}; i < global_names.size(); i++) {
+        payload.str(*static_cast<string*>(global_names.at(i).obj()));
+    }
+    payload.fn(script);
+    if (!payload.ok) return false;
+    writer out;
+    write_header(out, hash, flags, payload.out);
+    out.out.append(payload.out);
+
+    // written to the side and renamed over the old one, so nothing ever
+    // reads half a file.
+    std::filesystem::path temp = path;
+#ifdef STING_MMAP
+    temp += "." + std::to_string(getpid());
+#endif
+    temp += ".tmp";
+    std::error_code error;
+    {
+        std::ofstream f(temp, std::ios::binary | std::ios::trunc);
+        f.write(out.out.data(), out.out.size());
+        if (!f) {
+            std::filesystem::remove(temp, error);
+            return false;
+        }
+    }
+    std::filesystem::rename(temp, path, error);
+    if (error) {
+        std::filesystem::remove(temp, error);
+        return false;
+    }
+    return true;
+}
+
+bool read_bytecode_file(const std::filesystem::path& path, u64 hash, u8 flags,
+                        function& script, dynarray<value>& global_names) {
+    const mapped_file data(path);
+    return data.is_open() && load(data.data(), data.size(), hash, flags, script, global_names);
+}
+
+} // namespace sting
@@ -0,0 +1,59 @@
+#ifndef BYTECODE_FILE_HPP
+#define BYTECODE_FILE_HPP
+
+#include "utilities.hpp"
+#include "dynarray.hpp"
+#include "value.hpp"
+#include "function.hpp"
+
+namespace sting {
+
+/*
+ *  Compiled bytecode files (.stingc).
+ *
+ *  interpret writes the compiled script next to its source, foo.sting gets
+ *  foo.stingc, and the next run loads that instead of tokenizing and
+ *  parsing again. it's only used when it was written for the same source
+ *  (a hash of its contents), by the same build (the format version,
+ *  the opcode counts and the number of natives, which have the first
+ *  global slots) and with the same compiler flags. anything else is
+ *  compiled again, and the file rewritten. STING_NO_CACHE turns it off.
+ *
+ *  the file is a header, the global names and then the script function.
+ *  a function is its name, arity and chunk: bytecode, constants, line
+ *  table, max_stack and the number of call sites, the register code is
+ *  translated again on load. a constant is its vtype and then its
+ *  contents, functions nested inside their parent's constants. upvalue
+ *  descriptors are MAKE_CLOSURE's operands, so they're in the bytecode.
+ *  everything is in native byte order, it's a cache and not a format to
+ *  move between machines.
+ *
+ *  the header ends with a hash of everything after it, and the code is
+ *  verified before it runs (bytecode_file.cpp). a file that fails either
+ *  is compiled again, the same as a stale one.
+ */
+
+const u32 BYTECODE_FILE_VERSION = 4;
+
+// the compiler settings the code was compiled with, they have to match.
+enum bytecode_flags : u8 {
+    BYTECODE_OPTIMIZED = 1,
+    BYTECODE_REGISTERS = 2,
+};
+
+// the source's hash, what a bytecode file has to have been written for.
+u64 source_hash(const u8* source, u64 size);
+
+// writes script and global_names to path, false if it couldn't. a file
+// that's there already is only replaced once the new one is complete.
+bool write_bytecode_file(const std::filesystem::path& path, u64 hash, u8 flags,
+                         function& script, const dynarray<value>& global_names);
+
+// loads path into script and global_names, false when there's no file or
+// it isn't for this hash, flags and build. they're left as they were then.
+bool read_bytecode_file(const std::filesystem::path& path, u64 hash, u8 flags,
+                        function& script, dynarray<value>& global_names);
+
+} // namespace sting
+
+#endif
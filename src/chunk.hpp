@@ -8,9 +8,12 @@
 
 namespace sting {
 
+struct jit_code;
+
 enum class opcode {
     RETURN,
     LOAD_CONST,
+    LOAD_CONST_LONG, // u32 index, when the pool outgrows LOAD_CONST's u16
     NEGATE,
     NOT,
     ADD,
@@ -29,6 +32,8 @@ enum class opcode {
     DEFINE_GLOBAL,
     GET_GLOBAL,
     SET_GLOBAL,
+    GET_GLOBAL_CHECKED, // may run before the global is defined
+    SET_GLOBAL_CHECKED,
     GET_LOCAL,
     SET_LOCAL,
     BRANCH_FALSE,
@@ -41,16 +46,237 @@ enum class opcode {
     CLOSE_VALUE,
     SAVE_VALUE, // save and load to scratch value
     LOAD_VALUE,
+
+    // wide forms, write_instruction picks one when an operand doesn't fit
+    // the short form. same operands as the short op, each u32, see short_form.
+    POPN_LONG,
+    GET_LOCAL_LONG,
+    SET_LOCAL_LONG,
+    BRANCH_FALSE_LONG,
+    BRANCH_LONG,
+    LOOP_LONG,
+    CALL_LONG,
+    MAKE_CLOSURE_LONG,
+    GET_UPVALUE_LONG,
+    SET_UPVALUE_LONG,
+
+    // superinstructions, only the optimizer emits these. each one is a
+    // common sequence of the ops above (picked from the profiler's hot
+    // pairs on the bench workloads), see select_superinstructions.
+    GET_LOCALS,           // GET_LOCAL a, GET_LOCAL b
+    GET_LOCAL_CONST,      // GET_LOCAL a, LOAD_CONST k
+    ADD_LOCAL_CONST,      // GET_LOCAL a, LOAD_CONST k, ADD, SET_LOCAL a, POP
+    SET_LOCAL_POP,        // SET_LOCAL a, POP
+    SET_GLOBAL_POP,       // SET_GLOBAL slot, POP
+    CALL_LOCAL,           // GET_LOCAL a, CALL n
+    CALL_GLOBAL,          // GET_GLOBAL slot, CALL n
+    POP_BRANCH_FALSE,     // BRANCH_FALSE, with the POP on both paths
+    LESS_BRANCH_FALSE,    // LESS, POP_BRANCH_FALSE
+    LESS_BRANCH_TRUE,     // LESS, NOT, POP_BRANCH_FALSE
+    GREATER_BRANCH_FALSE, // GREATER, POP_BRANCH_FALSE
+    GREATER_BRANCH_TRUE,  // GREATER, NOT, POP_BRANCH_FALSE
+    EQUAL_BRANCH_FALSE,   // EQUAL, POP_BRANCH_FALSE
+    EQUAL_BRANCH_TRUE,    // EQUAL, NOT, POP_BRANCH_FALSE
+
+    // quickened forms, only the interpreter writes these. the first time a
+    // generic op runs on numbers (or strings for ADD) it rewrites itself in
+    // place to the form for them, which skips the type dispatch. when the
+    // types stop matching the quickened form puts the generic op back, and
+    // runs that. same operands as the generic op, see generic_form.
+    ADD_NUMBERS,
+    ADD_STRINGS,
+    SUBTRACT_NUMBERS,
+    MULTIPLY_NUMBERS,
+    DIVIDE_NUMBERS,
+    GREATER_NUMBERS,
+    LESS_NUMBERS,
+    EQUAL_NUMBERS,
+    ADD_LOCAL_CONST_NUMBERS,
+    LESS_BRANCH_FALSE_NUMBERS,
+    LESS_BRANCH_TRUE_NUMBERS,
+    GREATER_BRANCH_FALSE_NUMBERS,
+    GREATER_BRANCH_TRUE_NUMBERS,
+    EQUAL_BRANCH_FALSE_NUMBERS,
+    EQUAL_BRANCH_TRUE_NUMBERS,
+
+    OPCODE_COUNT, // not an opcode, keep last.
 };
 
 std::string opcode_to_string(opcode op);
 
-// when rewriting, needs to be a stream of bytes. instructions can be variable length.
-struct instruction {
-    opcode op;
-    dynarray<u32> operands;
+// the op a quickened one was rewritten from, any other op is its own.
+// everything that reads bytecode after it started running goes through this.
+inline opcode generic_form(opcode op) {
+    switch (op) {
+        case opcode::ADD_NUMBERS:
+        case opcode::ADD_STRINGS: return opcode::ADD;
+        case opcode::SUBTRACT_NUMBERS: return opcode::SUBTRACT;
+        case opcode::MULTIPLY_NUMBERS: return opcode::MULTIPLY;
+        case opcode::DIVIDE_NUMBERS: return opcode::DIVIDE;
+        case opcode::GREATER_NUMBERS: return opcode::GREATER;
+        case opcode::LESS_NUMBERS: return opcode::LESS;
+        case opcode::EQUAL_NUMBERS: return opcode::EQUAL;
+        case opcode::ADD_LOCAL_CONST_NUMBERS: return opcode::ADD_LOCAL_CONST;
+        case opcode::LESS_BRANCH_FALSE_NUMBERS: return opcode::LESS_BRANCH_FALSE;
+        case opcode::LESS_BRANCH_TRUE_NUMBERS: return opcode::LESS_BRANCH_TRUE;
+        case opcode::GREATER_BRANCH_FALSE_NUMBERS: return opcode::GREATER_BRANCH_FALSE;
+        case opcode::GREATER_BRANCH_TRUE_NUMBERS: return opcode::GREATER_BRANCH_TRUE;
+        case opcode::EQUAL_BRANCH_FALSE_NUMBERS: return opcode::EQUAL_BRANCH_FALSE;
+        case opcode::EQUAL_BRANCH_TRUE_NUMBERS: return opcode::EQUAL_BRANCH_TRUE;
+        default: return op;
+    }
+}
+
+// the op a wide one widens, any other op is its own.
+inline opcode short_form(opcode op) {
+    switch (op) {
+        case opcode::LOAD_CONST_LONG: return opcode::LOAD_CONST;
+        case opcode::POPN_LONG: return opcode::POPN;
+        case opcode::GET_LOCAL_LONG: return opcode::GET_LOCAL;
+        case opcode::SET_LOCAL_LONG: return opcode::SET_LOCAL;
+        case opcode::BRANCH_FALSE_LONG: return opcode::BRANCH_FALSE;
+        case opcode::BRANCH_LONG: return opcode::BRANCH;
+        case opcode::LOOP_LONG: return opcode::LOOP;
+        case opcode::CALL_LONG: return opcode::CALL;
+        case opcode::MAKE_CLOSURE_LONG: return opcode::MAKE_CLOSURE;
+        case opcode::GET_UPVALUE_LONG: return opcode::GET_UPVALUE;
+        case opcode::SET_UPVALUE_LONG: return opcode::SET_UPVALUE;
+        default: return op;
+    }
+}
+
+// the wide form of op, OPCODE_COUNT if it has none.
+inline opcode long_form(opcode op) {
+    switch (op) {
+        case opcode::LOAD_CONST: return opcode::LOAD_CONST_LONG;
+        case opcode::POPN: return opcode::POPN_LONG;
+        case opcode::GET_LOCAL: return opcode::GET_LOCAL_LONG;
+        case opcode::SET_LOCAL: return opcode::SET_LOCAL_LONG;
+        case opcode::BRANCH_FALSE: return opcode::BRANCH_FALSE_LONG;
+        case opcode::BRANCH: return opcode::BRANCH_LONG;
+        case opcode::LOOP: return opcode::LOOP_LONG;
+        case opcode::CALL: return opcode::CALL_LONG;
+        case opcode::MAKE_CLOSURE: return opcode::MAKE_CLOSURE_LONG;
+        case opcode::GET_UPVALUE: return opcode::GET_UPVALUE_LONG;
+        case opcode::SET_UPVALUE: return opcode::SET_UPVALUE_LONG;
+        default: return opcode::OPCODE_COUNT;
+    }
+}
+
+// bytecode is a stream of bytes: one byte of opcode followed by its inline
+// operands, stored in native byte order. operand_width is the size of each
+// operand, all operands of an instruction have the same width.
+// MAKE_CLOSURE is the only variable length instruction, its first operand
+// is the number of (local, index) pairs that follow. the calls' last
+// operand is their call site, an index into chunk::call_cache.
+inline u64 operand_width(opcode op) {
+    if (short_form(op) != op)
+        return 4;
+    switch (generic_form(op)) {
+        case opcode::LOAD_CONST:
+        case opcode::BRANCH_FALSE:
+        case opcode::BRANCH:
+        case opcode::LOOP:
+        case opcode::GET_LOCAL_CONST:
+        case opcode::ADD_LOCAL_CONST:
+        case opcode::CALL:
+        case opcode::CALL_LOCAL:
+        case opcode::POP_BRANCH_FALSE:
+        case opcode::LESS_BRANCH_FALSE:
+        case opcode::LESS_BRANCH_TRUE:
+        case opcode::GREATER_BRANCH_FALSE:
+        case opcode::GREATER_BRANCH_TRUE:
+        case opcode::EQUAL_BRANCH_FALSE:
+        case opcode::EQUAL_BRANCH_TRUE:
+            return 2;
+        case opcode::DEFINE_GLOBAL:
+        case opcode::GET_GLOBAL:
+        case opcode::SET_GLOBAL:
+        case opcode::GET_GLOBAL_CHECKED:
+        case opcode::SET_GLOBAL_CHECKED:
+        case opcode::SET_GLOBAL_POP:
+        case opcode::CALL_GLOBAL:
+            return 4;
+        case opcode::POPN:
+        case opcode::GET_LOCAL:
+        case opcode::SET_LOCAL:
+        case opcode::MAKE_CLOSURE:
+        case opcode::GET_UPVALUE:
+        case opcode::SET_UPVALUE:
+        case opcode::GET_LOCALS:
+        case opcode::SET_LOCAL_POP:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+inline bool operand_fits(u32 a, u64 width) {
+    return width >= sizeof(u32) || a >> (width * 8) == 0;
+}
+
+// the form of op that a fits in: op, or its wide form if it has one.
+inline opcode form_for(opcode op, u32 a) {
+    if (!operand_fits(a, operand_width(op)) && long_form(op) != opcode::OPCODE_COUNT)
+        return long_form(op);
+    return op;
+}
+
+// number of fixed operands, MAKE_CLOSURE's pairs aren't counted.
+inline u64 operand_count(opcode op) {
+    switch (short_form(generic_form(op))) {
+        case opcode::GET_LOCALS:
+        case opcode::GET_LOCAL_CONST:
+        case opcode::ADD_LOCAL_CONST:
+        case opcode::CALL:
+            return 2;
+        case opcode::CALL_LOCAL:
+        case opcode::CALL_GLOBAL:
+            return 3;
+        default:
+            return operand_width(op) > 0 ? 1 : 0;
+    }
+}
+
+inline u32 read_operand(const u8* code, u64 width) {
+    switch (width) {
+        case 1: return static_cast<uint8_t>(*code);
+        case 2: {
+            uint16_t v;
+            memcpy(&v, code, sizeof(v));
+            return v;
+        }
+        case 4: {
+            u32 v;
+            memcpy(&v, code, sizeof(v));
+            return v;
+        }
+        default:
+            return 0;
+    }
+}
+
+// size in bytes of the instruction starting at code, including the opcode.
+inline u64 instruction_size(const u8* code) {
+    const opcode op = static_cast<opcode>(*code);
+    const u64 width = operand_width(op);
+    if (short_form(op) == opcode::MAKE_CLOSURE)
+        return 1 + width + 2 * width * read_operand(code + 1, width);
+    return 1 + width * operand_count(op);
+}
+
+// line table is run length encoded, one entry per run of bytes on the same line.
+struct line_run {
+    u64 offset; // first byte of the run
+    u64 line;
+};
 
-    friend std::ostream& operator<<(std::ostream& os, const instruction& instr);
+// a loop of the chunk, found by its header: where its LOOP jumps back to.
+struct loop_record {
+    u64 header;
+    u32 count;      // times the LOOP ran without a trace
+    u32 recordings; // traces started, they can fail or go stale
+    jit_code* trace;
 };
 
 struct chunk {
@@ -58,28 +284,66 @@ struct chunk {
     // could just use my string
     chunk(const std::string& name) : name(name) {}
     std::string name; // should be sting::string
-    dynarray<instruction> bytecode;
-    // globals (functions, strs, global names)
+    dynarray<u8> bytecode;
+    // functions and strs. globals are slots, see compiler::resolve_global
     dynarray<value> constant_pool;
-    dynarray<u64> lines;
+    dynarray<line_run> lines;
+    // the most a call to this chunk grows the value stack above its
+    // arguments, the deepest point on any path (find_stack_depths). set
+    // once the chunk is finished.
+    u32 max_stack = 0;
+    // highest offset a branch lands on so far, only meaningful while
+    // compiling. code before it can't be rewritten in place.
+    u64 last_label = 0;
+    // the same code for the register vm (registers.hpp), only filled in
+    // when it's the one that runs.
+    dynarray<u32> register_code;
+    u32 register_count = 0;
+    // calls so far, and the native code once there were enough (jit.hpp).
+    // the code isn't owned, copies of the chunk share it.
+    u32 calls = 0;
+    jit_code* jit = nullptr;
+    // the loops that ran in the interpreter, with their traces.
+    dynarray<loop_record> loops;
+    // per call site, the callee it last called (vmachine::call_cached), nil
+    // before the first call. the callee got past the type and arity checks
+    // with the site's argument count. marked by the function, like the pool.
+    dynarray<value> call_cache;
 
-    void write_instruction(const opcode op, u64 line, u32 a = 0) {
-        instruction instr = {
-            .op = op,
-            .operands = dynarray<u32>({ a }),
-        };
+    void write_instruction(opcode op, u64 line, u32 a = 0) {
+        op = form_for(op, a);
 
-        lines.push_back(line);
-        bytecode.push_back(instr);
+        write_line(line);
+        bytecode.push_back(static_cast<u8>(op));
+        write_operand(a, operand_width(op));
     }
 
-    void write_instruction(const opcode op, u64 line, const dynarray<u32>& operands) {
-        instruction instr = {
-            .op = op,
-            .operands = operands,
-        };
-        lines.push_back(line);
-        bytecode.push_back(instr);
+    void write_instruction(opcode op, u64 line, const dynarray<u32>& operands) {
+        for (u64 i{}; i < operands.size(); i++) {
+            op = form_for(op, operands.at(i));
+        }
+
+        write_line(line);
+        bytecode.push_back(static_cast<u8>(op));
+        for (u64 i{}; i < operands.size(); i++) {
+            write_operand(operands.at(i), operand_width(op));
+        }
+    }
+
+    // overwrite an operand already in the bytecode, used for backpatching.
+    void patch_operand(u64 offset, u32 a, u64 width) {
+        check_operand(a, width);
+        memcpy(bytecode.data() + offset, &a, width);
+    }
+
+    // drop the code from offset on, to emit something else in its place.
+    void truncate(u64 offset) {
+        while (bytecode.size() > offset) {
+            bytecode.pop_back();
+        }
+        while (lines.size() > 0 && lines.back().offset >= offset) {
+            lines.pop_back();
+        }
     }
 
     u32 load_constant(const value& val) {
@@ -88,32 +352,87 @@ struct chunk {
         return index;
     }
 
+    u32 add_call_site() {
+        call_cache.push_back(value());
+        return call_cache.size() - 1;
+    }
+
+    loop_record& loop_at(u64 header) {
+        for (u64 i{}; i < loops.size(); i++) {
+            if (loops.data()[i].header == header)
+                return loops.data()[i];
+        }
+        loops.push_back(loop_record{ .header = header, .count = 0, .recordings = 0, .trace = nullptr });
+        return loops.back();
+    }
+
+    u64 line_at(u64 offset) const {
+        u64 line = 0;
+        for (u64 i{}; i < lines.size() && lines.at(i).offset <= offset; i++) {
+            line = lines.at(i).line;
+        }
+        return line;
+    }
+
     friend std::ostream& operator<<(std::ostream& os, const chunk& chk);
 
-    ~chunk() {}
-};
+private:
+    // ops with a wide form never get here with an operand too large, the
+    // superinstructions are only picked when theirs fit.
+    static void check_operand(u32 a, u64 width) {
+        panic_if(!operand_fits(a, width), "chunk: operand too large for its encoding");
+    }
 
-inline std::ostream& operator<<(std::ostream& os, const instruction& instr) {
-    os << opcode_to_string(instr.op) << ": " << instr.operands;
-    return os;
-}
+    void write_operand(u32 a, u64 width) {
+        check_operand(a, width);
+        const u8* bytes = reinterpret_cast<const u8*>(&a);
+        for (u64 i{}; i < width; i++) {
+            bytecode.push_back(bytes[i]);
+        }
+    }
+
+    void write_line(u64 line) {
+        if (lines.size() > 0 && lines.back().line == line)
+            return;
+        lines.push_back(line_run{ .offset = bytecode.size(), .line = line });
+    }
+};
 
 inline std::ostream& operator<<(std::ostream& os, const chunk& chk) {
     os << "---- CHUNK: " << chk.name << " ---- \n";
-    for (u64 i{0}; i < chk.bytecode.size(); i++) {
-        os << std::setw(3) << std::setfill(' ') << i + 1 << ": ";
-        const instruction& instr = chk.bytecode.at(i);
-        os << instr << "\t";
-        switch (instr.op) {
+    const u8* code = chk.bytecode.data();
+    for (u64 offset{0}; offset < chk.bytecode.size(); offset += instruction_size(code + offset)) {
+        const opcode op = static_cast<opcode>(code[offset]);
+        const u64 width = operand_width(op);
+        os << std::setw(4) << std::setfill('0') << offset << ": ";
+        os << opcode_to_string(op);
+        if (width > 0) {
+            const u64 count = short_form(op) == opcode::MAKE_CLOSURE ?
+                1 + 2 * read_operand(code + offset + 1, width) : operand_count(op);
+            os << ":";
+            for (u64 i{}; i < count; i++) {
+                os << " " << read_operand(code + offset + 1 + i * width, width);
+            }
+        }
+        os << "\t";
+        switch (short_form(generic_form(op))) {
             case opcode::LOAD_CONST: {
-                const value& data = chk.constant_pool.at(instr.operands.at(0));
+                const value& data = chk.constant_pool.at(read_operand(code + offset + 1, width));
+                os << "Value(" << data << ")";
+                os << "\t";
+                break;
+            }
+            case opcode::GET_LOCAL_CONST:
+            case opcode::ADD_LOCAL_CONST: {
+                const value& data = chk.constant_pool.at(read_operand(code + offset + 1 + width, width));
                 os << "Value(" << data << ")";
                 os << "\t";
+                break;
             }
             default: {
             }
         }
-        os << "\tline: " << chk.lines.at(i) << "\n";
+        os << "\tline: " << chk.line_at(offset) << "\n";
     }
     return os;
 }
@@ -1,22 +1,30 @@
 #include "closure.hpp"
 #include "object.hpp"
+#include "gc.hpp"
 
 namespace sting {
 
 rtupvalue::rtupvalue() : _value_stack_index(0), _next(nullptr), closed() {}
 rtupvalue::rtupvalue(const u64 v) : _value_stack_index(v), _next(nullptr), closed() {}
 rtupvalue::rtupvalue(rtupvalue * next) : _value_stack_index(0), _next(next), closed() {}
-rtupvalue::rtupvalue(const rtupvalue& other) : _value_stack_index(other._value_stack_index), _next(other._next), closed(other.closed) {}
+rtupvalue::rtupvalue(const rtupvalue& other) :
+    object(),
+    closed(other.closed),
+    is_closed(other.is_closed),
+    _value_stack_index(other._value_stack_index),
+    _next(other._next) {}
 rtupvalue::rtupvalue(rtupvalue&& other) :
+    closed(exchange(other.closed, value())),
+    is_closed(exchange(other.is_closed, false)),
     _value_stack_index(exchange(other._value_stack_index, 0)),
-    _next(exchange(other._next, nullptr)),
-    closed(exchange(other.closed, value())) {}
+    _next(exchange(other._next, nullptr)) {}
 
 rtupvalue& rtupvalue::operator=(const rtupvalue& other) {
     if (this != &other) {
         _value_stack_index = other._value_stack_index;
         _next = other._next;
         closed = other.closed;
+        is_closed = other.is_closed;
     }
     return *this;
 }
@@ -26,18 +34,31 @@ rtupvalue& rtupvalue::operator=(rtupvalue&& other) {
         _value_stack_index = exchange(other._value_stack_index, 0);
         _next = exchange(other._next, nullptr);
         closed = exchange(other.closed, value());
+        is_closed = exchange(other.is_closed, false);
     }
     return *this;
 }
 
 rtupvalue::~rtupvalue() {
-    // _value_stack_index or _next is not owned. should be by object_list
+    // _next is not owned, it is another heap object.
 }
 
 object *rtupvalue::clone() const {
-    object *c = new rtupvalue(*this);
-    object_list.push_back(c);
-    return c;
+    return gc.make<rtupvalue>(*this);
+}
+
+object *rtupvalue::relocate() {
+    return new rtupvalue(stealable(*this));
+}
+
+// open upvalues are reached (and their _next rewritten) through
+// vmachine::open_upvalues, not through each other.
+void rtupvalue::trace(collector& gc) {
+    gc.mark_value(closed);
+}
+
+u64 rtupvalue::footprint() const {
+    return sizeof(rtupvalue);
 }
 
 u8 *rtupvalue::cstr() const {
@@ -50,15 +71,13 @@ std::ostream& operator<<(std::ostream& os, const rtupvalue& u) {
 }
 
 rtupvalue *rtupvalue::new_upvalue(const u64 v) {
-    rtupvalue* uv = new rtupvalue(v);
-    object_list.push_back(uv);
-    return uv;
+    return gc.make<rtupvalue>(v);
 }
 
-closure::closure() : f(), _upvalues() {}
-closure::closure(const function& f) : f(f), _upvalues() {}
-closure::closure(const closure& other) : f(other.f), _upvalues(other._upvalues) {}
-closure::closure(closure&& other) : f(stealable(other.f)), _upvalues(stealable(other._upvalues)) {}
+closure::closure() : f(nullptr), _upvalues() {}
+closure::closure(function* f) : f(f), _upvalues() {}
+closure::closure(const closure& other) : object(), f(other.f), _upvalues(other._upvalues) {}
+closure::closure(closure&& other) : f(exchange(other.f, nullptr)), _upvalues(stealable(other._upvalues)) {}
 
 closure& closure::operator=(const closure& other) {
     if (this != &other) {
@@ -70,24 +89,37 @@ closure& closure::operator=(const closure& other) {
 
 closure& closure::operator=(closure&& other) {
     if (this != &other) {
-        f = stealable(other.f);
+        f = exchange(other.f, nullptr);
         _upvalues = stealable(other._upvalues);
     }
     return *this;
 }
 
 object *closure::clone() const {
-    object *c = new closure(*this);
-    object_list.push_back(c);
-    return c;
+    return gc.make<closure>(*this);
+}
+
+object *closure::relocate() {
+    return new closure(stealable(*this));
+}
+
+void closure::trace(collector& gc) {
+    gc.mark(f);
+    for (u64 i{}; i < _upvalues.size(); i++) {
+        gc.mark(_upvalues.data()[i]);
+    }
+}
+
+u64 closure::footprint() const {
+    return sizeof(closure) + _upvalues.capacity() * sizeof(rtupvalue*);
 }
 
 u8 *closure::cstr() const {
-    return f.cstr();
+    return f->cstr();
 }
 
 std::ostream& operator<<(std::ostream& os, const closure& c) {
-    os << c.f;
+    os << *c.f;
     return os;
 }
 
@@ -19,7 +19,10 @@ public:
     ~rtupvalue();
 
     object *clone() const override;
+    object *relocate() override;
     u8 *cstr() const override;
+    void trace(collector& gc) override;
+    u64 footprint() const override;
     friend std::ostream& operator<<(std::ostream& os, const rtupvalue& c);
     static rtupvalue *new_upvalue(const u64 v);
     u64 value_stack_index() const { return _value_stack_index; }
@@ -35,24 +38,28 @@ private:
 class closure : public object {
 public:
     closure();
-    closure(const function& f);
+    closure(function* f);
     closure(const closure& other);
     closure(closure&& other);
     closure& operator=(const closure& other);
     closure& operator=(closure&& other);
 
     object *clone() const override;
+    object *relocate() override;
     u8 *cstr() const override;
+    void trace(collector& gc) override;
+    u64 footprint() const override;
 
-    u64& get_arity() { return f.get_arity(); }
-    chunk& get_chunk() { return f.get_chunk(); }
+    u64& get_arity() { return f->get_arity(); }
+    chunk& get_chunk() { return f->get_chunk(); }
+    function* get_function() { return f; }
     dynarray<rtupvalue*>& get_upvalues() { return _upvalues; }
 
     friend std::ostream& operator<<(std::ostream& os, const closure& c);
 private:
-    function f;
+    function* f; // heap function, shared by every closure made from it
     dynarray<rtupvalue*> _upvalues;
-    // NOTE: upvalues not owned by closure.
+    // NOTE: upvalues not owned by closure, they are heap objects of their own.
 };
 } // namespace sting
 
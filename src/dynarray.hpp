@@ -49,6 +49,7 @@ public:
 
     dynarray& operator=(dynarray&& other) {
         if (this != &other) {
+            free_array(_data);
             steal_array(sting::stealable(other));
         }
         return *this;
@@ -61,9 +62,11 @@ public:
     u64 capacity() const { return _capacity; }
 
     T& at(u64 index) const {
-        std::ostringstream err;
-        err << "dynarray::at(): Index (" << index << ") out of bounds " << _size << ".";
-        panic_if(index >= _size, err.str(), -1);
+        if (index >= _size) {
+            std::ostringstream err;
+            err << "dynarray::at(): Index (" << index << ") out of bounds " << _size << ".";
+            panic(err.str(), -1);
+        }
         return _data[index];
     }
 
@@ -78,7 +81,7 @@ public:
 
     T pop_back() {
         panic_if(_size == 0, "dynarray::pop_back(): cannot pop_back on array of size 0");
-        T ret = this->at(_size - 1);
+        T ret = _data[_size - 1];
         _size--;
         _data[_size].~T();
         return ret;
@@ -1,4 +1,5 @@
 #include "function.hpp"
+#include "gc.hpp"
 
 namespace sting {
 
@@ -12,6 +13,7 @@ function::function(const string& name, u64 arity) :
 }
 
 function::function(const function& other) :
+    object(),
     name(other.name),
     arity(other.arity),
     chk(other.chk)
@@ -54,9 +56,29 @@ u32 function::load_constant(const value& val) {
 }
 
 object *function::clone() const {
-    object *func = new function(*this);
-    object_list.push_back(func);
-    return func;
+    return gc.make<function>(*this);
+}
+
+object *function::relocate() {
+    return new function(stealable(*this));
+}
+
+void function::trace(collector& gc) {
+    for (u64 i{}; i < chk.constant_pool.size(); i++) {
+        gc.mark_value(chk.constant_pool.data()[i]);
+    }
+    for (u64 i{}; i < chk.call_cache.size(); i++) {
+        gc.mark_value(chk.call_cache.data()[i]);
+    }
+}
+
+u64 function::footprint() const {
+    return sizeof(function) + name.size() +
+           chk.bytecode.capacity() +
+           chk.constant_pool.capacity() * sizeof(value) +
+           chk.call_cache.capacity() * sizeof(value) +
+           chk.lines.capacity() * sizeof(line_run) +
+           chk.register_code.capacity() * sizeof(u32);
 }
 
 u8 *function::cstr() const {
@@ -17,12 +17,16 @@ public:
     function& operator=(function&& other);
 
     chunk& get_chunk() { return chk; }
+    const string& get_name() const { return name; }
     u64& get_arity() { return arity; }
     void write_instruction(const opcode op, u64 line, u32 a = 0);
     void write_instruction(const opcode op, u64 line, const dynarray<u32>& operands);
     u32 load_constant(const value& val);
     object *clone() const override;
+    object *relocate() override;
     u8 *cstr() const override;
+    void trace(collector& gc) override;
+    u64 footprint() const override;
 
     friend std::ostream& operator<<(std::ostream& os, const function& func);
 private:
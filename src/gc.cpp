@@ -0,0 +1,263 @@
+#include "gc.hpp"
+#include "string.hpp"
+
+namespace sting {
+
+// the collector clears the intern table when it frees everything, so the
+// table has to outlive it: same translation unit, defined first.
+intern_table interned_strings;
+collector gc;
+
+collector::collector() :
+    nursery_start(nullptr),
+    nursery_top(nullptr),
+    nursery_end(nullptr),
+    young_bytes(0),
+    young_limit(0),
+    objects(nullptr),
+    gray(),
+    remembered(),
+    bytes_allocated(0),
+    next_gc(DEFAULT_GC_THRESHOLD),
+    min_threshold(DEFAULT_GC_THRESHOLD),
+    heap_growth(DEFAULT_GC_HEAP_GROWTH),
+    minor(false),
+    pause_start(),
+    _stats()
+{
+    configure(DEFAULT_NURSERY_SIZE, DEFAULT_GC_THRESHOLD, DEFAULT_GC_HEAP_GROWTH);
+}
+
+collector::~collector() {
+    free_all();
+    free(nursery_start);
+}
+
+void collector::track_old(object* o) {
+    o->gc_cell = 0;
+    o->gc_bytes = o->footprint();
+    o->gc_next = objects;
+    objects = o;
+    bytes_allocated += o->gc_bytes;
+    if (bytes_allocated > _stats.peak_bytes)
+        _stats.peak_bytes = bytes_allocated;
+}
+
+void collector::remember(object* o) {
+    o->gc_remembered = true;
+    remembered.push_back(o);
+}
+
+// move o into the old space, leaving its new address behind in gc_next.
+object* collector::promote(object* o) {
+    object* moved = o->relocate();
+    o->gc_next = moved;
+    track_old(moved);
+    _stats.objects_promoted++;
+    _stats.bytes_promoted += moved->gc_bytes;
+    return moved;
+}
+
+void collector::mark_object(object*& o) {
+    if (o == nullptr) return;
+
+    if (minor) {
+        if (!is_young(o)) return;
+        if (o->gc_next != nullptr) {
+            o = o->gc_next; // already promoted
+            return;
+        }
+        o = promote(o);
+        gray.push_back(o);
+        return;
+    }
+
+    if (o->gc_marked) return;
+    o->gc_marked = true;
+    gray.push_back(o);
+}
+
+void collector::mark_value(value& v) {
+    if (!v.is_object()) return;
+    object* o = v.obj();
+    mark_object(o);
+    if (o != v.obj())
+        v.retarget(o);
+}
+
+void collector::trace_references() {
+    while (gray.size() > 0) {
+        object* o = gray.pop_back();
+        o->trace(*this);
+    }
+}
+
+void collector::begin_minor() {
+    pause_start = std::chrono::steady_clock::now();
+    minor = true;
+}
+
+void collector::finish_minor() {
+    // old objects holding young references are roots too.
+    for (u64 i{}; i < remembered.size(); i++) {
+        object* o = remembered.data()[i];
+        o->gc_remembered = false;
+        o->trace(*this);
+    }
+    remembered = dynarray<object*>();
+
+    trace_references();
+    interned_strings.sweep_young();
+    sweep_nursery();
+    minor = false;
+    end_pause(true);
+}
+
+// everything reachable has been promoted, whatever is left is garbage or
+// the moved-from shell of a promoted object.
+void collector::sweep_nursery() {
+    u8* cell = nursery_start;
+    while (cell < nursery_top) {
+        object* o = reinterpret_cast<object*>(cell);
+        const u64 size = o->gc_cell;
+        if (o->gc_next == nullptr) {
+            _stats.objects_freed++;
+            _stats.bytes_freed += o->gc_bytes;
+        }
+        o->~object();
+        cell += size;
+    }
+    nursery_top = nursery_start;
+    young_bytes = 0;
+}
+
+// a major collection needs an empty nursery, run a minor one first.
+void collector::begin_major() {
+    panic_if(nursery_top != nursery_start, "collector: major collection with a non empty nursery");
+    pause_start = std::chrono::steady_clock::now();
+    minor = false;
+}
+
+void collector::finish_major() {
+    trace_references();
+    interned_strings.sweep_old();
+    sweep();
+    next_gc = bytes_allocated * heap_growth;
+    if (next_gc < min_threshold)
+        next_gc = min_threshold;
+    end_pause(false);
+}
+
+void collector::sweep() {
+    object* previous = nullptr;
+    object* current = objects;
+    while (current != nullptr) {
+        if (current->gc_marked) {
+            current->gc_marked = false;
+            previous = current;
+            current = current->gc_next;
+            continue;
+        }
+
+        object* unreached = current;
+        current = current->gc_next;
+        if (previous == nullptr) {
+            objects = current;
+        } else {
+            previous->gc_next = current;
+        }
+
+        bytes_allocated -= unreached->gc_bytes;
+        _stats.bytes_freed += unreached->gc_bytes;
+        _stats.objects_freed++;
+        delete unreached;
+    }
+}
+
+void collector::end_pause(bool minor) {
+    const std::chrono::duration<f64, std::milli> pause =
+        std::chrono::steady_clock::now() - pause_start;
+    _stats.total_pause_ms += pause.count();
+    if (minor) {
+        _stats.minor_collections++;
+        if (pause.count() > _stats.max_minor_pause_ms)
+            _stats.max_minor_pause_ms = pause.count();
+    } else {
+        _stats.major_collections++;
+        if (pause.count() > _stats.max_major_pause_ms)
+            _stats.max_major_pause_ms = pause.count();
+    }
+}
+
+void collector::free_all() {
+    u8* cell = nursery_start;
+    while (cell < nursery_top) {
+        object* o = reinterpret_cast<object*>(cell);
+        cell += o->gc_cell;
+        o->~object();
+    }
+    nursery_top = nursery_start;
+    young_bytes = 0;
+
+    while (objects != nullptr) {
+        object* next = objects->gc_next;
+        delete objects;
+        objects = next;
+    }
+    bytes_allocated = 0;
+    remembered = dynarray<object*>();
+    interned_strings.clear();
+}
+
+void collector::configure(u64 nursery_size, u64 threshold, f64 heap_growth) {
+    panic_if(heap_growth < 1.0, "collector: heap growth must be at least 1");
+    panic_if(nursery_size < 2 * NURSERY_SLACK, "collector: nursery is too small");
+    panic_if(nursery_top != nursery_start, "collector: cannot resize a nursery in use");
+
+    const u64 size = (nursery_size + NURSERY_ALIGNMENT - 1) & ~(NURSERY_ALIGNMENT - 1);
+    if (nursery_start == nullptr || static_cast<u64>(nursery_end - nursery_start) != size) {
+        free(nursery_start);
+        nursery_start = static_cast<u8*>(aligned_alloc(NURSERY_ALIGNMENT, size));
+        nursery_top = nursery_start;
+        nursery_end = nursery_start + size;
+    }
+    // what the young objects own outside the nursery (string data, chunks)
+    // counts towards a minor collection too.
+    young_limit = size * 8;
+
+    this->next_gc = threshold;
+    this->min_threshold = threshold;
+    this->heap_growth = heap_growth;
+}
+
+void collector::configure_from_env() {
+    u64 nursery = nursery_end - nursery_start;
+    u64 threshold = min_threshold;
+    f64 growth = heap_growth;
+    if (const char* n = std::getenv("STING_GC_NURSERY"))
+        nursery = std::strtoull(n, nullptr, 10);
+    if (const char* t = std::getenv("STING_GC_THRESHOLD"))
+        threshold = std::strtoull(t, nullptr, 10);
+    if (const char* g = std::getenv("STING_GC_HEAP_GROWTH"))
+        growth = std::strtod(g, nullptr);
+    configure(nursery, threshold, growth);
+}
+
+std::ostream& operator<<(std::ostream& os, const collector& gc) {
+    const gc_stats& s = gc.stats();
+    os << "---- GC ----\n"
+       << "minor collections:  " << s.minor_collections << "\n"
+       << "major collections:  " << s.major_collections << "\n"
+       << "objects promoted:   " << s.objects_promoted << "\n"
+       << "bytes promoted:     " << s.bytes_promoted << "\n"
+       << "objects freed:      " << s.objects_freed << "\n"
+       << "bytes freed:        " << s.bytes_freed << "\n"
+       << "old space bytes:    " << gc.bytes() << "\n"
+       << "peak old bytes:     " << s.peak_bytes << "\n"
+       << "total pause ms:     " << s.total_pause_ms << "\n"
+       << "max minor pause ms: " << s.max_minor_pause_ms << "\n"
+       << "max major pause ms: " << s.max_major_pause_ms << "\n";
+    return os;
+}
+
+} // namespace sting
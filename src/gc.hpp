@@ -0,0 +1,152 @@
+#ifndef GC_HPP
+#define GC_HPP
+
+#include <chrono>
+
+#include "utilities.hpp"
+#include "dynarray.hpp"
+#include "object.hpp"
+#include "value.hpp"
+
+namespace sting {
+
+const u64 DEFAULT_GC_THRESHOLD = 1 << 20;   // old space bytes before the first major collection
+const f64 DEFAULT_GC_HEAP_GROWTH = 2.0;     // next threshold = live bytes * growth
+const u64 DEFAULT_NURSERY_SIZE = 1 << 18;   // bytes of bump allocated cells
+const u64 NURSERY_SLACK = 1 << 12;          // minor collection once less than this is left
+const u64 NURSERY_ALIGNMENT = 16;
+
+struct gc_stats {
+    u64 minor_collections = 0;
+    u64 major_collections = 0;
+    u64 objects_promoted = 0;
+    u64 bytes_promoted = 0;
+    u64 objects_freed = 0;
+    u64 bytes_freed = 0;
+    u64 peak_bytes = 0;
+    f64 total_pause_ms = 0;
+    f64 max_minor_pause_ms = 0;
+    f64 max_major_pause_ms = 0;
+};
+
+/*
+ *  Generational collector.
+ *
+ *  young objects are bump allocated out of a fixed size nursery. a minor
+ *  collection copies everything still reachable into the old space
+ *  (survivors are promoted the first time they survive) and throws the
+ *  whole nursery away. the old space is a list of individually allocated
+ *  objects collected by mark-sweep in a major collection.
+ *
+ *  old objects that get a young reference stored into them have to be
+ *  remembered with write_barrier(), since a minor collection only scans
+ *  the roots and the remembered set.
+ *
+ *  the collector never starts a collection by itself: the vm checks
+ *  should_collect() at safepoints between instructions, and drives each
+ *  phase by visiting its roots between begin_*() and finish_*().
+ *
+ *  tunable through STING_GC_NURSERY (bytes), STING_GC_THRESHOLD (bytes)
+ *  and STING_GC_HEAP_GROWTH, STING_GC_STATS prints the statistics at exit.
+ */
+class collector {
+public:
+    collector();
+    ~collector();
+
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        const u64 cell = (sizeof(T) + NURSERY_ALIGNMENT - 1) & ~(NURSERY_ALIGNMENT - 1);
+        if (nursery_top + cell <= nursery_end) {
+            T* o = new (nursery_top) T(static_cast<Args&&>(args)...);
+            nursery_top += cell;
+            o->gc_cell = cell;
+            o->gc_bytes = o->footprint();
+            young_bytes += o->gc_bytes;
+            return o;
+        }
+
+        // nursery is full until the next safepoint.
+        T* o = new T(static_cast<Args&&>(args)...);
+        track_old(o);
+        if (nursery_top != nursery_start)
+            remember(o);
+        return o;
+    }
+
+    bool should_collect() const { return young_full() || bytes_allocated > next_gc; }
+    bool young_full() const {
+        return nursery_top + NURSERY_SLACK > nursery_end ||
+               young_bytes > young_limit;
+    }
+    bool old_full() const { return bytes_allocated > next_gc; }
+
+    bool is_young(const object* o) const {
+        const u8* p = reinterpret_cast<const u8*>(o);
+        return p >= nursery_start && p < nursery_top;
+    }
+    bool is_young(const value& v) const { return v.is_object() && is_young(v.obj()); }
+
+    // call after storing v into owner.
+    void write_barrier(object* owner, const value& v) {
+        if (!owner->gc_remembered && !is_young(owner) && is_young(v))
+            remember(owner);
+    }
+
+    // minor: evacuate the object into the old space and rewrite the slot.
+    // major: mark it.
+    void mark_object(object*& o);
+    void mark_value(value& v);
+    template <typename T>
+    void mark(T*& slot) {
+        object* o = slot;
+        mark_object(o);
+        slot = static_cast<T*>(o);
+    }
+
+    void begin_minor();
+    void finish_minor();
+    void begin_major();
+    void finish_major();
+    void free_all();
+
+    void configure(u64 nursery_size, u64 threshold, f64 heap_growth);
+    void configure_from_env();
+    u64 bytes() const { return bytes_allocated; }
+    const gc_stats& stats() const { return _stats; }
+
+    friend std::ostream& operator<<(std::ostream& os, const collector& gc);
+
+private:
+    void track_old(object* o);
+    void remember(object* o);
+    object* promote(object* o);
+    void trace_references();
+    void sweep();
+    void sweep_nursery();
+    void end_pause(bool minor);
+
+    u8* nursery_start;
+    u8* nursery_top;
+    u8* nursery_end;
+    u64 young_bytes; // footprint of the nursery objects, including what they own
+    u64 young_limit;
+
+    object* objects; // old space
+    dynarray<object*> gray;
+    dynarray<object*> remembered;
+    u64 bytes_allocated; // old space
+    u64 next_gc;
+    u64 min_threshold;
+    f64 heap_growth;
+    bool minor; // which kind of collection is in progress
+
+    std::chrono::steady_clock::time_point pause_start;
+    gc_stats _stats;
+};
+
+extern collector gc;
+
+} // namespace sting
+
+#endif
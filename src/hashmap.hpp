@@ -79,22 +79,7 @@ public:
 
     bool contains(const Key& key) {
         if (_size == 0) return false;
-        u64 original = _hash_key(key, _capacity);
-        u64 index = original;
-        while (_data[index].k != key) {
-            if (_data[index].state == _slot::EMPTY)
-                return false;
-
-            ++index;
-            index = _cycle_index(index, _capacity);
-            if (index == original)
-                return false;
-        }
-
-        if (_data[index].state != _slot::OCCUPIED)
-            return false;
-
-        return true;
+        return _find(key) != _capacity;
     }
 
     // would be nice to have a move version
@@ -120,42 +105,30 @@ public:
     // panic if not contains
     Value& at(const Key& key) {
         panic_if(_size == 0ul, "sting::hashmap::at(): at on empty hashmap");
-        u64 original = _hash_key(key, _capacity);
-        u64 index = original;
-        while (_data[index].k != key) {
-            panic_if(_data[index].state == _slot::EMPTY,
-                     "sting::hashmap::at(): non existent key-value pair");
-            ++index;
-            index = _cycle_index(index, _capacity);
-            panic_if(index == original, // if they're all deleted. not great way to handle this.
-                     "sting::hashmap::at(): non existent key-value pair");
-        }
-
-        panic_if(_data[index].state != _slot::OCCUPIED,
-                 "sting::hashmap::at(): non existent key-value pair\n");
+        const u64 index = _find(key);
+        panic_if(index == _capacity, "sting::hashmap::at(): non existent key-value pair");
         return _data[index].v;
     }
 
     // panic if not contains
     void remove(const Key& key) {
         panic_if(_size == 0ul, "sting::hashmap::remove(): remove on empty hashmap");
-
-        u64 original = _hash_key(key, _capacity);
-        u64 index = original;
-        while (_data[index].k != key) {
-            panic_if(_data[index].state == _slot::EMPTY,
-                     "sting::hashmap::remove(): non existent key-value pair");
-            ++index;
-            index = _cycle_index(index, _capacity);
-            panic_if(index == original,
-                     "sting::hashmap::remove(): non existent key-value pair");
-        }
+        const u64 index = _find(key);
+        panic_if(index == _capacity, "sting::hashmap::remove(): non existent key-value pair");
         _data[index].k.~Key();
         _data[index].v.~Value();
         _data[index].state = _slot::DELETED;
         _size--;
     }
 
+    template <typename Fn>
+    void for_each(Fn fn) {
+        for (u64 i{}; i < _capacity; ++i) {
+            if (_data[i].state == _slot::OCCUPIED)
+                fn(_data[i].k, _data[i].v);
+        }
+    }
+
     u64 capacity() { return _capacity; }
     u64 size() { return _size; }
 
@@ -179,6 +152,24 @@ private:
         return static_cast<_slot*>(calloc(capacity, sizeof(_slot)));
     }
 
+    // slot holding key, _capacity if there is none. deleted slots keep
+    // probing going but their key has been destroyed, never compare it.
+    u64 _find(const Key& key) {
+        const u64 original = _hash_key(key, _capacity);
+        u64 index = original;
+        for (;;) {
+            if (_data[index].state == _slot::EMPTY)
+                return _capacity;
+            if (_data[index].state == _slot::OCCUPIED && _data[index].k == key)
+                return index;
+
+            ++index;
+            index = _cycle_index(index, _capacity);
+            if (index == original) // if they're all deleted. not great way to handle this.
+                return _capacity;
+        }
+    }
+
     // produces some offset into _data, using FNV-1a
     u64 _hash_key(const Key& key, const u64 capacity) const {
         return fnv_1a_hash(key) % capacity;
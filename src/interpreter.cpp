@@ -1,27 +1,73 @@
 #include "interpreter.hpp"
 #include "parser.hpp"
+#include "gc.hpp"
+#include "bytecode_file.hpp"
+#include "mapped_file.hpp"
 
 namespace sting {
 
-dynarray<object*> object_list;
+namespace {
+
+// parses source into script and global_names, the parser takes its tokens
+// from the scanner as it needs them.
+bool compile(mapped_file& source, const std::filesystem::path& file, bool debug, u8 flags,
+             function& script, dynarray<value>& global_names) {
+    parser p(file.string(), scanner(source.data(), source.size()));
+    p.c.debug = debug;
+    p.c.optimize = flags & BYTECODE_OPTIMIZED;
+    p.c.registers = flags & BYTECODE_REGISTERS;
+    if (!p.parse()) return false;
+    script = p.get_script();
+    global_names = p.get_global_names();
+    return true;
+}
+
+} // namespace
 
 vm_result interpret(const std::filesystem::path& file, bool debug) {
-    bool result;
-    std::string source = read_file(file);
+    gc.configure_from_env();
+    mapped_file source(file);
+    panic_if(!source.is_open(), "Could not read " + file.string());
     if (debug) {
-        std::cout << "------- SOURCE -------\n" << source
-                  << "----------------------\n";
+        std::cout << "------- SOURCE -------\n";
+        std::cout.write(source.data(), source.size());
+        std::cout << "----------------------\n";
     }
-    scanner scan(source.data(), source.size());
-    parser p(file.string());
-    result = scan.tokenize(p.get_tokens());
-    if (!result) return vm_result::COMPILE_ERROR;
+    const bool registers = std::getenv("STING_REGISTER_VM") != nullptr;
+    u8 flags = registers ? BYTECODE_REGISTERS : 0;
+    if (std::getenv("STING_NO_OPTIMIZE") == nullptr)
+        flags |= BYTECODE_OPTIMIZED;
 
-    const dynarray<token>& ts = p.get_tokens();
+    // foo.sting's compiled code is in foo.stingc. debug output comes from
+    // the compiler, so debug runs always compile.
+    const bool cache = std::getenv("STING_NO_CACHE") == nullptr;
+    std::filesystem::path cache_file = file;
+    cache_file += "c";
+    const u64 hash = source_hash(source.data(), source.size());
 
-    result = p.parse();
-    if (!result) return vm_result::COMPILE_ERROR;
-    vmachine vm(p.get_script());
+    function script;
+    dynarray<value> global_names;
+    if (!cache || debug || !read_bytecode_file(cache_file, hash, flags, script, global_names)) {
+        if (!compile(source, file, debug, flags, script, global_names))
+            return vm_result::COMPILE_ERROR;
+        if (cache) write_bytecode_file(cache_file, hash, flags, script, global_names);
+    }
+
+    u64 max_frames = DEFAULT_MAX_FRAMES;
+    u64 stack_size = DEFAULT_STACK_SIZE;
+    if (const char* n = std::getenv("STING_MAX_FRAMES"))
+        max_frames = std::strtoull(n, nullptr, 10);
+    if (const char* n = std::getenv("STING_STACK_SIZE"))
+        stack_size = std::strtoull(n, nullptr, 10);
+    vmachine vm(script, global_names, max_frames, stack_size);
+    if (const char* n = std::getenv("STING_JIT_THRESHOLD"))
+        vm.jit_threshold = std::strtoul(n, nullptr, 10);
+    if (const char* n = std::getenv("STING_TRACE_THRESHOLD"))
+        vm.trace_threshold = std::strtoul(n, nullptr, 10);
+    if (std::getenv("STING_NO_JIT")) {
+        vm.jit_threshold = 0;
+        vm.trace_threshold = 0;
+    }
 
     if (debug) {
         dynarray<chunk> chunks;
@@ -30,9 +76,13 @@ vm_result interpret(const std::filesystem::path& file, bool debug) {
         while (chunks.size() > 0) {
             const chunk& current = chunks.pop_back();
             std::cout << current << "\n";
+            if (registers) {
+                print_registers(std::cout, current);
+                std::cout << "\n";
+            }
             for (u64 i = 0; i < current.constant_pool.size(); i++) {
                 const value& v = current.constant_pool.at(i);
-                if (v.type == vtype::FUNCTION) {
+                if (v.type() == vtype::FUNCTION) {
                     function& f = *static_cast<function*>(v.obj());
                     chunks.push_back(f.get_chunk());
                 }
@@ -40,7 +90,7 @@ vm_result interpret(const std::filesystem::path& file, bool debug) {
         }
     }
 
-    return vm.run_chunk();
+    return registers ? vm.run_registers() : vm.run_chunk();
 }
 
 void manage_result(vm_result result) {
@@ -62,10 +112,13 @@ void manage_result(vm_result result) {
             std::cerr << "Unknown interpreter result.\n";
     }
 
-    for (u64 i{}; i < object_list.size(); i++) {
-        delete object_list.at(i);
-        object_list.at(i) = nullptr;
+    if (std::getenv("STING_GC_STATS")) {
+        std::cerr << gc;
     }
+#ifdef STING_PROFILE
+    std::cerr << prof;
+#endif
+    gc.free_all();
     exit(code);
 }
 
@@ -0,0 +1,1513 @@
+#include "jit.hpp"
+#include "vmachine.hpp"
+
+#ifdef STING_JIT
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace sting {
+
+namespace {
+
+bool is_branch(opcode op) {
+    switch (short_form(op)) {
+        case opcode::BRANCH:
+        case opcode::LOOP:
+        case opcode::BRANCH_FALSE:
+        case opcode::POP_BRANCH_FALSE:
+        case opcode::LESS_BRANCH_FALSE:
+        case opcode::LESS_BRANCH_TRUE:
+        case opcode::GREATER_BRANCH_FALSE:
+        case opcode::GREATER_BRANCH_TRUE:
+        case opcode::EQUAL_BRANCH_FALSE:
+        case opcode::EQUAL_BRANCH_TRUE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+u64 branch_target(const u8* code, u64 offset) {
+    const opcode op = short_form(generic_form(static_cast<opcode>(code[offset])));
+    const u64 end = offset + instruction_size(code + offset);
+    const u32 distance = read_operand(code + offset + 1, operand_width(static_cast<opcode>(code[offset])));
+    return op == opcode::LOOP ? end - distance : end + distance;
+}
+
+} // namespace
+
+#ifdef STING_JIT
+
+namespace {
+
+enum reg : u8 {
+    RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+    R12 = 12, R13 = 13, R14 = 14, R15 = 15,
+};
+
+const u8 XMM0 = 0;
+
+// condition codes, as in the low nibble of jcc and setcc.
+enum cond : u8 {
+    CC_E = 0x4, CC_NE = 0x5, CC_BE = 0x6, CC_A = 0x7, CC_P = 0xa, CC_NP = 0xb,
+};
+
+// sse opcodes, after 0x0f. all but ucomiss take the f3 (scalar single) prefix.
+const u8 MOVSS = 0x10;
+const u8 ADDSS = 0x58;
+const u8 MULSS = 0x59;
+const u8 SUBSS = 0x5c;
+const u8 DIVSS = 0x5e;
+const u8 UCOMISS = 0x2e;
+
+// the default value layout: a 4 byte type, then the payload at 8. numbers
+// and booleans leave the rest of the payload zero.
+const i32 SLOT = 16;
+const i32 TYPE = 0;
+const i32 PAYLOAD = 8;
+static_assert(sizeof(value) == SLOT, "jit: unexpected value layout");
+
+// relative to r12, the value stack top.
+const i32 TOP = -SLOT;
+const i32 SECOND = -2 * SLOT;
+
+const u32 NO_ENTRY = UINT32_MAX;
+
+bool layout_matches() {
+    u8 bytes[SLOT];
+    const value number(1.5f);
+    memcpy(bytes, &number, SLOT);
+    u32 type;
+    f32 f;
+    u32 high;
+    memcpy(&type, bytes + TYPE, sizeof(type));
+    memcpy(&f, bytes + PAYLOAD, sizeof(f));
+    memcpy(&high, bytes + PAYLOAD + 4, sizeof(high));
+    if (type != static_cast<u32>(vtype::NUMBER) || f != 1.5f || high != 0)
+        return false;
+
+    const value boolean(static_cast<u8>(true));
+    memcpy(bytes, &boolean, SLOT);
+    u64 payload;
+    memcpy(&type, bytes + TYPE, sizeof(type));
+    memcpy(&payload, bytes + PAYLOAD, sizeof(payload));
+    return type == static_cast<u32>(vtype::BOOLEAN) && payload == 1;
+}
+
+// just the encodings the templates need. memory operands are always
+// [base + disp32].
+class assembler {
+public:
+    assembler() : bytes() {}
+
+    dynarray<u8> bytes;
+
+    u64 size() const { return bytes.size(); }
+
+    void byte(u8 b) { bytes.push_back(b); }
+
+    void dword(u32 d) {
+        for (u64 i{}; i < 4; i++) byte(static_cast<u8>(d >> (8 * i)));
+    }
+
+    void qword(u64 q) {
+        for (u64 i{}; i < 8; i++) byte(static_cast<u8>(q >> (8 * i)));
+    }
+
+    // mov dst, [base + disp]
+    void load(reg dst, reg base, i32 disp) {
+        rex(true, dst, base);
+        byte(0x8b);
+        mem(dst, base, disp);
+    }
+
+    // mov [base + disp], src
+    void store(reg base, i32 disp, reg src) {
+        rex(true, src, base);
+        byte(0x89);
+        mem(src, base, disp);
+    }
+
+    // mov dst32, dword [base + disp]
+    void load_dword(reg dst, reg base, i32 disp) {
+        rex(false, dst, base);
+        byte(0x8b);
+        mem(dst, base, disp);
+    }
+
+    // mov dword [base + disp], src32
+    void store_dword(reg base, i32 disp, reg src) {
+        rex(false, src, base);
+        byte(0x89);
+        mem(src, base, disp);
+    }
+
+    // lea dst, [base + disp]. leaves the flags alone.
+    void lea(reg dst, reg base, i32 disp) {
+        rex(true, dst, base);
+        byte(0x8d);
+        mem(dst, base, disp);
+    }
+
+    // mov dword [base + disp], imm
+    void store_dword(reg base, i32 disp, u32 imm) {
+        rex(false, 0, base);
+        byte(0xc7);
+        mem(0, base, disp);
+        dword(imm);
+    }
+
+    // mov qword [base + disp], imm (sign extended)
+    void store_qword(reg base, i32 disp, i32 imm) {
+        rex(true, 0, base);
+        byte(0xc7);
+        mem(0, base, disp);
+        dword(static_cast<u32>(imm));
+    }
+
+    // cmp dword [base + disp], imm
+    void cmp_dword(reg base, i32 disp, u32 imm) {
+        rex(false, 7, base);
+        byte(0x81);
+        mem(7, base, disp);
+        dword(imm);
+    }
+
+    // cmp byte [base + disp], imm
+    void cmp_byte(reg base, i32 disp, u8 imm) {
+        rex(false, 7, base);
+        byte(0x80);
+        mem(7, base, disp);
+        byte(imm);
+    }
+
+    // xor dword [base + disp], imm
+    void xor_dword(reg base, i32 disp, u32 imm) {
+        rex(false, 6, base);
+        byte(0x81);
+        mem(6, base, disp);
+        dword(imm);
+    }
+
+    // xor byte [base + disp], imm
+    void xor_byte(reg base, i32 disp, u8 imm) {
+        rex(false, 6, base);
+        byte(0x80);
+        mem(6, base, disp);
+        byte(imm);
+    }
+
+    // op xmm, dword [base + disp]
+    void sse(u8 op, u8 xmm, reg base, i32 disp) {
+        if (op != UCOMISS) byte(0xf3);
+        rex(false, xmm, base);
+        byte(0x0f);
+        byte(op);
+        mem(xmm, base, disp);
+    }
+
+    // movd eax, xmm0
+    void movd_eax_xmm0() {
+        byte(0x66); byte(0x0f); byte(0x7e); byte(0xc0);
+    }
+
+    // setcc on al or cl
+    void setcc(cond cc, reg r) {
+        byte(0x0f); byte(0x90 | cc); byte(0xc0 | r);
+    }
+
+    void movzx_eax_al() { byte(0x0f); byte(0xb6); byte(0xc0); }
+    void and_al_cl() { byte(0x20); byte(0xc8); }
+    void test_al() { byte(0x84); byte(0xc0); }
+    void test_rax() { byte(0x48); byte(0x85); byte(0xc0); }
+    void cmp_rax(u8 imm) { byte(0x48); byte(0x83); byte(0xf8); byte(imm); }
+    void cmp_al(u8 imm) { byte(0x3c); byte(imm); }
+
+    // mov dst, src
+    void mov(reg dst, reg src) {
+        rex(true, src, dst);
+        byte(0x89);
+        byte(0xc0 | (src & 7) << 3 | (dst & 7));
+    }
+
+    // mov dst32, imm (zero extended)
+    void mov_imm32(reg dst, u32 imm) {
+        rex(false, 0, dst);
+        byte(0xb8 | (dst & 7));
+        dword(imm);
+    }
+
+    // mov dst, imm64
+    void mov_imm64(reg dst, u64 imm) {
+        rex(true, 0, dst);
+        byte(0xb8 | (dst & 7));
+        qword(imm);
+    }
+
+    void call(reg r) { rex(false, 0, r); byte(0xff); byte(0xd0 | (r & 7)); }
+    void jmp(reg r) { rex(false, 0, r); byte(0xff); byte(0xe0 | (r & 7)); }
+    void push(reg r) { rex(false, 0, r); byte(0x50 | (r & 7)); }
+    void pop(reg r) { rex(false, 0, r); byte(0x58 | (r & 7)); }
+    void ret() { byte(0xc3); }
+
+    // rel32 jumps, they return where their displacement is for patch.
+    u64 jmp() {
+        byte(0xe9);
+        dword(0);
+        return size() - 4;
+    }
+
+    u64 jcc(cond cc) {
+        byte(0x0f);
+        byte(0x80 | cc);
+        dword(0);
+        return size() - 4;
+    }
+
+    void patch(u64 at, u64 target) {
+        const i32 rel = static_cast<i32>(static_cast<i64>(target) - static_cast<i64>(at + 4));
+        memcpy(bytes.data() + at, &rel, sizeof(rel));
+    }
+
+private:
+    void rex(bool wide, u8 r, u8 base) {
+        const u8 prefix = 0x40 | wide << 3 | (r >> 3) << 2 | base >> 3;
+        if (prefix != 0x40) byte(prefix);
+    }
+
+    // mod 10, so r13 needs no special case. r12 (like rsp) needs a sib byte.
+    void mem(u8 r, u8 base, i32 disp) {
+        byte(0x80 | (r & 7) << 3 | (base & 7));
+        if ((base & 7) == RSP) byte(0x24);
+        dword(static_cast<u32>(disp));
+    }
+};
+
+// native calls nest on the C stack, 16 bytes a level, this deep at most.
+// past it the callee's frame is left to the interpreter.
+const u32 MAX_NATIVE_DEPTH = 1 << 16;
+
+// returned by jit_call when there's nothing to call, the callable was native.
+const u64 CALL_DONE = 1;
+
+// makes frame the one the native code runs.
+void enter_frame(jit_context* ctx, call_frame& frame) {
+    ctx->frame = &frame;
+    ctx->base = ctx->vm->value_stack.data() + frame.bp;
+    ctx->constants = frame.constants;
+}
+
+// CALL, CALL_LOCAL and CALL_GLOBAL, ctx->pc is the instruction after the
+// call. returns the callee's native code for the caller to call, with the
+// callee's frame entered, or CALL_DONE. returns 0 when the callee's frame
+// is left to the interpreter, the caller exits at ctx->pc.
+u64 jit_call(jit_context* ctx, u32 op, u32 x, u32 y) {
+    vmachine& vm = *ctx->vm;
+    vm_stack<value>& stack = vm.value_stack;
+    stack.set_top(ctx->top);
+
+    value callable;
+    u64 num_args = y;
+    switch (static_cast<opcode>(op)) {
+        case opcode::CALL:
+            callable = stack.pop_back();
+            num_args = x;
+            break;
+        case opcode::CALL_LOCAL:
+            callable = ctx->base[x];
+            break;
+        default:
+            callable = vm.globals.data()[x];
+            break;
+    }
+
+    // CALL (or CALL_LONG) has its call site in y, the fused calls have it
+    // as their last operand, just before ctx->pc.
+    const u64 width = operand_width(static_cast<opcode>(op));
+    const u32 site = static_cast<opcode>(op) == opcode::CALL ? y :
+        read_operand(ctx->frame->code + ctx->pc - width, width);
+
+    const u64 frames = vm.call_frames.size();
+    vm.call_cached(callable, num_args, site);
+    ctx->top = stack.top();
+    if (vm.call_frames.size() == frames)
+        return CALL_DONE;
+
+    call_frame& callee = vm.call_frames.back();
+    const jit_code* code = callee.c->get_chunk().jit;
+    if (code == nullptr || ctx->depth == MAX_NATIVE_DEPTH)
+        return 0;
+    ctx->frame->pc = ctx->pc;
+    ctx->depth++;
+    enter_frame(ctx, callee);
+    return reinterpret_cast<u64>(code->native + code->entry.at(0));
+}
+
+// RETURN from a native call, the result is already in place. pops the
+// frame, the native code then returns to its caller.
+u64 jit_return(jit_context* ctx, u32, u32, u32) {
+    vmachine& vm = *ctx->vm;
+    vm.value_stack.set_top(ctx->top);
+    vm.call_frames.pop_back();
+    ctx->depth--;
+    enter_frame(ctx, vm.call_frames.back());
+    return 0;
+}
+
+void safepoint(jit_context* ctx) {
+    if (gc.should_collect()) {
+        ctx->vm->collect_garbage();
+        ctx->constants = ctx->frame->constants;
+    }
+}
+
+// everything the templates don't do natively, the same way the interpreter
+// does it. x and y are the instruction's operands. returns the byte of the
+// comparison for the compare branches.
+u32 jit_slow_path(jit_context* ctx, u32 op, u32 x, u32 y) {
+    vmachine& vm = *ctx->vm;
+    vm_stack<value>& stack = vm.value_stack;
+    stack.set_top(ctx->top);
+    u32 result = 0;
+    switch (static_cast<opcode>(op)) {
+        case opcode::ADD: {
+            const value b = stack.pop_back();
+            const value a = stack.pop_back();
+            stack.push_back(b + a);
+            safepoint(ctx);
+            break;
+        }
+        case opcode::SUBTRACT: {
+            const value b = stack.pop_back();
+            const value a = stack.pop_back();
+            stack.push_back(a - b);
+            break;
+        }
+        case opcode::MULTIPLY: {
+            const value b = stack.pop_back();
+            const value a = stack.pop_back();
+            stack.push_back(a * b);
+            break;
+        }
+        case opcode::DIVIDE: {
+            const value b = stack.pop_back();
+            const value a = stack.pop_back();
+            stack.push_back(a / b);
+            break;
+        }
+        case opcode::LESS: {
+            const value b = stack.pop_back();
+            const value a = stack.pop_back();
+            stack.push_back(a < b);
+            break;
+        }
+        case opcode::GREATER: {
+            const value b = stack.pop_back();
+            const value a = stack.pop_back();
+            stack.push_back(a > b);
+            break;
+        }
+        case opcode::EQUAL: {
+            const value b = stack.pop_back();
+            const value a = stack.pop_back();
+            stack.push_back(a == b);
+            break;
+        }
+        case opcode::NEGATE: {
+            const value a = stack.pop_back();
+            stack.push_back(-a);
+            break;
+        }
+        case opcode::NOT: {
+            const value a = stack.pop_back();
+            stack.push_back(!a);
+            break;
+        }
+        case opcode::LESS_BRANCH_FALSE:
+        case opcode::LESS_BRANCH_TRUE: {
+            const value b = stack.pop_back();
+            const value a = stack.pop_back();
+            result = (a < b).byte();
+            break;
+        }
+        case opcode::GREATER_BRANCH_FALSE:
+        case opcode::GREATER_BRANCH_TRUE: {
+            const value b = stack.pop_back();
+            const value a = stack.pop_back();
+            result = (a > b).byte();
+            break;
+        }
+        case opcode::EQUAL_BRANCH_FALSE:
+        case opcode::EQUAL_BRANCH_TRUE: {
+            const value b = stack.pop_back();
+            const value a = stack.pop_back();
+            result = (a == b).byte();
+            break;
+        }
+        case opcode::ADD_LOCAL_CONST: {
+            value& slot = ctx->base[x];
+            slot = ctx->constants[y] + slot;
+            safepoint(ctx);
+            break;
+        }
+        case opcode::PRINT: {
+            std::cout << stack.pop_back() << "\n" << std::flush;
+            break;
+        }
+        case opcode::DEFINE_GLOBAL: {
+            vm.globals.data()[x] = stack.pop_back();
+            vm.global_defined.data()[x] = true;
+            vm.remember_global(vm.globals.data()[x]);
+            break;
+        }
+        case opcode::SET_GLOBAL: {
+            value& slot = vm.globals.data()[x];
+            slot = stack.back();
+            vm.remember_global(slot);
+            break;
+        }
+        case opcode::SET_GLOBAL_POP: {
+            value& slot = vm.globals.data()[x];
+            slot = stack.pop_back();
+            vm.remember_global(slot);
+            break;
+        }
+        case opcode::GET_GLOBAL_CHECKED: {
+            if (!vm.global_defined.data()[x]) vm.undefined_global(x);
+            stack.push_back(vm.globals.data()[x]);
+            break;
+        }
+        case opcode::SET_GLOBAL_CHECKED: {
+            if (!vm.global_defined.data()[x]) vm.undefined_global(x);
+            vm.globals.data()[x] = stack.back();
+            vm.remember_global(vm.globals.data()[x]);
+            break;
+        }
+        case opcode::GET_UPVALUE: {
+            rtupvalue const * const uv = ctx->frame->c->get_upvalues().data()[x];
+            if (uv->is_closed) {
+                stack.push_back(uv->closed);
+            } else {
+                stack.push_back(stack.data()[uv->value_stack_index()]);
+            }
+            break;
+        }
+        case opcode::SET_UPVALUE: {
+            rtupvalue * const uv = ctx->frame->c->get_upvalues().data()[x];
+            if (uv->is_closed) {
+                uv->closed = stack.back();
+                gc.write_barrier(uv, uv->closed);
+            } else {
+                stack.data()[uv->value_stack_index()] = stack.back();
+            }
+            break;
+        }
+        case opcode::SAVE_VALUE: {
+            vm.return_slot = stack.pop_back();
+            break;
+        }
+        case opcode::LOAD_VALUE: {
+            stack.push_back(vm.return_slot);
+            break;
+        }
+        default: {
+            panic("jit: no slow path for " + opcode_to_string(static_cast<opcode>(op)));
+        }
+    }
+    ctx->top = stack.top();
+    return result;
+}
+
+// owns all the native code, chunks only point at it. it lives as long as
+// the program, copies of a chunk (and frames running it) can share it.
+class code_table {
+public:
+    code_table() : codes() {}
+    code_table(const code_table&) = delete;
+    code_table& operator=(const code_table&) = delete;
+
+    ~code_table() {
+        for (u64 i{}; i < codes.size(); i++) {
+            munmap(codes.at(i)->native, codes.at(i)->size);
+            delete codes.at(i);
+        }
+    }
+
+    jit_code* add(u8* native, u64 size, dynarray<u32>& entry) {
+        jit_code* code = new jit_code();
+        code->native = native;
+        code->size = size;
+        code->entry = stealable(entry);
+        codes.push_back(code);
+        return code;
+    }
+
+private:
+    dynarray<jit_code*> codes;
+};
+
+code_table table;
+
+struct fixup {
+    u64 at;     // rel32 to patch
+    u64 target; // bytecode offset it jumps to
+};
+
+// what the method and trace compilers share: getting in and out of the
+// native code, and the templates for the values themselves.
+class emitter {
+protected:
+    explicit emitter(const chunk& chk) : chk(chk), a(), exits() {}
+
+    const chunk& chk;
+    assembler a;
+    dynarray<u64> exits; // jumps to the epilogue
+
+    // called as void(jit_context*, const u8* target), saves what the
+    // templates use and jumps to the target.
+    void prologue() {
+        a.push(RBP);
+        a.push(RBX);
+        a.push(R12);
+        a.push(R13);
+        a.push(R14);
+        a.push(R15);
+        a.lea(RSP, RSP, -8); // keeps rsp 16 byte aligned for the helpers
+        a.mov(RBX, RDI);
+        a.store(RBX, offsetof(jit_context, sp), RSP);
+        a.load(R12, RBX, offsetof(jit_context, top));
+        a.load(R13, RBX, offsetof(jit_context, base));
+        a.load(R14, RBX, offsetof(jit_context, constants));
+        a.load(R15, RBX, offsetof(jit_context, globals));
+        a.jmp(RSI);
+    }
+
+    // exits from any depth of native calls, their frames are in call_frames.
+    void epilogue() {
+        a.store(RBX, offsetof(jit_context, top), R12);
+        a.load(RSP, RBX, offsetof(jit_context, sp));
+        a.lea(RSP, RSP, 8);
+        a.pop(R15);
+        a.pop(R14);
+        a.pop(R13);
+        a.pop(R12);
+        a.pop(RBX);
+        a.pop(RBP);
+        a.ret();
+    }
+
+    // leave the native code, the interpreter runs the instruction at offset.
+    void exit_at(u64 offset) {
+        a.store_qword(RBX, offsetof(jit_context, pc), static_cast<i32>(offset));
+        exits.push_back(a.jmp());
+    }
+
+    // calls h(ctx, op, x, y), the result is in rax.
+    template <typename helper = decltype(&jit_slow_path)>
+    void slow(opcode op, u32 x = 0, u32 y = 0, helper h = &jit_slow_path) {
+        a.store(RBX, offsetof(jit_context, top), R12);
+        a.mov(RDI, RBX);
+        a.mov_imm32(RSI, static_cast<u32>(op));
+        a.mov_imm32(RDX, x);
+        a.mov_imm32(RCX, y);
+        a.mov_imm64(RAX, reinterpret_cast<u64>(h));
+        a.call(RAX);
+        a.load(R12, RBX, offsetof(jit_context, top));
+        a.load(R14, RBX, offsetof(jit_context, constants));
+    }
+
+    // the fast path of an instruction falls through, its guards jump to the
+    // slow path after it.
+    void guard(dynarray<u64>& to_slow, reg base, i32 disp, vtype type) {
+        a.cmp_dword(base, disp + TYPE, static_cast<u32>(type));
+        to_slow.push_back(a.jcc(CC_NE));
+    }
+
+    u64 begin_slow(const dynarray<u64>& to_slow) {
+        const u64 done = a.jmp();
+        for (u64 i{}; i < to_slow.size(); i++) {
+            a.patch(to_slow.at(i), a.size());
+        }
+        return done;
+    }
+
+    void end_slow(u64 done) { a.patch(done, a.size()); }
+
+    static bool fits(u64 index) { return index < static_cast<u64>(INT32_MAX / SLOT); }
+
+    static i32 at(u64 index) { return static_cast<i32>(index) * SLOT; }
+
+    // the type and the payload separately, the same widths the templates
+    // store them with. a load that spans two stores can't be forwarded from
+    // them and waits for both to retire.
+    void copy(reg dst, i32 dst_disp, reg src, i32 src_disp) {
+        a.load_dword(RAX, src, src_disp + TYPE);
+        a.load(RDX, src, src_disp + PAYLOAD);
+        a.store_dword(dst, dst_disp + TYPE, RAX);
+        a.store(dst, dst_disp + PAYLOAD, RDX);
+    }
+
+    void push(reg src, i32 disp) {
+        copy(R12, 0, src, disp);
+        a.lea(R12, R12, SLOT);
+    }
+
+    void push_literal(vtype type, i32 payload) {
+        a.store_dword(R12, TYPE, static_cast<u32>(type));
+        a.store_qword(R12, PAYLOAD, payload);
+        a.lea(R12, R12, SLOT);
+    }
+
+    // the rest of the templates only have the fast paths, for operands that
+    // are known to be numbers (booleans for NOT).
+
+    void arithmetic_numbers(opcode op) {
+        switch (op) {
+            case opcode::ADD: // b + a, like the interpreter
+                a.sse(MOVSS, XMM0, R12, TOP + PAYLOAD);
+                a.sse(ADDSS, XMM0, R12, SECOND + PAYLOAD);
+                break;
+            case opcode::SUBTRACT:
+                a.sse(MOVSS, XMM0, R12, SECOND + PAYLOAD);
+                a.sse(SUBSS, XMM0, R12, TOP + PAYLOAD);
+                break;
+            case opcode::MULTIPLY:
+                a.sse(MOVSS, XMM0, R12, SECOND + PAYLOAD);
+                a.sse(MULSS, XMM0, R12, TOP + PAYLOAD);
+                break;
+            default:
+                a.sse(MOVSS, XMM0, R12, SECOND + PAYLOAD);
+                a.sse(DIVSS, XMM0, R12, TOP + PAYLOAD);
+                break;
+        }
+        a.movd_eax_xmm0();
+        a.store(R12, SECOND + PAYLOAD, RAX);
+        a.lea(R12, R12, -SLOT);
+    }
+
+    // sets the flags so that above is a < b, a > b, or equal and no parity
+    // is a == b, for the two numbers on top.
+    void compare_numbers(opcode op) {
+        if (op == opcode::LESS) {
+            a.sse(MOVSS, XMM0, R12, TOP + PAYLOAD);
+            a.sse(UCOMISS, XMM0, R12, SECOND + PAYLOAD);
+        } else {
+            a.sse(MOVSS, XMM0, R12, SECOND + PAYLOAD);
+            a.sse(UCOMISS, XMM0, R12, TOP + PAYLOAD);
+        }
+    }
+
+    void compare_to_boolean(opcode op) {
+        compare_numbers(op);
+        if (op == opcode::EQUAL) {
+            a.setcc(CC_E, RAX);
+            a.setcc(CC_NP, RCX);
+            a.and_al_cl();
+        } else {
+            a.setcc(CC_A, RAX);
+        }
+        a.movzx_eax_al();
+        a.store_dword(R12, SECOND + TYPE, static_cast<u32>(vtype::BOOLEAN));
+        a.store(R12, SECOND + PAYLOAD, RAX);
+        a.lea(R12, R12, -SLOT);
+    }
+
+    // after compare_numbers, the jumps to patch for when the comparison is
+    // result.
+    void jumps_if(opcode comparison, bool result, dynarray<u64>& jumps) {
+        if (comparison != opcode::EQUAL) {
+            jumps.push_back(a.jcc(result ? CC_A : CC_BE));
+        } else if (result) {
+            const u64 unordered = a.jcc(CC_P);
+            jumps.push_back(a.jcc(CC_E));
+            a.patch(unordered, a.size());
+        } else {
+            jumps.push_back(a.jcc(CC_P));
+            jumps.push_back(a.jcc(CC_NE));
+        }
+    }
+
+    void negate_number() { a.xor_dword(R12, TOP + PAYLOAD, 0x80000000); }
+
+    void not_boolean() { a.xor_byte(R12, TOP + PAYLOAD, 1); }
+
+    void add_local_const_numbers(u32 x, u32 y) {
+        a.sse(MOVSS, XMM0, R14, at(y) + PAYLOAD); // constant + local, like ADD
+        a.sse(ADDSS, XMM0, R13, at(x) + PAYLOAD);
+        a.movd_eax_xmm0();
+        a.store(R13, at(x) + PAYLOAD, RAX);
+    }
+
+    void call(opcode op, u32 x, u32 y, u64 end) {
+        a.store_qword(RBX, offsetof(jit_context, pc), static_cast<i32>(end));
+        slow(op, x, y, &jit_call);
+        a.test_rax();
+        exits.push_back(a.jcc(CC_E));
+        a.cmp_rax(CALL_DONE);
+        const u64 done = a.jcc(CC_E);
+        a.load(R13, RBX, offsetof(jit_context, base)); // the callee's
+        a.lea(RSP, RSP, -8); // the callee's helpers need rsp aligned too
+        a.call(RAX);
+        a.lea(RSP, RSP, 8);
+        a.load(R12, RBX, offsetof(jit_context, top));
+        a.load(R13, RBX, offsetof(jit_context, base));
+        a.load(R14, RBX, offsetof(jit_context, constants));
+        a.patch(done, a.size());
+    }
+
+    // the epilogue goes last, then the code to its own pages.
+    jit_code* finish(dynarray<u32>& entry) {
+        const u64 exit = a.size();
+        epilogue();
+        for (u64 i{}; i < exits.size(); i++) {
+            a.patch(exits.at(i), exit);
+        }
+        return install(entry);
+    }
+
+private:
+    // copies the code to its own pages and makes them executable instead
+    // of writable.
+    jit_code* install(dynarray<u32>& entry) {
+        const u64 page = sysconf(_SC_PAGESIZE);
+        const u64 size = (a.size() + page - 1) / page * page;
+        void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED)
+            return nullptr;
+        memcpy(memory, a.bytes.data(), a.size());
+        if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+            munmap(memory, size);
+            return nullptr;
+        }
+        return table.add(static_cast<u8*>(memory), size, entry);
+    }
+};
+
+// a whole function, in bytecode order.
+class method_compiler : public emitter {
+public:
+    explicit method_compiler(const chunk& chk) : emitter(chk), entry(), fixups() {}
+
+    jit_code* run() {
+        prologue();
+        const u8* bytes = chk.bytecode.data();
+        for (u64 i{}; i <= chk.bytecode.size(); i++) {
+            entry.push_back(NO_ENTRY);
+        }
+        for (u64 offset{}; offset < chk.bytecode.size(); offset += instruction_size(bytes + offset)) {
+            entry.at(offset) = a.size();
+            instruction(offset);
+        }
+        for (u64 i{}; i < fixups.size(); i++) {
+            a.patch(fixups.at(i).at, entry.at(fixups.at(i).target));
+        }
+        // every chunk ends in RETURN, which exits, so nothing falls into
+        // the epilogue.
+        return finish(entry);
+    }
+
+private:
+    dynarray<u32> entry;
+    dynarray<fixup> fixups;
+
+    void jump_to(u64 target) {
+        fixups.push_back(fixup{ .at = a.jmp(), .target = target });
+    }
+
+    void jump_to(cond cc, u64 target) {
+        fixups.push_back(fixup{ .at = a.jcc(cc), .target = target });
+    }
+
+    void arithmetic(opcode op) {
+        dynarray<u64> to_slow;
+        guard(to_slow, R12, SECOND, vtype::NUMBER);
+        guard(to_slow, R12, TOP, vtype::NUMBER);
+        arithmetic_numbers(op);
+        const u64 done = begin_slow(to_slow);
+        slow(op);
+        end_slow(done);
+    }
+
+    void compare(opcode op) {
+        dynarray<u64> to_slow;
+        guard(to_slow, R12, SECOND, vtype::NUMBER);
+        guard(to_slow, R12, TOP, vtype::NUMBER);
+        compare_to_boolean(op);
+        const u64 done = begin_slow(to_slow);
+        slow(op);
+        end_slow(done);
+    }
+
+    void compare_branch(opcode op, opcode comparison, bool taken_when, u64 target) {
+        dynarray<u64> to_slow;
+        guard(to_slow, R12, SECOND, vtype::NUMBER);
+        guard(to_slow, R12, TOP, vtype::NUMBER);
+        compare_numbers(comparison);
+        a.lea(R12, R12, -2 * SLOT);
+        dynarray<u64> taken;
+        jumps_if(comparison, taken_when, taken);
+        for (u64 i{}; i < taken.size(); i++) {
+            fixups.push_back(fixup{ .at = taken.at(i), .target = target });
+        }
+        const u64 done = begin_slow(to_slow);
+        slow(op);
+        a.cmp_al(taken_when);
+        jump_to(CC_E, target);
+        end_slow(done);
+    }
+
+    // the interpreter returns to frames it called, native code to its own.
+    void ret(u64 offset) {
+        a.store_qword(RBX, offsetof(jit_context, pc), static_cast<i32>(offset));
+        a.cmp_dword(RBX, offsetof(jit_context, depth), 0);
+        exits.push_back(a.jcc(CC_E));
+        copy(R13, 0, R12, TOP); // where the callee's arguments started
+        a.lea(R12, R13, SLOT);
+        slow(opcode::RETURN, 0, 0, &jit_return);
+        a.ret();
+    }
+
+    void instruction(u64 offset) {
+        const u8* code = chk.bytecode.data() + offset;
+        const opcode op = short_form(generic_form(static_cast<opcode>(*code)));
+        const u64 width = operand_width(static_cast<opcode>(*code));
+        const u32 x = read_operand(code + 1, width);
+        const u32 y = read_operand(code + 1 + width, width);
+        const u64 end = offset + instruction_size(code);
+
+        switch (op) {
+            case opcode::LOAD_CONST:
+                if (!fits(x)) return exit_at(offset);
+                return push(R14, at(x));
+            case opcode::GET_GLOBAL:
+                if (!fits(x)) return exit_at(offset);
+                return push(R15, at(x));
+            case opcode::GET_LOCAL:
+                return push(R13, at(x));
+            case opcode::GET_LOCALS:
+                push(R13, at(x));
+                return push(R13, at(y));
+            case opcode::GET_LOCAL_CONST:
+                push(R13, at(x));
+                return push(R14, at(y));
+            case opcode::SET_LOCAL:
+                return copy(R13, at(x), R12, TOP);
+            case opcode::SET_LOCAL_POP:
+                copy(R13, at(x), R12, TOP);
+                return a.lea(R12, R12, -SLOT);
+            case opcode::POP:
+                return a.lea(R12, R12, -SLOT);
+            case opcode::POPN:
+                return a.lea(R12, R12, -at(x));
+            case opcode::TRUE:
+                return push_literal(vtype::BOOLEAN, 1);
+            case opcode::FALSE:
+                return push_literal(vtype::BOOLEAN, 0);
+            case opcode::NIL:
+                return push_literal(vtype::NIL, 0);
+            case opcode::BRANCH:
+                return jump_to(end + x);
+            case opcode::LOOP:
+                return jump_to(end - x);
+            case opcode::BRANCH_FALSE:
+                a.cmp_byte(R12, TOP + PAYLOAD, 0);
+                return jump_to(CC_E, end + x);
+            case opcode::POP_BRANCH_FALSE:
+                a.lea(R12, R12, -SLOT);
+                a.cmp_byte(R12, PAYLOAD, 0);
+                return jump_to(CC_E, end + x);
+            case opcode::ADD:
+            case opcode::SUBTRACT:
+            case opcode::MULTIPLY:
+            case opcode::DIVIDE:
+                return arithmetic(op);
+            case opcode::LESS:
+            case opcode::GREATER:
+            case opcode::EQUAL:
+                return compare(op);
+            case opcode::LESS_BRANCH_FALSE:
+                return compare_branch(op, opcode::LESS, false, end + x);
+            case opcode::LESS_BRANCH_TRUE:
+                return compare_branch(op, opcode::LESS, true, end + x);
+            case opcode::GREATER_BRANCH_FALSE:
+                return compare_branch(op, opcode::GREATER, false, end + x);
+            case opcode::GREATER_BRANCH_TRUE:
+                return compare_branch(op, opcode::GREATER, true, end + x);
+            case opcode::EQUAL_BRANCH_FALSE:
+                return compare_branch(op, opcode::EQUAL, false, end + x);
+            case opcode::EQUAL_BRANCH_TRUE:
+                return compare_branch(op, opcode::EQUAL, true, end + x);
+            case opcode::NEGATE: {
+                dynarray<u64> to_slow;
+                guard(to_slow, R12, TOP, vtype::NUMBER);
+                negate_number();
+                const u64 done = begin_slow(to_slow);
+                slow(op);
+                return end_slow(done);
+            }
+            case opcode::NOT: {
+                dynarray<u64> to_slow;
+                guard(to_slow, R12, TOP, vtype::BOOLEAN);
+                not_boolean();
+                const u64 done = begin_slow(to_slow);
+                slow(op);
+                return end_slow(done);
+            }
+            case opcode::ADD_LOCAL_CONST: {
+                dynarray<u64> to_slow;
+                guard(to_slow, R13, at(x), vtype::NUMBER);
+                guard(to_slow, R14, at(y), vtype::NUMBER);
+                add_local_const_numbers(x, y);
+                const u64 done = begin_slow(to_slow);
+                slow(op, x, y);
+                return end_slow(done);
+            }
+            case opcode::PRINT:
+            case opcode::DEFINE_GLOBAL:
+            case opcode::SET_GLOBAL:
+            case opcode::SET_GLOBAL_POP:
+            case opcode::GET_GLOBAL_CHECKED:
+            case opcode::SET_GLOBAL_CHECKED:
+            case opcode::GET_UPVALUE:
+            case opcode::SET_UPVALUE:
+            case opcode::SAVE_VALUE:
+            case opcode::LOAD_VALUE:
+                return slow(op, x);
+            case opcode::CALL:
+            case opcode::CALL_LOCAL:
+            case opcode::CALL_GLOBAL:
+                return call(op, x, y, end);
+            case opcode::RETURN:
+                return ret(offset);
+            default:
+                // MAKE_CLOSURE and CLOSE_VALUE.
+                return exit_at(offset);
+        }
+    }
+};
+
+// the pc a trace leaves with when its entry checks fail.
+const u64 GUARDS_FAILED = UINT64_MAX;
+
+struct side_exit {
+    u64 at;     // rel32 to patch
+    u64 offset; // where the interpreter goes on
+};
+
+// a recording, as straight line code that jumps back to its start. types
+// has the vtype of every slot from the frame's base up to the top, as far
+// as the code so far knows it. a known number needs no checks, the rest
+// takes the slow path and its result is checked against the recording.
+class trace_compiler : public emitter {
+public:
+    trace_compiler(const chunk& chk, u64 header, const dynarray<u8>& entry_types,
+                   const dynarray<trace_step>& steps) :
+        emitter(chk), header(header), entry_types(entry_types), steps(steps),
+        types(), captured(), side_exits(), ok(true) {}
+
+    jit_code* run() {
+        if (!fits(entry_types.size()))
+            return nullptr;
+        find_captured();
+        prologue();
+        dynarray<u32> entry;
+        entry.push_back(a.size());
+
+        const u64 guards = a.size();
+        for (u64 i{}; i < entry_types.size(); i++) {
+            a.cmp_dword(R13, at(i) + TYPE, entry_types.at(i));
+            side_exits.push_back(side_exit{ .at = a.jcc(CC_NE), .offset = GUARDS_FAILED });
+        }
+        const u64 body = a.size();
+        types = entry_types;
+        for (u64 i{}; i < steps.size() && ok; i++) {
+            step(i);
+        }
+        if (!ok)
+            return nullptr;
+
+        // back at the header. the entry checks only need to run again if
+        // the iteration changed (or lost track of) a local's type.
+        bool same = types.size() == entry_types.size();
+        for (u64 i{}; same && i < types.size(); i++) {
+            same = types.at(i) == entry_types.at(i);
+        }
+        a.patch(a.jmp(), same ? body : guards);
+
+        for (u64 i{}; i < side_exits.size(); i++) {
+            a.patch(side_exits.at(i).at, a.size());
+            exit_at(side_exits.at(i).offset);
+        }
+        return finish(entry);
+    }
+
+private:
+    const u64 header;
+    const dynarray<u8>& entry_types;
+    const dynarray<trace_step>& steps;
+    dynarray<u8> types;
+    dynarray<u32> captured;
+    dynarray<side_exit> side_exits;
+    bool ok; // false once the trace has something it can't compile
+
+    // the locals this chunk's closures can capture. an upvalue can change
+    // them under the trace, in a call or with SET_UPVALUE.
+    void find_captured() {
+        const u8* code = chk.bytecode.data();
+        for (u64 offset{}; offset < chk.bytecode.size(); offset += instruction_size(code + offset)) {
+            const opcode op = static_cast<opcode>(code[offset]);
+            if (short_form(op) != opcode::MAKE_CLOSURE)
+                continue;
+            const u64 width = operand_width(op);
+            const u8* pair = code + offset + 1 + width;
+            const u64 count = read_operand(code + offset + 1, width);
+            for (u64 i{}; i < count; i++, pair += 2 * width) {
+                if (read_operand(pair, width))
+                    captured.push_back(read_operand(pair + width, width));
+            }
+        }
+    }
+
+    void forget_captured() {
+        for (u64 i{}; i < captured.size(); i++) {
+            if (captured.at(i) < types.size())
+                types.at(captured.at(i)) = NO_TYPE;
+        }
+    }
+
+    u8 type_of(u64 slot) {
+        if (slot >= types.size()) {
+            ok = false;
+            return NO_TYPE;
+        }
+        return types.at(slot);
+    }
+
+    void set_type(u64 slot, u8 type) {
+        if (slot >= types.size()) {
+            ok = false;
+            return;
+        }
+        types.at(slot) = type;
+    }
+
+    // by value, the type pushed is often one of types' own.
+    void push_type(u8 type) { types.push_back(type); }
+
+    void pop_types(u64 count) {
+        for (u64 i{}; i < count; i++) {
+            if (types.size() == 0) {
+                ok = false;
+                return;
+            }
+            types.pop_back();
+        }
+    }
+
+    u8 constant_type(u64 index) {
+        if (index >= chk.constant_pool.size() || !fits(index)) {
+            ok = false;
+            return NO_TYPE;
+        }
+        return static_cast<u8>(chk.constant_pool.at(index).type());
+    }
+
+    bool top_is(vtype type, u64 from_top = 0) {
+        return types.size() > from_top && types.back(from_top) == static_cast<u8>(type);
+    }
+
+    bool numbers() { return top_is(vtype::NUMBER) && top_is(vtype::NUMBER, 1); }
+
+    void side_exit_if(cond cc, u64 offset) {
+        side_exits.push_back(side_exit{ .at = a.jcc(cc), .offset = offset });
+    }
+
+    // the flags are from comparing the branch's byte with zero, which
+    // branches when equal.
+    void branch(u64 next, u64 end, u64 target) {
+        if (next == target) {
+            side_exit_if(CC_NE, end);
+        } else {
+            side_exit_if(CC_E, target);
+        }
+    }
+
+    void compare_branch(opcode op, opcode comparison, bool taken_when, u64 next, u64 end, u64 target) {
+        const bool taken = next == target;
+        const bool leaves_when = taken ? !taken_when : taken_when;
+        const u64 off_trace = taken ? end : target;
+        if (numbers()) {
+            compare_numbers(comparison);
+            a.lea(R12, R12, -2 * SLOT);
+            dynarray<u64> jumps;
+            jumps_if(comparison, leaves_when, jumps);
+            for (u64 i{}; i < jumps.size(); i++) {
+                side_exits.push_back(side_exit{ .at = jumps.at(i), .offset = off_trace });
+            }
+        } else {
+            slow(op);
+            a.cmp_al(leaves_when);
+            side_exit_if(CC_E, off_trace);
+        }
+        pop_types(2);
+    }
+
+    // values without references never need the globals' write barrier.
+    bool needs_barrier() {
+        return !top_is(vtype::NUMBER) && !top_is(vtype::BOOLEAN) && !top_is(vtype::NIL);
+    }
+
+    void step(u64 i) {
+        const u8* code = chk.bytecode.data() + steps.at(i).offset;
+        const opcode op = short_form(generic_form(static_cast<opcode>(*code)));
+        const u64 width = operand_width(static_cast<opcode>(*code));
+        const u32 x = read_operand(code + 1, width);
+        const u32 y = read_operand(code + 1 + width, width);
+        const u64 end = steps.at(i).offset + instruction_size(code);
+        const bool last = i + 1 == steps.size();
+        const u64 next = last ? header : steps.at(i + 1).offset;
+        const u8 recorded = last ? NO_TYPE : steps.at(i + 1).top_type;
+
+        switch (op) {
+            case opcode::LOAD_CONST:
+                push_type(constant_type(x));
+                if (ok) push(R14, at(x));
+                break;
+            case opcode::GET_GLOBAL:
+                if (!fits(x)) {
+                    ok = false;
+                    break;
+                }
+                push(R15, at(x));
+                push_type(NO_TYPE);
+                break;
+            case opcode::GET_LOCAL:
+                push(R13, at(x));
+                push_type(type_of(x));
+                break;
+            case opcode::GET_LOCALS:
+                push(R13, at(x));
+                push(R13, at(y));
+                push_type(type_of(x));
+                push_type(type_of(y));
+                break;
+            case opcode::GET_LOCAL_CONST:
+                push_type(type_of(x));
+                push_type(constant_type(y));
+                if (!ok) break;
+                push(R13, at(x));
+                push(R14, at(y));
+                break;
+            case opcode::SET_LOCAL:
+                copy(R13, at(x), R12, TOP);
+                set_type(x, type_of(types.size() - 1));
+                break;
+            case opcode::SET_LOCAL_POP:
+                copy(R13, at(x), R12, TOP);
+                a.lea(R12, R12, -SLOT);
+                set_type(x, type_of(types.size() - 1));
+                pop_types(1);
+                break;
+            case opcode::POP:
+                a.lea(R12, R12, -SLOT);
+                pop_types(1);
+                break;
+            case opcode::POPN:
+                a.lea(R12, R12, -at(x));
+                pop_types(x);
+                break;
+            case opcode::TRUE:
+                push_literal(vtype::BOOLEAN, 1);
+                push_type(static_cast<u8>(vtype::BOOLEAN));
+                break;
+            case opcode::FALSE:
+                push_literal(vtype::BOOLEAN, 0);
+                push_type(static_cast<u8>(vtype::BOOLEAN));
+                break;
+            case opcode::NIL:
+                push_literal(vtype::NIL, 0);
+                push_type(static_cast<u8>(vtype::NIL));
+                break;
+            case opcode::BRANCH:
+            case opcode::LOOP:
+                break; // the recording went where they go
+            case opcode::BRANCH_FALSE:
+                a.cmp_byte(R12, TOP + PAYLOAD, 0);
+                branch(next, end, end + x);
+                break;
+            case opcode::POP_BRANCH_FALSE:
+                a.lea(R12, R12, -SLOT);
+                a.cmp_byte(R12, PAYLOAD, 0);
+                branch(next, end, end + x);
+                pop_types(1);
+                break;
+            case opcode::ADD:
+            case opcode::SUBTRACT:
+            case opcode::MULTIPLY:
+            case opcode::DIVIDE: {
+                const bool known = numbers();
+                if (known) {
+                    arithmetic_numbers(op);
+                } else {
+                    slow(op);
+                }
+                pop_types(2);
+                push_type(known ? static_cast<u8>(vtype::NUMBER) : NO_TYPE);
+                break;
+            }
+            case opcode::LESS:
+            case opcode::GREATER:
+            case opcode::EQUAL: {
+                const bool known = numbers();
+                if (known) {
+                    compare_to_boolean(op);
+                } else {
+                    slow(op);
+                }
+                pop_types(2);
+                push_type(known ? static_cast<u8>(vtype::BOOLEAN) : NO_TYPE);
+                break;
+            }
+            case opcode::LESS_BRANCH_FALSE:
+                compare_branch(op, opcode::LESS, false, next, end, end + x);
+                break;
+            case opcode::LESS_BRANCH_TRUE:
+                compare_branch(op, opcode::LESS, true, next, end, end + x);
+                break;
+            case opcode::GREATER_BRANCH_FALSE:
+                compare_branch(op, opcode::GREATER, false, next, end, end + x);
+                break;
+            case opcode::GREATER_BRANCH_TRUE:
+                compare_branch(op, opcode::GREATER, true, next, end, end + x);
+                break;
+            case opcode::EQUAL_BRANCH_FALSE:
+                compare_branch(op, opcode::EQUAL, false, next, end, end + x);
+                break;
+            case opcode::EQUAL_BRANCH_TRUE:
+                compare_branch(op, opcode::EQUAL, true, next, end, end + x);
+                break;
+            case opcode::NEGATE:
+                if (top_is(vtype::NUMBER)) {
+                    negate_number();
+                } else {
+                    slow(op);
+                    set_type(types.size() - 1, NO_TYPE);
+                }
+                break;
+            case opcode::NOT:
+                if (top_is(vtype::BOOLEAN)) {
+                    not_boolean();
+                } else {
+                    slow(op);
+                    set_type(types.size() - 1, NO_TYPE);
+                }
+                break;
+            case opcode::ADD_LOCAL_CONST:
+                if (type_of(x) == static_cast<u8>(vtype::NUMBER)
+                    && constant_type(y) == static_cast<u8>(vtype::NUMBER)) {
+                    add_local_const_numbers(x, y);
+                } else if (ok) {
+                    slow(op, x, y);
+                    set_type(x, NO_TYPE);
+                }
+                break;
+            case opcode::SET_GLOBAL:
+            case opcode::SET_GLOBAL_POP:
+                if (needs_barrier() || !fits(x)) {
+                    slow(op, x);
+                } else {
+                    copy(R15, at(x), R12, TOP);
+                    if (op == opcode::SET_GLOBAL_POP) a.lea(R12, R12, -SLOT);
+                }
+                if (op == opcode::SET_GLOBAL_POP) pop_types(1);
+                break;
+            case opcode::PRINT:
+            case opcode::DEFINE_GLOBAL:
+            case opcode::SAVE_VALUE:
+                slow(op, x);
+                pop_types(1);
+                break;
+            case opcode::GET_GLOBAL_CHECKED:
+            case opcode::GET_UPVALUE:
+            case opcode::LOAD_VALUE:
+                slow(op, x);
+                push_type(NO_TYPE);
+                break;
+            case opcode::SET_GLOBAL_CHECKED:
+                slow(op, x);
+                break;
+            case opcode::SET_UPVALUE:
+                slow(op, x);
+                forget_captured();
+                break;
+            case opcode::CALL:
+                call(op, x, y, end);
+                pop_types(x + 1);
+                push_type(NO_TYPE);
+                forget_captured();
+                break;
+            case opcode::CALL_LOCAL:
+            case opcode::CALL_GLOBAL:
+                call(op, x, y, end);
+                pop_types(y);
+                push_type(NO_TYPE);
+                forget_captured();
+                break;
+            default:
+                // RETURN, MAKE_CLOSURE and CLOSE_VALUE, the recorder stops
+                // at them.
+                ok = false;
+                break;
+        }
+
+        // check a result the templates don't know against the recording.
+        if (ok && types.size() > 0 && types.back() == NO_TYPE && recorded != NO_TYPE) {
+            a.cmp_dword(R12, TOP + TYPE, recorded);
+            side_exit_if(CC_NE, next);
+            types.back() = recorded;
+        }
+    }
+};
+
+// runs code from its entry at native_offset, with frame as the running frame.
+void run_native(vmachine& vm, call_frame& frame, const jit_code& code, u32 native_offset,
+                jit_context& ctx) {
+    ctx.top = vm.value_stack.top();
+    ctx.globals = vm.globals.data();
+    ctx.vm = &vm;
+    ctx.pc = frame.pc;
+    ctx.depth = 0;
+    enter_frame(&ctx, frame);
+
+    using native_entry = void (*)(jit_context*, const u8*);
+    reinterpret_cast<native_entry>(code.native)(&ctx, code.native + native_offset);
+
+    vm.value_stack.set_top(ctx.top);
+}
+
+bool supported() {
+    static const bool layout = layout_matches();
+    return layout;
+}
+
+} // namespace
+
+jit_code* jit_compile(const chunk& chk) {
+    if (!supported() || chk.bytecode.size() >= INT32_MAX)
+        return nullptr;
+    return method_compiler(chk).run();
+}
+
+void jit_run(vmachine& vm, call_frame& frame) {
+    const jit_code& code = *frame.c->get_chunk().jit;
+    const u32 entry = code.entry.at(frame.pc);
+    panic_if(entry == NO_ENTRY, "jit: entered in the middle of an instruction");
+
+    jit_context ctx;
+    run_native(vm, frame, code, entry, ctx);
+    ctx.frame->pc = ctx.pc;
+}
+
+jit_code* jit_compile_trace(const chunk& chk, u64 header, const dynarray<u8>& entry_types,
+                            const dynarray<trace_step>& steps) {
+    if (!supported() || chk.bytecode.size() >= INT32_MAX)
+        return nullptr;
+    return trace_compiler(chk, header, entry_types, steps).run();
+}
+
+bool jit_run_trace(vmachine& vm, call_frame& frame, const jit_code& trace) {
+    jit_context ctx;
+    run_native(vm, frame, trace, trace.entry.at(0), ctx);
+    if (ctx.pc == GUARDS_FAILED)
+        return false;
+    ctx.frame->pc = ctx.pc;
+    return true;
+}
+
+#else
+
+jit_code* jit_compile(const chunk&) { return nullptr; }
+
+void jit_run(vmachine&, call_frame&) {}
+
+jit_code* jit_compile_trace(const chunk&, u64, const dynarray<u8>&, const dynarray<trace_step>&) {
+    return nullptr;
+}
+
+bool jit_run_trace(vmachine&, call_frame&, const jit_code&) { return false; }
+
+#endif
+
+void trace_recorder::start(vmachine& vm, u64 loop_header) {
+    const call_frame& frame = vm.call_frames.back();
+    header = loop_header;
+    depth = vm.call_frames.size();
+    entry_types = dynarray<u8>();
+    steps = dynarray<trace_step>();
+    for (u64 i = frame.bp; i < vm.value_stack.size(); i++) {
+        entry_types.push_back(static_cast<u8>(vm.value_stack.data()[i].type()));
+    }
+    next = header;
+    target = header;
+}
+
+bool trace_recorder::record(vmachine& vm, u64 offset) {
+    const u64 frames = vm.call_frames.size();
+    if (frames > depth)
+        return true; // a call the trace makes
+    // a quickened instruction that deoptimized, running again as the generic one.
+    if (frames == depth && steps.size() > 0 && offset == steps.back().offset && offset != header)
+        return true;
+    // the frame returned, or native code ran part of it.
+    if (frames < depth || (steps.size() > 0 && offset != next && offset != target)) {
+        stop();
+        return false;
+    }
+
+    if (offset == header && steps.size() > 0) {
+        chunk& chk = vm.call_frames.back().c->get_chunk();
+        chk.loop_at(header).trace = jit_compile_trace(chk, header, entry_types, steps);
+        // a for loop's body LOOPs to its increment, which LOOPs to the
+        // condition. the trace has both, the other header needs none.
+        for (u64 i{}; i < steps.size(); i++) {
+            const u64 at = steps.at(i).offset;
+            if (short_form(static_cast<opcode>(chk.bytecode.at(at))) != opcode::LOOP)
+                continue;
+            const u64 other = branch_target(chk.bytecode.data(), at);
+            if (other != header)
+                chk.loop_at(other).recordings = MAX_TRACE_RECORDINGS;
+        }
+        stop();
+        return false;
+    }
+
+    const call_frame& frame = vm.call_frames.back();
+    const opcode op = short_form(generic_form(static_cast<opcode>(frame.code[offset])));
+    bool seen = false; // an inner loop
+    for (u64 i{}; i < steps.size() && !seen; i++) {
+        seen = steps.at(i).offset == offset;
+    }
+    if (seen || steps.size() == MAX_TRACE_LENGTH || op == opcode::RETURN
+        || op == opcode::MAKE_CLOSURE || op == opcode::CLOSE_VALUE) {
+        stop();
+        return false;
+    }
+
+    const u8 top_type = vm.value_stack.size() > frame.bp ?
+        static_cast<u8>(vm.value_stack.back().type()) : NO_TYPE;
+    steps.push_back(trace_step{ .offset = static_cast<u32>(offset), .top_type = top_type });
+    next = offset + instruction_size(frame.code + offset);
+    target = is_branch(op) ? branch_target(frame.code, offset) : next;
+    if (op == opcode::BRANCH || op == opcode::LOOP)
+        next = target;
+    return true;
+}
+
+void trace_recorder::stop() {
+    depth = 0;
+    entry_types = dynarray<u8>();
+    steps = dynarray<trace_step>();
+}
+
+} // namespace sting
@@ -0,0 +1,151 @@
+#ifndef JIT_HPP
+#define JIT_HPP
+
+#include "utilities.hpp"
+#include "dynarray.hpp"
+#include "value.hpp"
+#include "chunk.hpp"
+
+// the jit writes x86-64 code for the default value layout. build with
+// -DSTING_NO_JIT to leave it out everywhere else too.
+#if defined(__x86_64__) && defined(__linux__) && !defined(STING_NAN_BOXING) \
+    && !defined(STING_PROFILE) && !defined(STING_NO_JIT)
+#define STING_JIT
+#endif
+
+namespace sting {
+
+/*
+ *  Baseline jit.
+ *
+ *  once a function has been called jit_threshold times (STING_JIT_THRESHOLD,
+ *  STING_NO_JIT turns it off) its stack bytecode is compiled to native code:
+ *  every instruction gets a fixed template with its operands patched in, in
+ *  bytecode order, so any instruction boundary is also an entry point.
+ *
+ *  arithmetic and comparisons on numbers, locals, constants, unchecked
+ *  globals and branches run natively. the rest of the value semantics
+ *  (strings, type errors, globals that need the write barrier, upvalues)
+ *  goes through jit_slow_path, which does what the interpreter does.
+ *
+ *  the native code works on the vm's own value stack and frames, it just
+ *  keeps the top in a register, so upvalues and the collector see the same
+ *  stack they always do. a call pushes the callee's frame like the
+ *  interpreter does, and when the callee has native code it's a native
+ *  call, and its RETURN pops the frame and returns to the caller's code.
+ *  anything else (a callee without native code, returning to a frame that
+ *  the interpreter runs, closures and closing upvalues) leaves the native
+ *  code, from however deep, with the top frame's pc on the instruction for
+ *  the interpreter to run. the interpreter enters the native code again at
+ *  the frame's pc after every call and return.
+ *
+ *  registers while native code runs:
+ *      rbx  the jit_context
+ *      r12  value stack top, the first free slot
+ *      r13  the frame's base, its first local
+ *      r14  the frame's constants, reloaded after anything that collects
+ *      r15  the globals
+ */
+
+/*
+ *  Traces.
+ *
+ *  the interpreter counts how often each LOOP jumps back to its target, the
+ *  loop's header. once one has done it trace_threshold times
+ *  (STING_TRACE_THRESHOLD) the next iteration is recorded: every
+ *  instruction the frame runs from the header until it's back there, with
+ *  the type of the value on top before each one. the trace is that one path
+ *  compiled as straight line code, in a loop.
+ *
+ *  on entry it checks the vtype of every local against the recording. the
+ *  types of everything it pushes follow from those, or are checked against
+ *  the recorded ones when they can't (globals, calls, upvalues), so numbers
+ *  need no checks at all. a branch the recording didn't take, or a type
+ *  that doesn't match, is a side exit: the trace stops with the frame's pc
+ *  on the next instruction, for run_chunk to go on from. the stack and the
+ *  locals are always written back, there's nothing to restore.
+ *
+ *  only whole iterations of the frame itself are recorded: a loop with an
+ *  inner loop, a closure or a return in it isn't traced (its inner loop
+ *  gets its own trace), calls run like they do in the method code.
+ */
+
+const u64 DEFAULT_JIT_THRESHOLD = 1000;
+const u64 DEFAULT_TRACE_THRESHOLD = 50;
+const u64 MAX_TRACE_LENGTH = 500;    // instructions
+const u32 MAX_TRACE_RECORDINGS = 4;  // per loop, then it stays interpreted
+const u8 NO_TYPE = 0xff;
+
+struct vmachine;
+struct call_frame;
+
+struct trace_step {
+    u32 offset;
+    u8 top_type; // of the value on top before it ran, NO_TYPE for none
+};
+
+struct jit_code {
+    u8* native;          // executable, starts with the entry trampoline
+    u64 size;            // of the mapping
+    dynarray<u32> entry; // native offset of each bytecode offset, a trace's start
+};
+
+// what the native code reads and writes, everything else it gets from
+// the vm in jit_slow_path.
+struct jit_context {
+    value* top;
+    value* base;
+    value const* constants;
+    value* globals;
+    vmachine* vm;
+    call_frame* frame;
+    u64 pc; // where the native code stopped
+    u32 depth; // native calls the running frame is nested in
+    void* sp; // rsp to exit with, from any depth
+};
+
+// native code for chk, or nullptr when this build or machine can't jit it.
+jit_code* jit_compile(const chunk& chk);
+
+// runs the current frame's native code from frame.pc, until it leaves an
+// instruction to the interpreter at the top frame's pc.
+void jit_run(vmachine& vm, call_frame& frame);
+
+// native code for the loop at header, from a recording that started with
+// the frame's slots holding entry_types. nullptr if it can't be compiled.
+jit_code* jit_compile_trace(const chunk& chk, u64 header, const dynarray<u8>& entry_types,
+                            const dynarray<trace_step>& steps);
+
+// runs a trace of the frame's loop at frame.pc, until a side exit. false if
+// its entry checks failed, then nothing ran.
+bool jit_run_trace(vmachine& vm, call_frame& frame, const jit_code& trace);
+
+// records the frame at the top of call_frames from a loop header, see
+// vmachine::hot_loop. the loop's count of recordings is taken when it
+// starts, so a recording that ends in an abort needn't find the loop again.
+class trace_recorder {
+public:
+    trace_recorder() : header(0), depth(0), entry_types(), steps(), next(0), target(0) {}
+
+    bool active() const { return depth != 0; }
+
+    void start(vmachine& vm, u64 header);
+
+    // before every instruction while active, from any frame. false once the
+    // recording is over, compiled or not.
+    bool record(vmachine& vm, u64 offset);
+
+private:
+    u64 header;
+    u64 depth; // call_frames.size() of the recorded frame, 0 when inactive
+    dynarray<u8> entry_types;
+    dynarray<trace_step> steps;
+    u64 next;   // where the last step falls through to
+    u64 target; // and where it branches to, if it can
+
+    void stop();
+};
+
+} // namespace sting
+
+#endif
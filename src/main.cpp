@@ -1,7 +1,18 @@
 #include "sting.hpp"
 
-i32 main() {
-    const std::filesystem::path file("main.sting");
-    sting::vm_result result = sting::interpret(file, true);
+// sting [-d] [file]
+// with no file, runs main.sting with debug output (source and bytecode).
+i32 main(i32 argc, char** argv) {
+    bool debug = argc == 1;
+    std::filesystem::path file("main.sting");
+    for (i32 i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-d") == 0) {
+            debug = true;
+        } else {
+            file = argv[i];
+        }
+    }
+
+    sting::vm_result result = sting::interpret(file, debug);
     sting::manage_result(result); // uses exit
 }
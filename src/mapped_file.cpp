@@ -0,0 +1,56 @@
+#include "mapped_file.hpp"
+
+#ifdef STING_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace sting {
+
+mapped_file::mapped_file(const std::filesystem::path& path) :
+    _data(nullptr),
+    _size(0),
+    opened(false),
+    mapped(false),
+    contents()
+{
+#ifdef STING_MMAP
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return;
+    }
+    // an empty file can't be mapped, it's an empty buffer instead.
+    if (st.st_size > 0) {
+        void* data = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            _data = static_cast<u8*>(data);
+            _size = st.st_size;
+            mapped = true;
+        }
+    }
+    close(fd);
+    if (mapped) {
+        opened = true;
+        return;
+    }
+#endif
+    std::error_code error;
+    if (!std::filesystem::is_regular_file(path, error)) return;
+    contents = read_file(path);
+    _data = contents.data();
+    _size = contents.size();
+    opened = true;
+}
+
+mapped_file::~mapped_file() {
+#ifdef STING_MMAP
+    if (mapped) munmap(_data, _size);
+#endif
+}
+
+} // namespace sting
@@ -0,0 +1,43 @@
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include "utilities.hpp"
+
+#if __has_include(<sys/mman.h>)
+#define STING_MMAP
+#endif
+
+namespace sting {
+
+/*
+ *  A file's contents, mapped into memory where there's mmap and read into
+ *  a buffer where there isn't. the mapping is private, so writing to it
+ *  never reaches the file, and nothing has to be copied unless something
+ *  does. there's no terminator after the last byte, size() is the end.
+ */
+class mapped_file {
+public:
+    explicit mapped_file(const std::filesystem::path& path);
+    ~mapped_file();
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    // false when the file couldn't be opened or read.
+    bool is_open() const { return opened; }
+
+    u8* data() { return _data; }
+    const u8* data() const { return _data; }
+    u64 size() const { return _size; }
+
+private:
+    u8* _data;
+    u64 _size;
+    bool opened;
+    bool mapped; // else _data is contents
+    std::string contents;
+};
+
+} // namespace sting
+
+#endif
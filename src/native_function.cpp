@@ -1,4 +1,5 @@
 #include "native_function.hpp"
+#include "gc.hpp"
 #include <ctime>
 
 namespace sting {
@@ -13,6 +14,7 @@ native_function::native_function(const string& name, u64 arity, pfn native_fn) :
 }
 
 native_function::native_function(const native_function& other) :
+    object(),
     name(other.name),
     arity(other.arity),
     native_fn(other.native_fn)
@@ -47,9 +49,15 @@ value native_function::call(const dynarray<value>& args) {
 }
 
 object *native_function::clone() const {
-    object *func = new native_function(*this);
-    object_list.push_back(func);
-    return func;
+    return gc.make<native_function>(*this);
+}
+
+object *native_function::relocate() {
+    return new native_function(stealable(*this));
+}
+
+u64 native_function::footprint() const {
+    return sizeof(native_function) + name.size();
 }
 
 u8 *native_function::cstr() const {
@@ -69,4 +77,11 @@ value clock(const dynarray<value>& /* args */) {
     return value(ms);
 }
 
+const dynarray<native_function>& native_functions() {
+    static const dynarray<native_function> natives = {
+        native_function("clock", 0, clock),
+    };
+    return natives;
+}
+
 } // namespace sting
@@ -18,9 +18,12 @@ public:
     native_function& operator=(native_function&& other);
 
     u64 get_arity() { return arity; }
+    const string& get_name() const { return name; }
     value call(const dynarray<value>& args);
     object *clone() const override;
+    object *relocate() override;
     u8 *cstr() const override;
+    u64 footprint() const override;
 
     friend std::ostream& operator<<(std::ostream& os, const native_function& func);
 private:
@@ -33,6 +36,9 @@ private:
 
 value clock(const dynarray<value>& args);
 
+// every native, the parser defines each one as a global.
+const dynarray<native_function>& native_functions();
+
 } // namespace sting
 
 #endif
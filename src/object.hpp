@@ -6,16 +6,36 @@
 
 namespace sting {
 
+class collector;
+
 class object {
 public:
+    object() = default;
+    // the header belongs to the allocation, not the contents.
+    object(const object&) {}
+    object& operator=(const object&) { return *this; }
+
     // we can copy derived from base pointer
     virtual object *clone() const = 0;
     virtual u8 *cstr() const = 0;
+    // move this object into a new old space allocation, used when the
+    // collector promotes it out of the nursery.
+    virtual object *relocate() = 0;
+    // visit every heap reference this object holds. the collector may
+    // rewrite them when it moves the objects they point to.
+    virtual void trace(collector& /* gc */) {}
+    // bytes owned by this object, used to pace the collector.
+    virtual u64 footprint() const = 0;
     virtual ~object() = default;
-};
 
-// make a memory arena?
-extern dynarray<object*> object_list;
+    // collector bookkeeping, unused by objects that aren't on the heap
+    // (e.g. the function the parser is still building).
+    object* gc_next = nullptr; // old space list, or forwarding address in the nursery
+    u64 gc_bytes = 0;
+    u32 gc_cell = 0; // size of the nursery cell, 0 in the old space
+    bool gc_marked = false;
+    bool gc_remembered = false;
+};
 
 } // namespace sting
 
@@ -0,0 +1,570 @@
+#include "optimizer.hpp"
+
+namespace sting {
+
+namespace {
+
+struct instruction {
+    opcode op; // never a wide form, encoding picks those again
+    dynarray<u32> operands; // MAKE_CLOSURE: the count, then the pairs
+    u64 line;
+    u64 target; // branches only, index of the instruction they land on
+    bool live;
+    bool is_target;
+};
+
+// LOOP is decoded as BRANCH, encoding picks the one the direction needs.
+// everything else only branches forwards.
+bool is_branch(opcode op) {
+    switch (op) {
+        case opcode::BRANCH:
+        case opcode::BRANCH_FALSE:
+        case opcode::POP_BRANCH_FALSE:
+        case opcode::LESS_BRANCH_FALSE:
+        case opcode::LESS_BRANCH_TRUE:
+        case opcode::GREATER_BRANCH_FALSE:
+        case opcode::GREATER_BRANCH_TRUE:
+        case opcode::EQUAL_BRANCH_FALSE:
+        case opcode::EQUAL_BRANCH_TRUE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool is_pop(opcode op) {
+    return op == opcode::POP || op == opcode::POPN;
+}
+
+u32 pop_count(const instruction& in) {
+    return in.op == opcode::POP ? 1 : in.operands.at(0);
+}
+
+// the compare and branch a comparison fuses into, with or without a NOT
+// in between. OPCODE_COUNT if it isn't a comparison.
+opcode compare_branch(opcode compare, bool negated) {
+    switch (compare) {
+        case opcode::LESS:
+            return negated ? opcode::LESS_BRANCH_TRUE : opcode::LESS_BRANCH_FALSE;
+        case opcode::GREATER:
+            return negated ? opcode::GREATER_BRANCH_TRUE : opcode::GREATER_BRANCH_FALSE;
+        case opcode::EQUAL:
+            return negated ? opcode::EQUAL_BRANCH_TRUE : opcode::EQUAL_BRANCH_FALSE;
+        default:
+            return opcode::OPCODE_COUNT;
+    }
+}
+
+// index of the constant operand of instructions that load one, or -1.
+i64 constant_operand(opcode op) {
+    switch (op) {
+        case opcode::LOAD_CONST:
+            return 0;
+        case opcode::GET_LOCAL_CONST:
+        case opcode::ADD_LOCAL_CONST:
+            return 1;
+        default:
+            return -1;
+    }
+}
+
+// the get that reads back what set just stored.
+bool reads_back(opcode set, opcode get) {
+    switch (set) {
+        case opcode::SET_LOCAL:
+            return get == opcode::GET_LOCAL;
+        case opcode::SET_UPVALUE:
+            return get == opcode::GET_UPVALUE;
+        case opcode::SET_GLOBAL:
+        case opcode::SET_GLOBAL_CHECKED:
+            return get == opcode::GET_GLOBAL || get == opcode::GET_GLOBAL_CHECKED;
+        default:
+            return false;
+    }
+}
+
+class peephole {
+public:
+    peephole(chunk& chk) : chk(chk), code() {}
+
+    void run() {
+        decode();
+        bool changed = true;
+        while (changed) {
+            changed = thread_jumps();
+            changed |= remove_unreachable();
+            changed |= rewrite();
+        }
+        fuse_pops_into_branches();
+        select_superinstructions();
+        encode();
+    }
+
+private:
+    void decode() {
+        const u8* bytes = chk.bytecode.data();
+        const u64 size = chk.bytecode.size();
+        dynarray<u64> index_of(size + 1);
+        for (u64 i{}; i <= size; i++) {
+            index_of.push_back(UINT64_MAX);
+        }
+
+        u64 run = 0;
+        for (u64 offset{}; offset < size; offset += instruction_size(bytes + offset)) {
+            while (run + 1 < chk.lines.size() && chk.lines.at(run + 1).offset <= offset) {
+                run++;
+            }
+
+            const opcode op = static_cast<opcode>(bytes[offset]);
+            const u64 width = operand_width(op);
+            u64 count = operand_count(op);
+            if (short_form(op) == opcode::MAKE_CLOSURE)
+                count += 2 * read_operand(bytes + offset + 1, width);
+            // sized for its operands, a default dynarray is much bigger and
+            // there's one per instruction.
+            instruction in{ short_form(op), dynarray<u32>(count + 1), chk.lines.at(run).line, 0, true, false };
+            for (u64 i{}; i < count; i++) {
+                in.operands.push_back(read_operand(bytes + offset + 1 + i * width, width));
+            }
+
+            // a target offset for now, an index once everything is decoded.
+            const u64 end = offset + instruction_size(bytes + offset);
+            if (in.op == opcode::LOOP) {
+                in.op = opcode::BRANCH;
+                in.target = end - in.operands.at(0);
+            } else if (is_branch(in.op)) {
+                in.target = end + in.operands.at(0);
+            }
+
+            index_of.data()[offset] = code.size();
+            code.push_back(in);
+        }
+        index_of.data()[size] = code.size();
+
+        for (u64 i{}; i < code.size(); i++) {
+            instruction& in = code.data()[i];
+            if (!is_branch(in.op)) continue;
+            panic_if(in.target > size || index_of.data()[in.target] == UINT64_MAX,
+                     "peephole: branch into the middle of an instruction");
+            in.target = index_of.data()[in.target];
+        }
+    }
+
+    // first live instruction at or after i, code.size() past the end.
+    u64 live_from(u64 i) const {
+        while (i < code.size() && !code.at(i).live) i++;
+        return i;
+    }
+
+    bool thread_jumps() {
+        bool changed = false;
+        for (u64 i{}; i < code.size(); i++) {
+            instruction& in = code.data()[i];
+            if (!in.live || !is_branch(in.op)) continue;
+
+            u64 target = live_from(in.target);
+            for (u64 hops{}; hops < code.size() && target < code.size(); hops++) {
+                const instruction& next = code.at(target);
+                const bool follow = next.op == opcode::BRANCH ||
+                                    (in.op == opcode::BRANCH_FALSE && next.op == opcode::BRANCH_FALSE);
+                const u64 after = live_from(next.target);
+                // only BRANCH can go backwards.
+                if (!follow || (in.op != opcode::BRANCH && after <= i))
+                    break;
+                target = after;
+            }
+
+            if (in.op == opcode::BRANCH && target == live_from(i + 1)) {
+                in.live = false; // lands on the next instruction anyway
+                changed = true;
+            } else if (target != in.target) {
+                in.target = target;
+                changed = true;
+            }
+        }
+        return changed;
+    }
+
+    bool remove_unreachable() {
+        dynarray<bool> reached(code.size());
+        for (u64 i{}; i < code.size(); i++) {
+            reached.push_back(false);
+        }
+
+        dynarray<u64> work;
+        work.push_back(live_from(0));
+        while (work.size() > 0) {
+            const u64 i = work.pop_back();
+            if (i >= code.size() || reached.at(i)) continue;
+            reached.at(i) = true;
+
+            const instruction& in = code.at(i);
+            if (is_branch(in.op))
+                work.push_back(live_from(in.target));
+            if (in.op != opcode::RETURN && in.op != opcode::BRANCH)
+                work.push_back(live_from(i + 1));
+        }
+
+        bool changed = false;
+        for (u64 i{}; i < code.size(); i++) {
+            if (code.at(i).live && !reached.at(i)) {
+                code.at(i).live = false;
+                changed = true;
+            }
+        }
+        return changed;
+    }
+
+    void mark_targets() {
+        for (u64 i{}; i < code.size(); i++) {
+            code.at(i).is_target = false;
+        }
+        for (u64 i{}; i < code.size(); i++) {
+            const instruction& in = code.at(i);
+            if (in.live && is_branch(in.op) && live_from(in.target) < code.size())
+                code.at(live_from(in.target)).is_target = true;
+        }
+    }
+
+    void kill(const dynarray<u64>& live, u64 from, u64 to) {
+        for (u64 k = from; k < to; k++) {
+            code.at(live.at(k)).live = false;
+        }
+    }
+
+    // the pattern rewrites, each only over straight line code: nothing after
+    // the first instruction of a match may be a branch target.
+    bool rewrite() {
+        mark_targets();
+        dynarray<u64> live;
+        for (u64 i{}; i < code.size(); i++) {
+            if (code.at(i).live) live.push_back(i);
+        }
+        const auto at = [&](u64 k) -> instruction& { return code.at(live.at(k)); };
+
+        bool changed = false;
+        for (u64 k{}; k < live.size(); k++) {
+            if (!at(k).live) continue;
+
+            // SAVE_VALUE, pops, LOAD_VALUE, RETURN => RETURN
+            if (at(k).op == opcode::SAVE_VALUE) {
+                u64 j = k + 1;
+                while (j < live.size() && is_pop(at(j).op) && !at(j).is_target) j++;
+                if (j + 1 < live.size() && at(j).op == opcode::LOAD_VALUE && !at(j).is_target &&
+                    at(j + 1).op == opcode::RETURN) {
+                    kill(live, k, j + 1);
+                    changed = true;
+                    continue;
+                }
+            }
+
+            // TRUE, BRANCH_FALSE, POP => nothing, the branch is never taken.
+            // folded conditions like while (true) end up here.
+            if (k + 2 < live.size() && at(k).op == opcode::TRUE &&
+                at(k + 1).op == opcode::BRANCH_FALSE && !at(k + 1).is_target &&
+                at(k + 2).op == opcode::POP && !at(k + 2).is_target) {
+                kill(live, k, k + 3);
+                changed = true;
+                continue;
+            }
+
+            // SET x, POP, GET x => SET x
+            if (k + 2 < live.size() && reads_back(at(k).op, at(k + 2).op) &&
+                at(k + 1).op == opcode::POP && !at(k + 1).is_target && !at(k + 2).is_target &&
+                at(k).operands.at(0) == at(k + 2).operands.at(0)) {
+                kill(live, k + 1, k + 3);
+                changed = true;
+                continue;
+            }
+
+            // POP, POP, ... => POPN
+            if (is_pop(at(k).op)) {
+                u64 total = pop_count(at(k));
+                u64 j = k + 1;
+                while (j < live.size() && is_pop(at(j).op) && !at(j).is_target) {
+                    total += pop_count(at(j));
+                    j++;
+                }
+                if (j > k + 1) {
+                    at(k).op = opcode::POPN;
+                    at(k).operands = dynarray<u32>{ static_cast<u32>(total) };
+                    kill(live, k + 1, j);
+                    changed = true;
+                }
+            }
+        }
+        return changed;
+    }
+
+    // the last instruction before i that is still live, code.size() if none.
+    u64 live_before(u64 i) const {
+        while (i > 0) {
+            if (code.at(--i).live) return i;
+        }
+        return code.size();
+    }
+
+    // an upper bound on where each instruction starts once encoded, as if
+    // every operand were 4 bytes. nothing done to the code after this makes
+    // the stretch between two instructions longer than it is here.
+    dynarray<u64> widest_offsets() const {
+        dynarray<u64> offsets(code.size() + 1);
+        u64 offset = 0;
+        for (u64 i{}; i < code.size(); i++) {
+            offsets.push_back(offset);
+            if (code.at(i).live)
+                offset += 1 + sizeof(u32) * code.at(i).operands.size();
+        }
+        offsets.push_back(offset);
+        return offsets;
+    }
+
+    // the condition of an if or while is popped on both paths: after the
+    // BRANCH_FALSE, and at its target (where it may have become part of a
+    // POPN). when the target's pop is only reached by branching to it, and
+    // every branch there is a BRANCH_FALSE followed by a POP, the branches
+    // pop the condition themselves. POP_BRANCH_FALSE has no wide form, so
+    // only branches that are sure to stay short are fused.
+    void fuse_pops_into_branches() {
+        mark_targets();
+        const dynarray<u64> widest = widest_offsets();
+        dynarray<bool> fusable(code.size());
+        for (u64 i{}; i < code.size(); i++) {
+            const u64 before = live_before(i);
+            const bool falls_in = before < code.size() &&
+                                  code.at(before).op != opcode::BRANCH && code.at(before).op != opcode::RETURN;
+            fusable.push_back(code.at(i).live && code.at(i).is_target &&
+                              is_pop(code.at(i).op) && !falls_in);
+        }
+
+        for (u64 i{}; i < code.size(); i++) {
+            const instruction& in = code.at(i);
+            if (!in.live || !is_branch(in.op)) continue;
+            const u64 target = live_from(in.target);
+            if (target >= code.size() || !fusable.at(target)) continue;
+
+            const u64 next = live_from(i + 1);
+            if (in.op != opcode::BRANCH_FALSE || next >= code.size() ||
+                code.at(next).op != opcode::POP || code.at(next).is_target ||
+                !operand_fits(widest.at(target) - widest.at(i + 1), operand_width(opcode::POP_BRANCH_FALSE))) {
+                fusable.at(target) = false;
+            }
+        }
+
+        for (u64 i{}; i < code.size(); i++) {
+            instruction& in = code.data()[i];
+            if (!in.live || in.op != opcode::BRANCH_FALSE) continue;
+            const u64 target = live_from(in.target);
+            if (target >= code.size() || !fusable.at(target)) continue;
+
+            in.op = opcode::POP_BRANCH_FALSE;
+            code.at(live_from(i + 1)).live = false;
+        }
+
+        // only now, the branches above still had to find them. the targets
+        // resolve to what follows.
+        for (u64 i{}; i < code.size(); i++) {
+            if (fusable.at(i)) take_pop(i);
+        }
+        for (u64 i{}; i < code.size(); i++) {
+            instruction& in = code.data()[i];
+            if (in.live && in.op == opcode::BRANCH && live_from(in.target) == live_from(i + 1))
+                in.live = false; // jumped over an else that was just a POP
+        }
+    }
+
+    // one less value for the POP or POPN at i to pop, it may go away.
+    void take_pop(u64 i) {
+        instruction& in = code.at(i);
+        if (in.op == opcode::POP) {
+            in.live = false;
+        } else if (in.operands.at(0) == 2) {
+            in.op = opcode::POP;
+            in.operands = dynarray<u32>(2);
+        } else {
+            in.operands.at(0)--;
+        }
+    }
+
+    // rewrites common sequences into the fused opcodes at the end of the
+    // opcode list. like rewrite(), nothing after the first instruction of
+    // a sequence may be a branch target.
+    void select_superinstructions() {
+        mark_targets();
+        dynarray<u64> live;
+        for (u64 i{}; i < code.size(); i++) {
+            if (code.at(i).live) live.push_back(i);
+        }
+        const auto at = [&](u64 k) -> instruction& { return code.at(live.at(k)); };
+        // the instructions k + 1 .. k + n exist and are straight line code.
+        const auto straight = [&](u64 k, u64 n) {
+            if (k + n >= live.size()) return false;
+            for (u64 j = k + 1; j <= k + n; j++) {
+                if (at(j).is_target) return false;
+            }
+            return true;
+        };
+        const auto fuse = [&](u64 k, opcode op, const dynarray<u32>& operands, u64 count) {
+            at(k).op = op;
+            at(k).operands = operands;
+            kill(live, k + 1, k + count);
+        };
+        // superinstructions have no wide forms, their operands have to fit.
+        const auto fit = [](opcode op, const dynarray<u32>& operands) {
+            for (u64 i{}; i < operands.size(); i++) {
+                if (!operand_fits(operands.at(i), operand_width(op))) return false;
+            }
+            return true;
+        };
+
+        for (u64 k{}; k < live.size(); k++) {
+            if (!at(k).live) continue;
+            const opcode op = at(k).op;
+
+            if (op == opcode::GET_LOCAL && straight(k, 4) &&
+                at(k + 1).op == opcode::LOAD_CONST && at(k + 2).op == opcode::ADD &&
+                at(k + 3).op == opcode::SET_LOCAL && is_pop(at(k + 4).op) &&
+                at(k + 3).operands.at(0) == at(k).operands.at(0) &&
+                fit(opcode::ADD_LOCAL_CONST, { at(k).operands.at(0), at(k + 1).operands.at(0) })) {
+                take_pop(live.at(k + 4));
+                fuse(k, opcode::ADD_LOCAL_CONST, { at(k).operands.at(0), at(k + 1).operands.at(0) }, 4);
+            } else if ((op == opcode::GET_LOCAL || op == opcode::GET_GLOBAL) && straight(k, 1) &&
+                       at(k + 1).op == opcode::CALL &&
+                       fit(op == opcode::GET_LOCAL ? opcode::CALL_LOCAL : opcode::CALL_GLOBAL,
+                           { at(k).operands.at(0), at(k + 1).operands.at(0), at(k + 1).operands.at(1) })) {
+                fuse(k, op == opcode::GET_LOCAL ? opcode::CALL_LOCAL : opcode::CALL_GLOBAL,
+                     { at(k).operands.at(0), at(k + 1).operands.at(0), at(k + 1).operands.at(1) }, 2);
+            } else if ((op == opcode::SET_LOCAL || op == opcode::SET_GLOBAL) && straight(k, 1) &&
+                       is_pop(at(k + 1).op) &&
+                       fit(op == opcode::SET_LOCAL ? opcode::SET_LOCAL_POP : opcode::SET_GLOBAL_POP,
+                           { at(k).operands.at(0) })) {
+                take_pop(live.at(k + 1));
+                at(k).op = op == opcode::SET_LOCAL ? opcode::SET_LOCAL_POP : opcode::SET_GLOBAL_POP;
+            } else if (compare_branch(op, false) != opcode::OPCODE_COUNT) {
+                const bool negated = straight(k, 1) && at(k + 1).op == opcode::NOT;
+                const u64 branch = negated ? k + 2 : k + 1;
+                if (straight(k, branch - k) && at(branch).op == opcode::POP_BRANCH_FALSE) {
+                    at(k).target = at(branch).target;
+                    fuse(k, compare_branch(op, negated), { 0 }, branch - k + 1);
+                }
+            } else if (op == opcode::GET_LOCAL && straight(k, 1) && at(k + 1).op == opcode::GET_LOCAL &&
+                       !(straight(k, 2) && at(k + 2).op == opcode::CALL) &&
+                       fit(opcode::GET_LOCALS, { at(k).operands.at(0), at(k + 1).operands.at(0) })) {
+                fuse(k, opcode::GET_LOCALS, { at(k).operands.at(0), at(k + 1).operands.at(0) }, 2);
+            } else if (op == opcode::GET_LOCAL && straight(k, 1) && at(k + 1).op == opcode::LOAD_CONST &&
+                       fit(opcode::GET_LOCAL_CONST, { at(k).operands.at(0), at(k + 1).operands.at(0) })) {
+                fuse(k, opcode::GET_LOCAL_CONST, { at(k).operands.at(0), at(k + 1).operands.at(0) }, 2);
+            }
+        }
+    }
+
+    // only keep the constants live code still loads, folding leaves the
+    // operands it replaced behind. indices only get smaller, so a fused
+    // instruction's constant still fits.
+    dynarray<value> compact_constants() {
+        dynarray<u32> remap(chk.constant_pool.size() + 1);
+        for (u64 i{}; i < chk.constant_pool.size(); i++) {
+            remap.push_back(UINT32_MAX);
+        }
+
+        dynarray<value> pool;
+        for (u64 i{}; i < code.size(); i++) {
+            instruction& in = code.data()[i];
+            const i64 operand = constant_operand(in.op);
+            if (!in.live || operand == -1)
+                continue;
+            u32& old_index = in.operands.at(operand);
+            u32& index = remap.at(old_index);
+            if (index == UINT32_MAX) {
+                index = pool.size();
+                pool.push_back(chk.constant_pool.at(old_index));
+            }
+            old_index = index;
+        }
+        return pool;
+    }
+
+    void encode() {
+        chunk out(chk.name);
+        out.constant_pool = compact_constants();
+        out.call_cache = chk.call_cache; // dead call sites just keep an empty slot
+
+        // branches start out short. the ones that don't reach make the code
+        // longer, which can push others out of reach, so the layout is
+        // redone until none change. LOOP is as wide as BRANCH either way.
+        dynarray<bool> wide(code.size());
+        for (u64 i{}; i < code.size(); i++) {
+            wide.push_back(false);
+        }
+        dynarray<u64> offset_of;
+        bool changed = true;
+        while (changed) {
+            offset_of = layout(wide);
+            changed = false;
+            for (u64 i{}; i < code.size(); i++) {
+                const instruction& in = code.at(i);
+                if (!in.live || !is_branch(in.op) || wide.at(i)) continue;
+                if (!operand_fits(distance(offset_of, i), operand_width(in.op))) {
+                    panic_if(long_form(in.op) == opcode::OPCODE_COUNT, "peephole: fused branch out of reach");
+                    wide.at(i) = true;
+                    changed = true;
+                }
+            }
+        }
+
+        for (u64 i{}; i < code.size(); i++) {
+            const instruction& in = code.at(i);
+            if (!in.live) continue;
+
+            if (is_branch(in.op)) {
+                const bool backwards = offset_of.at(live_from(in.target)) < offset_of.at(i + 1);
+                panic_if(backwards && in.op != opcode::BRANCH, "peephole: only BRANCH can go backwards");
+                const opcode op = backwards ? opcode::LOOP : in.op;
+                out.write_instruction(wide.at(i) ? long_form(op) : op, in.line, distance(offset_of, i));
+            } else if (in.operands.size() > 1) {
+                out.write_instruction(in.op, in.line, in.operands);
+            } else {
+                out.write_instruction(in.op, in.line, in.operands.size() > 0 ? in.operands.at(0) : 0);
+            }
+        }
+        chk = stealable(out);
+    }
+
+    // where each instruction starts, with the branches marked wide taking
+    // their wide form. the rest take whichever form their operands fit.
+    dynarray<u64> layout(const dynarray<bool>& wide) const {
+        dynarray<u64> offsets(code.size() + 1);
+        u64 offset = 0;
+        for (u64 i{}; i < code.size(); i++) {
+            offsets.push_back(offset);
+            const instruction& in = code.at(i);
+            if (!in.live) continue;
+            opcode op = wide.at(i) ? long_form(in.op) : in.op;
+            for (u64 j{}; j < in.operands.size() && !is_branch(in.op); j++) {
+                op = form_for(op, in.operands.at(j));
+            }
+            offset += 1 + operand_width(op) * in.operands.size();
+        }
+        offsets.push_back(offset);
+        return offsets;
+    }
+
+    // how far the branch at i goes, either way, from its end.
+    u64 distance(const dynarray<u64>& offsets, u64 i) const {
+        const u64 end = offsets.at(i + 1);
+        const u64 target = offsets.at(live_from(code.at(i).target));
+        return target >= end ? target - end : end - target;
+    }
+
+    chunk& chk;
+    dynarray<instruction> code;
+};
+
+} // namespace
+
+void peephole_optimize(chunk& chk) {
+    if (chk.bytecode.size() == 0) return;
+    peephole(chk).run();
+}
+
+} // namespace sting
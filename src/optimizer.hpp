@@ -0,0 +1,40 @@
+#ifndef OPTIMIZER_HPP
+#define OPTIMIZER_HPP
+
+#include "utilities.hpp"
+#include "chunk.hpp"
+
+namespace sting {
+
+/*
+ *  Peephole optimizer.
+ *
+ *  runs over a function's chunk once the parser is done with it. the chunk
+ *  is decoded into a list of instructions with branch targets as indices,
+ *  rewritten, and encoded again, so offsets and the line table come out
+ *  right. max_stack is measured after this, on the code that runs.
+ *
+ *  - jumps to unconditional jumps go straight to the final target, and so
+ *    do BRANCH_FALSE to BRANCH_FALSE (the condition is still on the stack).
+ *  - code no path reaches is dropped (the NIL RETURN after a return).
+ *  - runs of POP become one POPN.
+ *  - SAVE_VALUE, pops, LOAD_VALUE, RETURN is just RETURN, returning
+ *    truncates the stack to the frame base anyway.
+ *  - SET x, POP, GET x is SET x, for locals, upvalues and globals.
+ *  - TRUE, BRANCH_FALSE, POP goes away, it's what a folded always true
+ *    condition leaves.
+ *  - constants no live instruction loads are dropped from the pool.
+ *
+ *  last, the pairs the profiler sees most are fused into superinstructions:
+ *  BRANCH_FALSE and the POP on both of its paths, a compare (and NOT) with
+ *  the branch after it, two GET_LOCALs, GET_LOCAL and a constant, x = x + k,
+ *  SET and POP, and a load of the callee with its CALL.
+ *
+ *  nothing is rewritten across a branch target. the parser emits forward
+ *  branches wide, encoding gives every branch the short form if it reaches.
+ */
+void peephole_optimize(chunk& chk);
+
+} // namespace sting
+
+#endif
@@ -4,12 +4,14 @@
 
 namespace sting {
 
-parser::parser() : parser("unknown_chunk") {}
-
-parser::parser(const std::string& name) :
+parser::parser(const std::string& name, const scanner& scan) :
     index{},
+    scan(scan),
+    rescan(scan),
+    ring{},
     panic{},
-    parse_error{}
+    parse_error{},
+    operand_start{}
 {
     prev = 0;
     current = 0;
@@ -22,7 +24,8 @@ bool parser::match(token_type type) {
 
 bool parser::parse() {
     define_native_functions();
-    current = &tokens.at(0);
+    current = &ring[0];
+    *current = scan_token();
 
     while (current->type != token_type::END_OF_FILE) {
         declaration();
@@ -32,20 +35,30 @@ bool parser::parse() {
     if (panic) return !parse_error;
 
     get_current_function().write_instruction(opcode::RETURN, current->line);
+    if (c.optimize) peephole_optimize(get_current_function().get_chunk());
+    c.measure_stack(get_current_function(), true);
+    if (c.registers && !translate_to_registers(get_current_function().get_chunk(), 0)) {
+        error_at_token(*current, "Too many locals for the register vm");
+        return false;
+    }
     return true;
 }
 
-void parser::define_native_function(const string& name, const native_function& fn) {
-    const value vname(&name, vtype::STRING);
-    const u64 name_index = get_script().load_constant(vname);
-    const value vfn(static_cast<object const*>(&fn), vtype::NATIVE_FUNCTION);
-    const u64 fn_index = get_script().load_constant(vfn);
-    get_script().write_instruction(opcode::LOAD_CONST, 0, fn_index);
-    get_script().write_instruction(opcode::DEFINE_GLOBAL, 0, name_index);
-}
-
+// the natives take the first global slots, in native_functions() order,
+// and the vm puts them there before it runs anything (vmachine::vmachine).
+// no bytecode sets them up, however many there are.
 void parser::define_native_functions() {
-    define_native_function("clock", native_function("clock", 0, clock));
+    const dynarray<native_function>& natives = native_functions();
+    for (u64 i{}; i < natives.size(); i++) {
+        const string& name = natives.at(i).get_name();
+        const token tname = {
+            .type = token_type::IDENTIFIER,
+            .start = name.data(),
+            .length = name.size(),
+            .line = 0,
+        };
+        c.define_global(c.resolve_global(tname));
+    }
 }
 
 void parser::error_at_token(const token& t, const std::string& msg) {
@@ -68,10 +81,23 @@ void parser::check_current_token(const token_type expected, const std::string& m
 
 void parser::get_next_token() {
     prev = current;
+    if (current->type == token_type::END_OF_FILE) return; // stays there
     index++;
-    if (index < tokens.size())
-        current = &tokens.at(index);
-    // TODO: deal with error tokens.
+    current = &ring[index % TOKEN_RING];
+    *current = scan_token();
+}
+
+// a token the scanner can't make is a compile error. the file ends there,
+// so the parser winds down without reporting anything else.
+token parser::scan_token() {
+    token t = scan.next_token();
+    if (t.type == token_type::ERROR) {
+        panic = true;
+        parse_error = true;
+        t.type = token_type::END_OF_FILE;
+        t.length = 0;
+    }
+    return t;
 }
 
 void parser::consume(token_type type, const char* msg) {
@@ -80,12 +106,16 @@ void parser::consume(token_type type, const char* msg) {
 }
 
 void parser::parse_precedence(precedence p) {
+    const u64 start = get_current_function().get_chunk().bytecode.size();
     get_next_token();
     parse_fn prefix_rule = get_rule(prev->type)->prefix;
 
     if (prefix_rule == nullptr) {
-        string tok(prev->start, prev->length);
-        std::cout << "Error at " << tok << "\n" << std::flush;
+        // like error_at_token, only for the first error.
+        if (!panic) {
+            string tok(prev->start, prev->length);
+            std::cout << "Error at " << tok << "\n" << std::flush;
+        }
         error_at_token(*prev, "Expected expression");
         return;
     }
@@ -98,6 +128,7 @@ void parser::parse_precedence(precedence p) {
     while (pi <= ci) {
         get_next_token();
         parse_fn infix_rule = get_rule(prev->type)->infix;
+        operand_start = start;
         (this->*infix_rule)(assignable);
         ci = static_cast<int>(get_rule(current->type)->prec);
     }
@@ -135,11 +166,15 @@ void parser::fun_declaration() {
     get_next_token();
     consume(token_type::IDENTIFIER, "Expected function name");
 
-    const u64 name_index = parse_variable_name();
+    u32 slot = 0;
+    if (c.scope_depth == 0) {
+        slot = parse_global_variable_name();
+        // defined before the body, so recursive calls don't need a check.
+        c.define_global(slot);
+    }
     declare_local_variable();
 
-    const string& fname =
-        *static_cast<string*>(get_current_function().get_chunk().constant_pool.at(name_index).obj());
+    const string fname(prev->start, prev->length);
     c.new_function(function(fname, 0));
 
     const u64 fn_line = prev->line;
@@ -164,13 +199,9 @@ void parser::fun_declaration() {
 
     consume(token_type::RIGHT_BRACE, "Expected '}' after function definition");
 
-    const dynarray<instruction>& bc = c.functions.back().get_chunk().bytecode;
-    // TODO: fun f() { if (x < 5) { return } };
-    // maybe always append this?
-    if (bc.size() == 0 || bc.back().op != opcode::RETURN) {
-        c.functions.back().write_instruction(opcode::NIL, fn_line);
-        c.functions.back().write_instruction(opcode::RETURN, fn_line);
-    }
+    // falling off the end returns nil, unreachable after an explicit return.
+    c.functions.back().write_instruction(opcode::NIL, fn_line);
+    c.functions.back().write_instruction(opcode::RETURN, fn_line);
 
     // TODO: needs to be its own helper function, anytime scope_depth--;
     while (c.locals().size() > 0 && c.locals().back().depth == c.scope_depth) {
@@ -180,6 +211,7 @@ void parser::fun_declaration() {
     c.scope_depth--;
     // at end, store function in previous functions constant pool
     const function& f = c.finish_function();
+    if (c.out_of_registers) error_at_token(*prev, "Too many locals for the register vm");
     const value fv(static_cast<object const*>(&f), vtype::FUNCTION);
 
     u64 findex = get_current_function().load_constant(fv);
@@ -193,7 +225,7 @@ void parser::fun_declaration() {
     }
     get_current_function().write_instruction(opcode::MAKE_CLOSURE, fn_line, operands);
     if (c.scope_depth == 0) {
-        get_current_function().write_instruction(opcode::DEFINE_GLOBAL, prev->line, name_index);
+        get_current_function().write_instruction(opcode::DEFINE_GLOBAL, prev->line, slot);
     } else {
         c.locals().back().depth = c.scope_depth;
     }
@@ -221,32 +253,33 @@ void parser::declare_local_variable() {
     c.locals().push_back(l); // local == token + scope
 }
 
-// parse identifier into sting::string
-// put in current functions constant pool
-u64 parser::parse_variable_name() {
-    string name(prev->start, prev->length);
-    value v(&name, vtype::STRING);
-    return get_current_function().load_constant(v);
+// slot of the global named by the previous token
+u32 parser::parse_global_variable_name() {
+    return c.resolve_global(*prev);
 }
 
-u64 parser::parse_global_variable_name() {
-    string name(prev->start, prev->length);
-    value v(&name, vtype::STRING);
-    return c.functions.at(0).load_constant(v);
+// GET_GLOBAL / SET_GLOBAL, or their checked version for a global that
+// isn't known to be defined yet.
+void parser::emit_global(opcode op, u32 slot, u64 line) {
+    if (!c.global_defined.at(slot)) {
+        op = op == opcode::GET_GLOBAL ? opcode::GET_GLOBAL_CHECKED : opcode::SET_GLOBAL_CHECKED;
+    }
+    get_current_function().write_instruction(op, line, slot);
 }
 
 void parser::var_declaration() {
     get_next_token();
     consume(token_type::IDENTIFIER, "Expected variable name");
 
-    u64 index;
+    u32 slot = 0;
+    const token name = *prev;
+    const u64 name_at = index - 1;
     declare_local_variable();
-    if (c.scope_depth > 0) {
-        index = 0;
-    } else {
-        index = parse_variable_name();
+    if (c.scope_depth == 0) {
+        slot = parse_global_variable_name();
     }
 
+    const u64 init_start = get_current_function().get_chunk().bytecode.size();
     if (current->type == token_type::EQUAL) {
         get_next_token();
         expression();
@@ -256,11 +289,18 @@ void parser::var_declaration() {
     }
 
     // fix the scope of the variable we just added, for both NIL and EQUAL
-    if (c.scope_depth > 0)
-        c.locals().back().depth = c.scope_depth;
+    if (c.scope_depth > 0) {
+        local& l = c.locals().back();
+        l.depth = c.scope_depth;
+        const u64 init_end = get_current_function().get_chunk().bytecode.size();
+        l.constant = c.optimize && constant_in(init_start, init_end, l.init) &&
+                     !assigned_later(name, name_at);
+    }
 
     if (c.scope_depth == 0) {
-        get_current_function().write_instruction(opcode::DEFINE_GLOBAL, prev->line, index);
+        // after the initializer, it can't see the variable it defines.
+        c.define_global(slot);
+        get_current_function().write_instruction(opcode::DEFINE_GLOBAL, prev->line, slot);
     }
     consume(token_type::SEMICOLON, "Expected ';' after variable declaration");
 }
@@ -275,7 +315,7 @@ void parser::named_variable(const token& tok_name, bool assignable) {
         token fname = *prev;
         u64 fnline = current->line;
         i64 local = c.resolve_local(fname, c.locals());
-        u64 global = 0;
+        u32 global = 0;
         i64 upvalue = 0;
 
         if (local == -1) {
@@ -307,10 +347,11 @@ void parser::named_variable(const token& tok_name, bool assignable) {
         } else if (upvalue != -1) {
             get_current_function().write_instruction(opcode::GET_UPVALUE, fnline, upvalue);
         } else {
-            get_current_function().write_instruction(opcode::GET_GLOBAL, fnline, global);
+            emit_global(opcode::GET_GLOBAL, global, fnline);
         }
 
-        get_current_function().write_instruction(opcode::CALL, fnline, num_args);
+        const u32 site = get_current_function().get_chunk().add_call_site();
+        get_current_function().write_instruction(opcode::CALL, fnline, { static_cast<u32>(num_args), site });
     } else if (current->type == token_type::EQUAL) {
         panic_if(!assignable, "Cannot assign to this expression");
 
@@ -325,12 +366,18 @@ void parser::named_variable(const token& tok_name, bool assignable) {
             expression();
             get_current_function().write_instruction(opcode::SET_UPVALUE, prev->line, upvalue);
         } else {
-            u64 global = parse_global_variable_name();
+            u32 global = parse_global_variable_name();
             get_next_token();
             expression();
-            get_current_function().write_instruction(opcode::SET_GLOBAL, prev->line, global);
+            emit_global(opcode::SET_GLOBAL, global, prev->line);
         }
     } else {
+        value constant;
+        if (c.optimize && c.resolve_constant(*prev, constant)) {
+            emit_constant(constant, prev->line);
+            return;
+        }
+
         i64 local = c.resolve_local(*prev, c.locals());
         i64 upvalue = 0;
         if (local != -1) {
@@ -338,8 +385,8 @@ void parser::named_variable(const token& tok_name, bool assignable) {
         } else if ((upvalue = c.resolve_upvalue(*prev)) != -1) {
             get_current_function().write_instruction(opcode::GET_UPVALUE, prev->line, upvalue);
         }else {
-            u64 global = parse_global_variable_name();
-            get_current_function().write_instruction(opcode::GET_GLOBAL, prev->line, global);
+            u32 global = parse_global_variable_name();
+            emit_global(opcode::GET_GLOBAL, global, prev->line);
         }
     }
 }
@@ -355,7 +402,15 @@ void parser::return_statement() {
     }
     consume(token_type::SEMICOLON, "Expected ';' after return expression");
     get_current_function().write_instruction(opcode::SAVE_VALUE, prev->line);
-    fix_block_stack();
+    // unwind every local of the function, but leave them declared for the
+    // code that follows the return (e.g. return inside an if).
+    for (u64 i = c.locals().size(); i > 0; i--) {
+        if (c.locals().at(i - 1).captured) {
+            get_current_function().write_instruction(opcode::CLOSE_VALUE, prev->line);
+        } else {
+            get_current_function().write_instruction(opcode::POP, prev->line);
+        }
+    }
     get_current_function().write_instruction(opcode::LOAD_VALUE, prev->line);
     get_current_function().write_instruction(opcode::RETURN, prev->line);
 }
@@ -384,22 +439,43 @@ void parser::statement() {
     }
 }
 
+// returns the offset just past the branch, which is where its
+// increment is measured from. how far it goes isn't known yet, so it's
+// the wide form, the peephole pass shrinks the ones that fit.
 u64 parser::emit_jump(opcode branch_type) {
-    get_current_function().write_instruction(branch_type, prev->line, 0);
+    get_current_function().write_instruction(long_form(branch_type), prev->line, 0);
     return get_current_function().get_chunk().bytecode.size();
 }
 
 void parser::backpatch(u64 branch) {
-    u64 current_size = get_current_function().get_chunk().bytecode.size();
-    // get_current_function().get_chunk().bytecode.at(branch - 1).operands.push_back(current_size - branch);
-    get_current_function().get_chunk().bytecode.at(branch - 1).operands.at(0) = current_size - branch;
-    // get_current_function().get_chunk().bytecode.at(branch - 1).a = current_size - branch;
+    chunk& chk = get_current_function().get_chunk();
+    const u64 width = operand_width(opcode::BRANCH_LONG);
+    chk.patch_operand(branch - width, chk.bytecode.size() - branch, width);
+    chk.last_label = chk.bytecode.size();
+}
+
+// the current offset, as the target of a branch emitted later.
+u64 parser::label() {
+    chunk& chk = get_current_function().get_chunk();
+    chk.last_label = chk.bytecode.size();
+    return chk.last_label;
+}
+
+// jump backwards to start, measured from the end of the LOOP instruction.
+// write_instruction widens it if the distance doesn't fit, which makes it
+// longer by the difference.
+void parser::emit_loop(u64 start) {
+    const u64 size = get_current_function().get_chunk().bytecode.size();
+    u64 end = size + 1 + operand_width(opcode::LOOP);
+    if (!operand_fits(end - start, operand_width(opcode::LOOP)))
+        end = size + 1 + operand_width(opcode::LOOP_LONG);
+    get_current_function().write_instruction(opcode::LOOP, prev->line, end - start);
 }
 
 void parser::while_statement() {
     get_next_token();
     consume(token_type::LEFT_PAREN, "Expected '(' after while");
-    u64 start = get_current_function().get_chunk().bytecode.size();
+    u64 start = label();
     expression();
     consume(token_type::RIGHT_PAREN, "Expected ')' after expression");
 
@@ -407,8 +483,7 @@ void parser::while_statement() {
     get_current_function().write_instruction(opcode::POP, prev->line);
 
     statement();
-    u64 end = get_current_function().get_chunk().bytecode.size();
-    get_current_function().write_instruction(opcode::LOOP, prev->line, end - start + 1);
+    emit_loop(start);
     backpatch(jump_if_false);
     get_current_function().write_instruction(opcode::POP, prev->line);
 }
@@ -422,7 +497,7 @@ void parser::for_statement() {
     // must have a var declaration.
     var_declaration(); // var i = 0; a
 
-    u64 start = get_current_function().get_chunk().bytecode.size(); // check
+    u64 start = label();
     expression(); // i < size; b
     consume(token_type::SEMICOLON, "Expected ';' after expression");
 
@@ -430,17 +505,17 @@ void parser::for_statement() {
     get_current_function().write_instruction(opcode::POP, prev->line);
 
     u64 to_statement = emit_jump(opcode::BRANCH);
-    u64 to_inc = get_current_function().get_chunk().bytecode.size();
+    u64 to_inc = label();
     expression(); // i++, expression_statement expects a ;
     get_current_function().write_instruction(opcode::POP, prev->line);
     consume(token_type::RIGHT_PAREN, "Expected ')' after for loop statement");
 
-    get_current_function().write_instruction(opcode::LOOP, prev->line, get_current_function().get_chunk().bytecode.size() - start + 1);
+    emit_loop(start);
 
     backpatch(to_statement);
     statement();
 
-    get_current_function().write_instruction(opcode::LOOP, prev->line, get_current_function().get_chunk().bytecode.size() - to_inc + 1);
+    emit_loop(to_inc);
 
     // end_for_loop
     backpatch(end_for_loop);
@@ -459,25 +534,26 @@ void parser::if_statement() {
     expression();
     consume(token_type::RIGHT_PAREN, "Expected ')' after expression");
 
+    // condition is popped on both paths, so it never sits under locals
+    // declared in the branches.
     u64 if_statement = emit_jump(opcode::BRANCH_FALSE);
+    get_current_function().write_instruction(opcode::POP, prev->line);
     statement();
 
+    u64 else_statement = emit_jump(opcode::BRANCH);
+    backpatch(if_statement);
+    get_current_function().write_instruction(opcode::POP, prev->line);
     if (current->type == token_type::ELSE) {
         get_next_token();
-        u64 else_statement = emit_jump(opcode::BRANCH);
-        backpatch(if_statement);
         statement();
-        backpatch(else_statement);
-    } else {
-        backpatch(if_statement);
     }
-    get_current_function().write_instruction(opcode::POP, prev->line);
+    backpatch(else_statement);
 }
 
 void parser::fix_block_stack() {
     while (c.locals().size() > 0 && c.locals().back().depth == c.scope_depth) {
         if (c.locals().pop_back().captured) {
-            get_current_function().write_instruction(opcode::CLOSE_VALUE, prev->line, c.locals().size());
+            get_current_function().write_instruction(opcode::CLOSE_VALUE, prev->line);
         } else {
             get_current_function().write_instruction(opcode::POP, prev->line);
         }
@@ -494,7 +570,7 @@ void parser::block() {
 void parser::expression_statement() {
     expression();
     consume(token_type::SEMICOLON, "Expected ;");
-    //get_current_function().write_instruction(opcode::POP, prev->line);
+    get_current_function().write_instruction(opcode::POP, prev->line);
 }
 
 // should be able to escape quickly if token is just a semicolon.
@@ -530,9 +606,8 @@ void parser::literal(bool assignable) {
 }
 
 void parser::str(bool assignable) {
-    object* str = new string(prev->start, prev->length);
-    object_list.push_back(str);
-    value val = value(str, vtype::STRING);
+    const string str(prev->start, prev->length);
+    const value val(&str, vtype::STRING);
     u32 index = get_current_function().load_constant(val);
     get_current_function().write_instruction(opcode::LOAD_CONST, prev->line, index);
 }
@@ -545,8 +620,18 @@ void parser::grouping(bool assignable) {
 
 void parser::unary(bool assignable) {
     token_type op_type = prev->type;
+    const u64 start = get_current_function().get_chunk().bytecode.size();
     parse_precedence(precedence::UNARY);
 
+    value a, result;
+    if (foldable(start) &&
+        constant_in(start, get_current_function().get_chunk().bytecode.size(), a) &&
+        fold_unary(op_type, a, result)) {
+        get_current_function().get_chunk().truncate(start);
+        emit_constant(result, prev->line);
+        return;
+    }
+
     switch(op_type) {
         case token_type::MINUS: {
             get_current_function().write_instruction(opcode::NEGATE, prev->line);
@@ -565,10 +650,21 @@ void parser::unary(bool assignable) {
 void parser::binary(bool assignable) {
     token_type type = prev->type;
     parse_rule* rule = get_rule(type);
+    const u64 left = operand_start;
+    const u64 right = get_current_function().get_chunk().bytecode.size();
 
     // + 1 => left associativity. If +, only */ and above can be parsed, not +
     parse_precedence(static_cast<precedence>(rule->prec + 1));
 
+    value a, b, result;
+    if (foldable(left) && constant_in(left, right, a) &&
+        constant_in(right, get_current_function().get_chunk().bytecode.size(), b) &&
+        fold_binary(type, a, b, result)) {
+        get_current_function().get_chunk().truncate(left);
+        emit_constant(result, prev->line);
+        return;
+    }
+
     switch (type) {
         case token_type::PLUS: {
             get_current_function().write_instruction(opcode::ADD, prev->line);
@@ -618,6 +714,204 @@ void parser::binary(bool assignable) {
     }
 }
 
+// constant folding. the operands are folded with value's own operators, in
+// the order the vm applies them, so the result is what running it would
+// give. type errors the vm would panic on are compile errors instead.
+
+void parser::emit_constant(const value& v, u64 line) {
+    switch (v.type()) {
+        case vtype::BOOLEAN: {
+            get_current_function().write_instruction(v.byte() ? opcode::TRUE : opcode::FALSE, line);
+            break;
+        }
+        case vtype::NIL: {
+            get_current_function().write_instruction(opcode::NIL, line);
+            break;
+        }
+        default: {
+            const u32 index = get_current_function().load_constant(v);
+            get_current_function().write_instruction(opcode::LOAD_CONST, line, index);
+        }
+    }
+}
+
+// true if the code in [start, end) is a single constant load, v is the constant.
+bool parser::constant_in(u64 start, u64 end, value& v) {
+    const chunk& chk = get_current_function().get_chunk();
+    if (start >= end) return false;
+    const u8* code = chk.bytecode.data() + start;
+    if (start + instruction_size(code) != end) return false;
+
+    const opcode op = static_cast<opcode>(*code);
+    switch (short_form(op)) {
+        case opcode::LOAD_CONST: {
+            v = chk.constant_pool.at(read_operand(code + 1, operand_width(op)));
+            return v.type() == vtype::NUMBER || v.type() == vtype::STRING;
+        }
+        case opcode::TRUE: {
+            v = value(static_cast<u8>(true));
+            return true;
+        }
+        case opcode::FALSE: {
+            v = value(static_cast<u8>(false));
+            return true;
+        }
+        case opcode::NIL: {
+            v = value();
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+// code from start on can be replaced, no branch lands inside it.
+bool parser::foldable(u64 start) {
+    return c.optimize && get_current_function().get_chunk().last_label <= start;
+}
+
+bool parser::fold_binary(token_type type, const value& a, const value& b, value& result) {
+    // nil mixed with anything else is left for the vm.
+    if ((a.type() == vtype::NIL) != (b.type() == vtype::NIL)) return false;
+    if (a.type() != b.type()) {
+        error_at_token(*prev, "Type error: operands have different types");
+        return false;
+    }
+
+    const vtype t = a.type();
+    switch (type) {
+        case token_type::PLUS: {
+            if (t != vtype::NUMBER && t != vtype::STRING) break;
+            result = b + a; // same as ADD
+            return true;
+        }
+        case token_type::MINUS: {
+            if (t != vtype::NUMBER) break;
+            result = a - b;
+            return true;
+        }
+        case token_type::STAR: {
+            if (t != vtype::NUMBER) break;
+            result = a * b;
+            return true;
+        }
+        case token_type::SLASH: {
+            if (t != vtype::NUMBER) break;
+            result = a / b;
+            return true;
+        }
+        case token_type::EQUAL_EQUAL:
+        case token_type::BANG_EQUAL: {
+            result = a == b;
+            if (type == token_type::BANG_EQUAL) result = !result;
+            return true;
+        }
+        case token_type::GREATER:
+        case token_type::LESS_EQUAL: {
+            if (t == vtype::STRING) return false; // not an error, but nothing to fold either
+            if (t == vtype::NIL) break;
+            result = a > b;
+            if (type == token_type::LESS_EQUAL) result = !result;
+            return true;
+        }
+        case token_type::LESS:
+        case token_type::GREATER_EQUAL: {
+            if (t == vtype::STRING) return false;
+            if (t == vtype::NIL) break;
+            result = a < b;
+            if (type == token_type::GREATER_EQUAL) result = !result;
+            return true;
+        }
+        default:
+            return false;
+    }
+
+    error_at_token(*prev, "Type error: operator not defined for this type");
+    return false;
+}
+
+bool parser::fold_unary(token_type type, const value& a, value& result) {
+    switch (type) {
+        case token_type::MINUS: {
+            if (a.type() != vtype::NUMBER) {
+                error_at_token(*prev, "Type error: cannot negate non-number type");
+                return false;
+            }
+            result = -a;
+            return true;
+        }
+        case token_type::BANG: {
+            if (a.type() != vtype::BOOLEAN) {
+                error_at_token(*prev, "Type error: cannot logical-not non-boolean type");
+                return false;
+            }
+            result = !a;
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+// constant propagation: a local that is never assigned reads as its
+// initializer. any "name =" before the end of the local's scope counts,
+// even one that assigns a different variable of the same name. at is the
+// token index of the local's name.
+bool parser::assigned_later(const token& name, u64 at) {
+    if (!assignments.built) index_assignments();
+    const string key(name.start, name.length);
+    if (!assignments.assigned.contains(key)) return false;
+
+    // the innermost block around at, its } ends the scope.
+    const dynarray<block_span>& blocks = assignments.blocks;
+    u64 lo = 0, hi = blocks.size();
+    while (lo < hi) {
+        const u64 mid = lo + (hi - lo) / 2;
+        if (blocks.at(mid).open < at) lo = mid + 1;
+        else hi = mid;
+    }
+    u64 b = lo == 0 ? UINT64_MAX : lo - 1;
+    while (b != UINT64_MAX && blocks.at(b).close < at) b = blocks.at(b).enclosing;
+    const u64 end = b == UINT64_MAX ? UINT64_MAX : blocks.at(b).close;
+
+    // the first assignment after at.
+    const dynarray<u64>& places = assignments.assigned.at(key);
+    lo = 0, hi = places.size();
+    while (lo < hi) {
+        const u64 mid = lo + (hi - lo) / 2;
+        if (places.at(mid) <= at) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < places.size() && places.at(lo) < end;
+}
+
+// scans the source once more, the same tokens at the same indices as
+// parse sees. a block that never closes ends with the file.
+void parser::index_assignments() {
+    assignments.built = true;
+    dynarray<u64> open; // blocks not closed yet
+    token before{ .type = token_type::END_OF_FILE };
+    token t = rescan.next_token();
+    for (u64 i{};; i++) {
+        if (t.type == token_type::ERROR || t.type == token_type::END_OF_FILE) break;
+        const token next = rescan.next_token();
+        if (t.type == token_type::LEFT_BRACE) {
+            const u64 enclosing = open.size() > 0 ? open.back() : UINT64_MAX;
+            open.push_back(assignments.blocks.size());
+            assignments.blocks.push_back(block_span{ .open = i, .close = UINT64_MAX, .enclosing = enclosing });
+        } else if (t.type == token_type::RIGHT_BRACE && open.size() > 0) {
+            assignments.blocks.at(open.pop_back()).close = i;
+        } else if (t.type == token_type::IDENTIFIER && next.type == token_type::EQUAL &&
+                   before.type != token_type::VAR) {
+            const string key(t.start, t.length);
+            if (!assignments.assigned.contains(key)) assignments.assigned.insert(key, dynarray<u64>());
+            assignments.assigned.at(key).push_back(i);
+        }
+        before = t;
+        t = next;
+    }
+}
+
 void parser::binary_and(bool assignable) {
     u64 _and = emit_jump(opcode::BRANCH_FALSE);
     get_current_function().write_instruction(opcode::POP, prev->line);
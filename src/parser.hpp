@@ -9,6 +9,9 @@
 #include "hashmap.hpp"
 #include "function.hpp"
 #include "native_function.hpp"
+#include "optimizer.hpp"
+#include "registers.hpp"
+#include "stack_depth.hpp"
 
 /*
  *  Parsing + codegen
@@ -34,6 +37,10 @@ struct local {
     token name;
     i64 depth; // can have locals with same name, but different depths.
     bool captured = false;
+    // initialized with a constant and never assigned, reads are replaced
+    // with the constant.
+    bool constant = false;
+    value init{};
 
     bool operator==(const local& other) const {
         return name == other.name && depth == other.depth;
@@ -56,10 +63,54 @@ struct compiler {
     dynarray<dynarray<upvalue>> _upvalues;
     i64 scope_depth;
 
-    compiler() : functions(), scope_depth(0), _locals(), _upvalues() {
+    // globals get a slot each at compile time, the vm keeps them in a flat
+    // array. keyed by the interned name.
+    hashmap<string*, u32> global_slots;
+    dynarray<value> global_names; // by slot
+    dynarray<bool> global_defined; // DEFINE_GLOBAL already emitted for the slot
+    bool debug;
+    bool optimize; // run the peephole pass on every finished chunk
+    bool registers; // and translate it for the register vm
+    bool out_of_registers; // a chunk needed more than MAX_REGISTERS
+
+    compiler() :
+        functions(),
+        _locals(),
+        _upvalues(),
+        scope_depth(0),
+        global_slots(),
+        global_names(),
+        global_defined(),
+        debug(false),
+        optimize(true),
+        registers(false),
+        out_of_registers(false)
+    {
         new_function(function("script", 0));
     }
 
+    u32 resolve_global(const token& t) {
+        const string name(t.start, t.length);
+        const value vname(&name, vtype::STRING);
+        string* key = static_cast<string*>(vname.obj());
+        if (global_slots.contains(key))
+            return global_slots.at(key);
+
+        const u32 slot = global_names.size();
+        global_slots.insert(key, slot);
+        global_names.push_back(vname);
+        global_defined.push_back(false);
+        return slot;
+    }
+
+    // globals are only defined by top level declarations, which run once and
+    // in order. anything compiled after the definition, including function
+    // bodies (they can't run before their closure exists), sees it defined.
+    void define_global(u32 slot) {
+        panic_if(global_defined.at(slot), "Already defined global");
+        global_defined.at(slot) = true;
+    }
+
     i64 resolve_local(const token& t, const dynarray<local>& locals) {
         if (scope_depth == 0) return -1;
         for (i64 i{static_cast<i64>(locals.size()) - 1l}; i >= 0; i--) {
@@ -72,18 +123,33 @@ struct compiler {
         return -1;
     }
 
+    // the constant t reads, when it resolves to a constant local of this
+    // function or an enclosing one. resolves in the same order as
+    // resolve_local and resolve_upvalue.
+    bool resolve_constant(const token& t, value& v) {
+        for (u64 level = _locals.size(); level > 0; level--) {
+            const i64 l = resolve_local(t, _locals.at(level - 1));
+            if (l == -1) continue;
+            const local& found = _locals.at(level - 1).at(l);
+            if (!found.constant) return false;
+            v = found.init;
+            return true;
+        }
+        return false;
+    }
+
     // return its location in the upvalues array
     // index and local are just used as identifiers
     i64 add_upvalue(dynarray<upvalue>& upvalues, u64 index, bool local) {
         const upvalue uv = upvalue(index, local);
         for (u64 i = 0; i < upvalues.size(); i++) {
             if (upvalues.at(i) == uv) {
-                std::cout << "Old upvalue: " << index << ", " << local << "\n";
+                if (debug) std::cout << "Old upvalue: " << index << ", " << local << "\n";
                 return i;
             }
         }
 
-        std::cout << "New upvalue: " << index << ", " << local << "\n";
+        if (debug) std::cout << "New upvalue: " << index << ", " << local << "\n";
         upvalues.push_back(uv);
         return upvalues.size() - 1;
     }
@@ -119,32 +185,77 @@ struct compiler {
     function finish_function() {
         // sanity checks to make sure stack is cleaned up properly.
         panic_if(_locals.pop_back().size() > 0, "Stack is not zero, missed local pop somewhere");
+        if (optimize) peephole_optimize(functions.back().get_chunk());
+        measure_stack(functions.back(), false);
+        if (registers && !translate_to_registers(functions.back().get_chunk(), functions.back().get_arity()))
+            out_of_registers = true;
         // panic_if(_upvalues.pop_back().size() > 0, "Stack is not zero, missed upvalue pop somewhere");
         //_upvalues.pop_back();
         return functions.pop_back();
     }
 
     void pop_upvalues() { _upvalues.pop_back(); }
+
+    // chunk::max_stack, from the finished code. code with a compile error
+    // in it can have paths that disagree, it never runs anyway.
+    void measure_stack(function& f, bool script) {
+        dynarray<i64> depths;
+        find_stack_depths(f.get_chunk(), f.get_arity(), script, depths, f.get_chunk().max_stack);
+    }
+};
+
+// tokens the parser keeps, prev and current and a couple before them. it
+// pulls them from the scanner one at a time as it goes, and never looks
+// past current. the one thing that depends on later code, whether a local
+// is assigned before its scope ends, comes from assignment_index.
+const u64 TOKEN_RING = 4;
+
+// a { and the } that closes it, as token indices. enclosing is the block
+// around it, UINT64_MAX at the top level.
+struct block_span {
+    u64 open;
+    u64 close;
+    u64 enclosing;
+};
+
+// where every name is assigned and where every block ends, from one scan of
+// the whole source, for constant propagation. positions are token indices,
+// the ones parser::index counts. only built once a local could be a
+// constant, so code without any doesn't scan twice.
+struct assignment_index {
+    bool built = false;
+    // "name =" that isn't a declaration, in order.
+    hashmap<string, dynarray<u64>> assigned;
+    // in order of their {.
+    dynarray<block_span> blocks;
 };
 
 // rename parser -> compiler. merge parser + compiler.
 class parser {
 public:
-    parser();
-    parser(const std::string& name);
+    parser(const std::string& name, const scanner& scan);
     bool parse();
-    void define_native_function(const string& name, const native_function& fn);
     void define_native_functions();
-    dynarray<token>& get_tokens() { return tokens; }
     function& get_script() { return c.functions.at(0); }
+    const dynarray<value>& get_global_names() { return c.global_names; }
     void error_at_token(const token& t, const std::string& msg);
     void check_current_token(const token_type expected, const std::string& mesg);
     void get_next_token();
+    token scan_token();
     void consume(token_type type, const char* msg);
     void parse_precedence(precedence p);
     bool match(token_type type);
     u64 emit_jump(opcode branch_type);
     void backpatch(u64 branch);
+    u64 label();
+    void emit_loop(u64 start);
+    void emit_constant(const value& v, u64 line);
+    bool constant_in(u64 start, u64 end, value& v);
+    bool foldable(u64 start);
+    bool fold_binary(token_type type, const value& a, const value& b, value& result);
+    bool fold_unary(token_type type, const value& a, value& result);
+    void index_assignments();
+    bool assigned_later(const token& name, u64 at);
     function& get_current_function() { return c.functions.back(); }
 
     // parse functions that generate code
@@ -155,8 +266,8 @@ public:
     void declare_function_param();
     void declare_local_variable();
     void variable(bool assignable);
-    u64 parse_variable_name();
-    u64 parse_global_variable_name();
+    u32 parse_global_variable_name();
+    void emit_global(opcode op, u32 slot, u64 line);
     void named_variable(const token& name, bool assignable);
     void block();
     void return_statement();
@@ -179,10 +290,15 @@ public:
     // token related
     token *prev;
     token *current;
-    u64 index;
-    dynarray<token> tokens;
+    u64 index; // of current, in the whole token stream
+    scanner scan; // only scan_token calls it
+    scanner rescan; // from the start, for index_assignments
+    assignment_index assignments;
+    token ring[TOKEN_RING];
     bool parse_error;
     bool panic;
+    // where the left operand of the infix rule being parsed starts.
+    u64 operand_start;
 
     compiler c;
 };
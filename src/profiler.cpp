@@ -0,0 +1,192 @@
+#include "profiler.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+namespace sting {
+
+profiler prof;
+
+profiler::profiler() :
+    ops(), pairs(), previous(OPCODE_COUNT), chunks(), ticks(0), timing(OPCODE_COUNT), timing_start(0) {}
+
+profiler::~profiler() {
+    for (u64 i{}; i < chunks.size(); i++) {
+        delete chunks.data()[i];
+    }
+}
+
+// no tsc, nanoseconds will have to do.
+u64 profiler::read_cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+void profiler::end_sample() {
+    const u64 cycles = read_cycles() - timing_start;
+    opcode_profile& p = ops[timing];
+    p.samples++;
+    p.sampled_cycles += cycles;
+
+    u64 bucket = 0;
+    while ((cycles >> bucket) > 1 && bucket < PROFILE_HISTOGRAM_BUCKETS - 1)
+        bucket++;
+    p.histogram[bucket]++;
+    timing = OPCODE_COUNT;
+}
+
+chunk_profile* profiler::enter(const chunk& chk) {
+    const u8* code = chk.bytecode.data();
+    const u64 size = chk.bytecode.size();
+    for (u64 i{}; i < chunks.size(); i++) {
+        chunk_profile* p = chunks.data()[i];
+        if (p->code == code && p->size == size)
+            return p;
+    }
+
+    chunk_profile* p = new chunk_profile{ code, size, chk.name, dynarray<u64>(size + 1) };
+    for (u64 i{}; i < size; i++) {
+        p->hits.push_back(0);
+    }
+    chunks.push_back(p);
+    return p;
+}
+
+namespace {
+
+struct pc_range {
+    u64 begin;
+    u64 end; // last instruction in the range
+    u64 hits;
+};
+
+// straight line code runs every instruction the same number of times, so
+// runs of equal counts are roughly the basic blocks.
+dynarray<pc_range> hot_ranges(const chunk_profile& p) {
+    dynarray<pc_range> ranges;
+    for (u64 pc{}; pc < p.size; pc += instruction_size(p.code + pc)) {
+        const u64 hits = p.hits.data()[pc];
+        if (hits == 0) continue;
+        if (ranges.size() > 0 && ranges.back().hits == hits &&
+            ranges.back().end + instruction_size(p.code + ranges.back().end) == pc) {
+            ranges.back().end = pc;
+        } else {
+            ranges.push_back(pc_range{ pc, pc, hits });
+        }
+    }
+    return ranges;
+}
+
+// sorted by key, largest first. the lists are short, insertion sort it is.
+template <typename T, typename Key>
+void sort_descending(dynarray<T>& items, Key key) {
+    T* data = items.data();
+    for (u64 i = 1; i < items.size(); i++) {
+        T item = data[i];
+        u64 j = i;
+        for (; j > 0 && key(data[j - 1]) < key(item); j--) {
+            data[j] = data[j - 1];
+        }
+        data[j] = item;
+    }
+}
+
+} // namespace
+
+std::ostream& operator<<(std::ostream& os, const profiler& p) {
+    u64 total = 0;
+    dynarray<u64> order;
+    for (u64 op{}; op < profiler::OPCODE_COUNT; op++) {
+        total += p.ops[op].count;
+        if (p.ops[op].count > 0)
+            order.push_back(op);
+    }
+    sort_descending(order, [&](u64 op) { return p.ops[op].count; });
+
+    os << "---- PROFILE ----\n"
+       << "instructions: " << total << ", timed 1 in " << PROFILE_SAMPLE_INTERVAL << "\n\n";
+    os << std::left << std::setw(22) << "opcode" << std::right
+       << std::setw(14) << "count" << std::setw(8) << "%"
+       << std::setw(12) << "avg cycles" << std::setw(9) << "% time" << "\n";
+
+    f64 estimated_total = 0;
+    for (u64 i{}; i < order.size(); i++) {
+        const opcode_profile& o = p.ops[order.data()[i]];
+        if (o.samples > 0)
+            estimated_total += static_cast<f64>(o.sampled_cycles) / o.samples * o.count;
+    }
+
+    for (u64 i{}; i < order.size(); i++) {
+        const opcode_profile& o = p.ops[order.data()[i]];
+        const f64 avg = o.samples > 0 ? static_cast<f64>(o.sampled_cycles) / o.samples : 0;
+        os << std::left << std::setw(22) << opcode_to_string(static_cast<opcode>(order.data()[i]))
+           << std::right << std::setw(14) << o.count
+           << std::setw(8) << std::fixed << std::setprecision(2) << 100.0 * o.count / total
+           << std::setw(12) << std::setprecision(1) << avg
+           << std::setw(9) << std::setprecision(2)
+           << (estimated_total > 0 ? 100.0 * avg * o.count / estimated_total : 0.0) << "\n";
+    }
+
+    os << "\ncycle histograms (log2 buckets, samples)\n";
+    for (u64 i{}; i < order.size(); i++) {
+        const opcode_profile& o = p.ops[order.data()[i]];
+        if (o.samples == 0) continue;
+        os << std::left << std::setw(22) << opcode_to_string(static_cast<opcode>(order.data()[i])) << std::right;
+        for (u64 b{}; b < PROFILE_HISTOGRAM_BUCKETS; b++) {
+            if (o.histogram[b] == 0) continue;
+            os << " [" << (b == 0 ? 0 : 1ull << b) << ","
+               << (b == PROFILE_HISTOGRAM_BUCKETS - 1 ? std::string("inf") : std::to_string(1ull << (b + 1)))
+               << "):" << o.histogram[b];
+        }
+        os << "\n";
+    }
+
+    dynarray<u64> hot_pairs;
+    for (u64 first{}; first < profiler::OPCODE_COUNT; first++) {
+        for (u64 second{}; second < profiler::OPCODE_COUNT; second++) {
+            if (p.pairs[first][second] > 0)
+                hot_pairs.push_back(first * profiler::OPCODE_COUNT + second);
+        }
+    }
+    sort_descending(hot_pairs, [&](u64 pair) {
+        return p.pairs[pair / profiler::OPCODE_COUNT][pair % profiler::OPCODE_COUNT];
+    });
+
+    os << "\nhot opcode pairs\n";
+    for (u64 i{}; i < hot_pairs.size() && i < PROFILE_HOT_PAIRS; i++) {
+        const u64 first = hot_pairs.data()[i] / profiler::OPCODE_COUNT;
+        const u64 second = hot_pairs.data()[i] % profiler::OPCODE_COUNT;
+        const u64 count = p.pairs[first][second];
+        os << std::left << std::setw(44)
+           << opcode_to_string(static_cast<opcode>(first)) + ", " + opcode_to_string(static_cast<opcode>(second))
+           << std::right << std::setw(14) << count
+           << std::setw(8) << std::fixed << std::setprecision(2) << 100.0 * count / total << "\n";
+    }
+
+    os << "\nhot pc ranges\n";
+    for (u64 i{}; i < p.chunks.size(); i++) {
+        const chunk_profile& c = *p.chunks.data()[i];
+        dynarray<pc_range> ranges = hot_ranges(c);
+        if (ranges.size() == 0) continue;
+        sort_descending(ranges, [](const pc_range& r) { return r.hits; });
+
+        os << c.name << ":\n";
+        for (u64 r{}; r < ranges.size() && r < PROFILE_HOT_RANGES; r++) {
+            const pc_range& range = ranges.data()[r];
+            os << "  " << std::setw(4) << std::setfill('0') << range.begin << "-"
+               << std::setw(4) << range.end << std::setfill(' ')
+               << std::setw(14) << range.hits << "  "
+               << opcode_to_string(static_cast<opcode>(c.code[range.begin])) << " ...\n";
+        }
+    }
+    os << std::defaultfloat;
+    return os;
+}
+
+} // namespace sting
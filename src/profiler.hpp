@@ -0,0 +1,93 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include "utilities.hpp"
+#include "dynarray.hpp"
+#include "chunk.hpp"
+
+namespace sting {
+
+const u64 PROFILE_SAMPLE_INTERVAL = 16;  // time one instruction in this many, power of two
+const u64 PROFILE_HISTOGRAM_BUCKETS = 24; // log2 cycle buckets, the last one catches the rest
+const u64 PROFILE_HOT_RANGES = 10;       // per chunk, in the report
+const u64 PROFILE_HOT_PAIRS = 20;        // in the report
+
+struct opcode_profile {
+    u64 count = 0;
+    u64 samples = 0;
+    u64 sampled_cycles = 0;
+    u64 histogram[PROFILE_HISTOGRAM_BUCKETS] = {};
+};
+
+// execution counts for every byte offset of one chunk, only the offsets
+// that start an instruction are ever counted.
+struct chunk_profile {
+    const u8* code; // bytecode buffers survive the collector moving the chunk
+    u64 size;
+    std::string name;
+    dynarray<u64> hits;
+};
+
+/*
+ *  Opcode profiler.
+ *
+ *  only hooked into run_chunk when built with -DSTING_PROFILE, the normal
+ *  build doesn't pay for it. counts every instruction per opcode and per
+ *  pc, and times a sample of them with the time stamp counter (the cycles
+ *  from one dispatch to the next, so the dispatch is included). the
+ *  report is printed at exit.
+ */
+class profiler {
+public:
+    profiler();
+    ~profiler();
+
+    // the frame changed, look up (or start) the profile of its chunk.
+    chunk_profile* enter(const chunk& chk);
+
+    // called before every instruction.
+    void step(chunk_profile* current, u64 pc) {
+        if (timing != OPCODE_COUNT)
+            end_sample();
+
+        const u64 op = static_cast<u64>(static_cast<opcode>(current->code[pc]));
+        ops[op].count++;
+        pairs[previous][op]++;
+        previous = op;
+        current->hits.data()[pc]++;
+        if ((ticks++ & (PROFILE_SAMPLE_INTERVAL - 1)) == 0) {
+            timing = op;
+            timing_start = read_cycles();
+        }
+    }
+
+    // the instruction being timed didn't dispatch another one (end of the
+    // script), close the sample now.
+    void finish() {
+        if (timing != OPCODE_COUNT) end_sample();
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const profiler& p);
+
+private:
+    static constexpr u64 OPCODE_COUNT = static_cast<u64>(opcode::OPCODE_COUNT);
+
+    static u64 read_cycles();
+    void end_sample();
+
+    opcode_profile ops[OPCODE_COUNT];
+    // consecutive dispatches, what superinstructions are picked from. a call
+    // or return pairs the last op of one chunk with the first of the next.
+    u64 pairs[OPCODE_COUNT + 1][OPCODE_COUNT];
+    u64 previous; // OPCODE_COUNT before the first instruction
+    dynarray<chunk_profile*> chunks;
+    u64 ticks;
+    u64 timing; // opcode being timed, OPCODE_COUNT when none
+    u64 timing_start;
+};
+
+extern profiler prof;
+
+} // namespace sting
+
+#endif
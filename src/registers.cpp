@@ -0,0 +1,727 @@
+#include "registers.hpp"
+
+namespace sting {
+
+std::string regop_to_string(regop op) {
+    switch (op) {
+        case regop::MOVE:
+            return "MOVE";
+        case regop::LOAD_CONST:
+            return "CONST";
+        case regop::LOAD_CONST_LONG:
+            return "CONST LONG";
+        case regop::LOAD_TRUE:
+            return "TRUE";
+        case regop::LOAD_FALSE:
+            return "FALSE";
+        case regop::LOAD_NIL:
+            return "NIL";
+        case regop::NEGATE:
+            return "NEGATE";
+        case regop::NOT:
+            return "NOT";
+        case regop::ADD:
+            return "ADD";
+        case regop::SUBTRACT:
+            return "SUBTRACT";
+        case regop::MULTIPLY:
+            return "MULTIPLY";
+        case regop::DIVIDE:
+            return "DIVIDE";
+        case regop::GREATER:
+            return "GREATER";
+        case regop::LESS:
+            return "LESS";
+        case regop::EQUAL:
+            return "EQUAL";
+        case regop::ADD_CONST:
+            return "ADD CONST";
+        case regop::SUBTRACT_CONST:
+            return "SUBTRACT CONST";
+        case regop::PRINT:
+            return "PRINT";
+        case regop::DEFINE_GLOBAL:
+            return "DEFINE GLOBAL";
+        case regop::GET_GLOBAL:
+            return "GET GLOBAL";
+        case regop::SET_GLOBAL:
+            return "SET GLOBAL";
+        case regop::GET_GLOBAL_CHECKED:
+            return "GET GLOBAL (checked)";
+        case regop::SET_GLOBAL_CHECKED:
+            return "SET GLOBAL (checked)";
+        case regop::GET_UPVALUE:
+            return "GET UPVALUE";
+        case regop::SET_UPVALUE:
+            return "SET UPVALUE";
+        case regop::JUMP:
+            return "JUMP";
+        case regop::BRANCH_FALSE:
+            return "BRANCH (if false)";
+        case regop::LESS_BRANCH_FALSE:
+            return "BRANCH (if not less)";
+        case regop::LESS_BRANCH_TRUE:
+            return "BRANCH (if less)";
+        case regop::GREATER_BRANCH_FALSE:
+            return "BRANCH (if not greater)";
+        case regop::GREATER_BRANCH_TRUE:
+            return "BRANCH (if greater)";
+        case regop::EQUAL_BRANCH_FALSE:
+            return "BRANCH (if not equal)";
+        case regop::EQUAL_BRANCH_TRUE:
+            return "BRANCH (if equal)";
+        case regop::LESS_CONST_BRANCH_FALSE:
+            return "BRANCH (if not less than const)";
+        case regop::LESS_CONST_BRANCH_TRUE:
+            return "BRANCH (if less than const)";
+        case regop::GREATER_CONST_BRANCH_FALSE:
+            return "BRANCH (if not greater than const)";
+        case regop::GREATER_CONST_BRANCH_TRUE:
+            return "BRANCH (if greater than const)";
+        case regop::EQUAL_CONST_BRANCH_FALSE:
+            return "BRANCH (if not equal to const)";
+        case regop::EQUAL_CONST_BRANCH_TRUE:
+            return "BRANCH (if equal to const)";
+        case regop::CALL:
+            return "CALL";
+        case regop::CALL_GLOBAL:
+            return "CALL GLOBAL";
+        case regop::MAKE_CLOSURE:
+            return "MAKE CLOSURE";
+        case regop::CLOSE_VALUE:
+            return "CLOSE VALUE";
+        case regop::SAVE_VALUE:
+            return "SAVE VALUE";
+        case regop::LOAD_VALUE:
+            return "LOAD VALUE";
+        case regop::RETURN:
+            return "RETURN";
+        default:
+            return "UNKNOWN";
+    }
+}
+
+namespace {
+
+bool is_branch(opcode op) {
+    switch (short_form(op)) {
+        case opcode::BRANCH:
+        case opcode::LOOP:
+        case opcode::BRANCH_FALSE:
+        case opcode::POP_BRANCH_FALSE:
+        case opcode::LESS_BRANCH_FALSE:
+        case opcode::LESS_BRANCH_TRUE:
+        case opcode::GREATER_BRANCH_FALSE:
+        case opcode::GREATER_BRANCH_TRUE:
+        case opcode::EQUAL_BRANCH_FALSE:
+        case opcode::EQUAL_BRANCH_TRUE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// the form of op that takes its right operand from the constant pool,
+// REGOP_COUNT if there is none.
+regop with_constant(regop op) {
+    switch (op) {
+        case regop::ADD:
+            return regop::ADD_CONST;
+        case regop::SUBTRACT:
+            return regop::SUBTRACT_CONST;
+        case regop::LESS_BRANCH_FALSE:
+            return regop::LESS_CONST_BRANCH_FALSE;
+        case regop::LESS_BRANCH_TRUE:
+            return regop::LESS_CONST_BRANCH_TRUE;
+        case regop::GREATER_BRANCH_FALSE:
+            return regop::GREATER_CONST_BRANCH_FALSE;
+        case regop::GREATER_BRANCH_TRUE:
+            return regop::GREATER_CONST_BRANCH_TRUE;
+        case regop::EQUAL_BRANCH_FALSE:
+            return regop::EQUAL_CONST_BRANCH_FALSE;
+        case regop::EQUAL_BRANCH_TRUE:
+            return regop::EQUAL_CONST_BRANCH_TRUE;
+        default:
+            return regop::REGOP_COUNT;
+    }
+}
+
+bool falls_through(opcode op) {
+    op = short_form(op);
+    return op != opcode::RETURN && op != opcode::BRANCH && op != opcode::LOOP;
+}
+
+// how an instruction changes the depth of the value stack. the branches
+// pop the same on both paths.
+i64 depth_change(const u8* code) {
+    const u64 width = operand_width(static_cast<opcode>(*code));
+    switch (short_form(static_cast<opcode>(*code))) {
+        case opcode::LOAD_CONST:
+        case opcode::TRUE:
+        case opcode::FALSE:
+        case opcode::NIL:
+        case opcode::GET_GLOBAL:
+        case opcode::GET_GLOBAL_CHECKED:
+        case opcode::GET_LOCAL:
+        case opcode::GET_UPVALUE:
+        case opcode::LOAD_VALUE:
+            return 1;
+        case opcode::GET_LOCALS:
+        case opcode::GET_LOCAL_CONST:
+            return 2;
+        case opcode::ADD:
+        case opcode::SUBTRACT:
+        case opcode::MULTIPLY:
+        case opcode::DIVIDE:
+        case opcode::GREATER:
+        case opcode::LESS:
+        case opcode::EQUAL:
+        case opcode::PRINT:
+        case opcode::POP:
+        case opcode::DEFINE_GLOBAL:
+        case opcode::CLOSE_VALUE:
+        case opcode::SAVE_VALUE:
+        case opcode::SET_LOCAL_POP:
+        case opcode::SET_GLOBAL_POP:
+        case opcode::POP_BRANCH_FALSE:
+        case opcode::RETURN:
+            return -1;
+        case opcode::LESS_BRANCH_FALSE:
+        case opcode::LESS_BRANCH_TRUE:
+        case opcode::GREATER_BRANCH_FALSE:
+        case opcode::GREATER_BRANCH_TRUE:
+        case opcode::EQUAL_BRANCH_FALSE:
+        case opcode::EQUAL_BRANCH_TRUE:
+            return -2;
+        case opcode::POPN:
+        case opcode::CALL: // the arguments and the callable, for the result
+            return -static_cast<i64>(read_operand(code + 1, width));
+        case opcode::CALL_LOCAL:
+        case opcode::CALL_GLOBAL:
+            return 1 - static_cast<i64>(read_operand(code + 1 + width, width));
+        default:
+            return 0;
+    }
+}
+
+// where a stack slot's value is. the translation leaves copies of locals
+// and constants on the stack pending, and the instruction that uses them
+// reads the local's register or the constant directly.
+struct slot {
+    enum kind_t { HERE, REGISTER, CONSTANT } kind;
+    u32 index; // the register or the constant
+};
+
+struct fixup {
+    u64 word;   // the offset word to patch
+    u64 target; // bytecode offset the branch lands on
+};
+
+const u64 NO_RESULT = UINT64_MAX;
+
+class translator {
+public:
+    translator(chunk& chk, u64 arity) :
+        chk(chk), arity(arity), depth_at(), is_target(), labels(), stack(), code(), fixups(),
+        registers(0), last_result(NO_RESULT) {}
+
+    bool run() {
+        find_depths();
+        translate();
+        for (u64 i{}; i < fixups.size(); i++) {
+            const fixup& f = fixups.at(i);
+            const i64 offset = static_cast<i64>(labels.at(f.target)) - static_cast<i64>(f.word + 1);
+            code.at(f.word) = static_cast<u32>(static_cast<i32>(offset));
+        }
+        if (registers < arity) registers = arity;
+        if (registers > MAX_REGISTERS) return false;
+        chk.register_code = stealable(code);
+        chk.register_count = registers;
+        return true;
+    }
+
+private:
+    u64 target_of(u64 offset) const {
+        const u8* at = chk.bytecode.data() + offset;
+        const opcode op = static_cast<opcode>(*at);
+        const u64 end = offset + instruction_size(at);
+        const u32 distance = read_operand(at + 1, operand_width(op));
+        return short_form(op) == opcode::LOOP ? end - distance : end + distance;
+    }
+
+    // stack depth before every reachable instruction (relative to the frame
+    // base, so locals included), -1 for the rest. the compiler leaves the
+    // same depth on every path into an instruction.
+    void find_depths() {
+        const u64 size = chk.bytecode.size();
+        for (u64 i{}; i <= size; i++) {
+            depth_at.push_back(-1);
+            is_target.push_back(false);
+            labels.push_back(0);
+        }
+
+        dynarray<u64> work;
+        depth_at.at(0) = arity;
+        work.push_back(0);
+        const auto reach = [&](u64 offset, i64 depth) {
+            if (depth_at.at(offset) == -1) {
+                depth_at.at(offset) = depth;
+                work.push_back(offset);
+            }
+            panic_if(depth_at.at(offset) != depth, "register vm: stack depth differs between paths");
+        };
+
+        while (work.size() > 0) {
+            const u64 offset = work.pop_back();
+            const u8* at = chk.bytecode.data() + offset;
+            const opcode op = static_cast<opcode>(*at);
+            const i64 depth = depth_at.at(offset) + depth_change(at);
+            if (is_branch(op)) {
+                is_target.at(target_of(offset)) = true;
+                reach(target_of(offset), depth);
+            }
+            if (falls_through(op))
+                reach(offset + instruction_size(at), depth);
+        }
+    }
+
+    void translate() {
+        const u8* bytes = chk.bytecode.data();
+        bool reachable = false; // by falling through from the instruction before
+        for (u64 offset{}; offset < chk.bytecode.size(); offset += instruction_size(bytes + offset)) {
+            if (depth_at.at(offset) == -1) {
+                reachable = false;
+                continue;
+            }
+            // every path into a branch target has the whole stack in place.
+            if (is_target.at(offset) || !reachable) {
+                if (reachable) flush_all();
+                stack = dynarray<slot>();
+                for (i64 i{}; i < depth_at.at(offset); i++) {
+                    push(slot::HERE);
+                }
+                last_result = NO_RESULT;
+            }
+            labels.at(offset) = code.size();
+            translate(bytes + offset);
+            reachable = falls_through(static_cast<opcode>(bytes[offset]));
+            panic_if(reachable && static_cast<i64>(stack.size()) != depth_at.at(offset + instruction_size(bytes + offset)),
+                     "register vm: lost track of the stack");
+        }
+    }
+
+    void translate(const u8* at) {
+        const opcode op = short_form(static_cast<opcode>(*at));
+        const u64 width = operand_width(static_cast<opcode>(*at));
+        const u32 first = read_operand(at + 1, width);
+        const u32 second = read_operand(at + 1 + width, width);
+        const u64 offset = at - chk.bytecode.data();
+
+        switch (op) {
+            case opcode::LOAD_CONST:
+                push(slot::CONSTANT, first);
+                break;
+            case opcode::TRUE:
+                produced(emit(encode_abc(regop::LOAD_TRUE, stack.size())));
+                break;
+            case opcode::FALSE:
+                produced(emit(encode_abc(regop::LOAD_FALSE, stack.size())));
+                break;
+            case opcode::NIL:
+                produced(emit(encode_abc(regop::LOAD_NIL, stack.size())));
+                break;
+            case opcode::NEGATE:
+            case opcode::NOT: {
+                const u32 b = reg(top());
+                stack.pop_back();
+                produced(emit(encode_abc(op == opcode::NEGATE ? regop::NEGATE : regop::NOT, stack.size(), b)));
+                break;
+            }
+            case opcode::ADD:
+                binary(regop::ADD);
+                break;
+            case opcode::SUBTRACT:
+                binary(regop::SUBTRACT);
+                break;
+            case opcode::MULTIPLY:
+                binary(regop::MULTIPLY);
+                break;
+            case opcode::DIVIDE:
+                binary(regop::DIVIDE);
+                break;
+            case opcode::GREATER:
+                binary(regop::GREATER);
+                break;
+            case opcode::LESS:
+                binary(regop::LESS);
+                break;
+            case opcode::EQUAL:
+                binary(regop::EQUAL);
+                break;
+            case opcode::PRINT:
+                emit(encode_abc(regop::PRINT, reg(top())));
+                stack.pop_back();
+                break;
+            case opcode::POP:
+                stack.pop_back();
+                break;
+            case opcode::POPN:
+                for (u32 i{}; i < first; i++) {
+                    stack.pop_back();
+                }
+                break;
+            case opcode::DEFINE_GLOBAL:
+                emit(encode_abc(regop::DEFINE_GLOBAL, reg(top())));
+                extra(first);
+                stack.pop_back();
+                break;
+            case opcode::GET_GLOBAL:
+            case opcode::GET_GLOBAL_CHECKED: {
+                const u64 at = emit(encode_abc(op == opcode::GET_GLOBAL ? regop::GET_GLOBAL : regop::GET_GLOBAL_CHECKED,
+                                               stack.size()));
+                extra(first);
+                produced(at);
+                break;
+            }
+            case opcode::SET_GLOBAL:
+            case opcode::SET_GLOBAL_CHECKED:
+            case opcode::SET_GLOBAL_POP:
+                emit(encode_abc(op == opcode::SET_GLOBAL_CHECKED ? regop::SET_GLOBAL_CHECKED : regop::SET_GLOBAL,
+                                reg(top())));
+                extra(first);
+                if (op == opcode::SET_GLOBAL_POP) stack.pop_back();
+                break;
+            case opcode::GET_LOCAL:
+                get_local(first);
+                break;
+            case opcode::SET_LOCAL:
+            case opcode::SET_LOCAL_POP:
+                set_local(first, op == opcode::SET_LOCAL_POP);
+                break;
+            case opcode::GET_UPVALUE:
+                produced(emit(encode_abc(regop::GET_UPVALUE, stack.size(), first)));
+                break;
+            case opcode::SET_UPVALUE:
+                emit(encode_abc(regop::SET_UPVALUE, reg(top()), first));
+                break;
+            case opcode::BRANCH:
+            case opcode::LOOP:
+                flush_all();
+                branch(encode_abc(regop::JUMP, 0), target_of(offset));
+                break;
+            case opcode::BRANCH_FALSE:
+                // the condition stays on the stack, so it has to be in place.
+                flush_all();
+                branch(encode_abc(regop::BRANCH_FALSE, top()), target_of(offset));
+                break;
+            case opcode::POP_BRANCH_FALSE: {
+                const u32 a = reg(top());
+                stack.pop_back();
+                flush_all();
+                branch(encode_abc(regop::BRANCH_FALSE, a), target_of(offset));
+                break;
+            }
+            case opcode::LESS_BRANCH_FALSE:
+                compare_branch(regop::LESS_BRANCH_FALSE, target_of(offset));
+                break;
+            case opcode::LESS_BRANCH_TRUE:
+                compare_branch(regop::LESS_BRANCH_TRUE, target_of(offset));
+                break;
+            case opcode::GREATER_BRANCH_FALSE:
+                compare_branch(regop::GREATER_BRANCH_FALSE, target_of(offset));
+                break;
+            case opcode::GREATER_BRANCH_TRUE:
+                compare_branch(regop::GREATER_BRANCH_TRUE, target_of(offset));
+                break;
+            case opcode::EQUAL_BRANCH_FALSE:
+                compare_branch(regop::EQUAL_BRANCH_FALSE, target_of(offset));
+                break;
+            case opcode::EQUAL_BRANCH_TRUE:
+                compare_branch(regop::EQUAL_BRANCH_TRUE, target_of(offset));
+                break;
+            case opcode::CALL: {
+                const u32 callee = reg(top());
+                stack.pop_back();
+                call(encode_abc(regop::CALL, stack.size() - first, first, callee), first);
+                break;
+            }
+            case opcode::CALL_LOCAL:
+                call(encode_abc(regop::CALL, stack.size() - second, second, first), second);
+                break;
+            case opcode::CALL_GLOBAL:
+                call(encode_abc(regop::CALL_GLOBAL, stack.size() - second, second), second);
+                extra(first);
+                break;
+            case opcode::MAKE_CLOSURE: {
+                const slot fn = stack.pop_back();
+                panic_if(fn.kind != slot::CONSTANT, "register vm: closure of a non constant function");
+                for (u32 i{}; i < first; i++) {
+                    const u8* pair = at + 1 + width + 2 * i * width;
+                    if (read_operand(pair, width)) flush(read_operand(pair + width, width));
+                }
+                const u64 result = emit(encode_abc(regop::MAKE_CLOSURE, stack.size()));
+                extra(fn.index);
+                extra(first);
+                for (u32 i{}; i < first; i++) {
+                    const u8* pair = at + 1 + width + 2 * i * width;
+                    extra(read_operand(pair, width) | read_operand(pair + width, width) << 8);
+                }
+                produced(result);
+                break;
+            }
+            case opcode::CLOSE_VALUE:
+                flush(top());
+                emit(encode_abc(regop::CLOSE_VALUE, top()));
+                stack.pop_back();
+                break;
+            case opcode::SAVE_VALUE:
+                emit(encode_abc(regop::SAVE_VALUE, reg(top())));
+                stack.pop_back();
+                break;
+            case opcode::LOAD_VALUE:
+                produced(emit(encode_abc(regop::LOAD_VALUE, stack.size())));
+                break;
+            case opcode::RETURN:
+                // the script's return has nothing to return.
+                if (stack.size() == 0) {
+                    emit(encode_abc(regop::RETURN, 0));
+                    break;
+                }
+                emit(encode_abc(regop::RETURN, reg(top())));
+                stack.pop_back();
+                break;
+            case opcode::GET_LOCALS:
+                get_local(first);
+                get_local(second);
+                break;
+            case opcode::GET_LOCAL_CONST:
+                get_local(first);
+                push(slot::CONSTANT, second);
+                break;
+            case opcode::ADD_LOCAL_CONST:
+                flush(first);
+                flush_reading(first);
+                if (second < MAX_REGISTERS) {
+                    emit(encode_abc(regop::ADD_CONST, first, first, second));
+                } else {
+                    // the slot above the stack is free for a moment.
+                    const u32 temp = stack.size();
+                    if (registers < temp + 1) registers = temp + 1;
+                    load_constant(temp, second);
+                    emit(encode_abc(regop::ADD, first, first, temp));
+                }
+                break;
+            default:
+                panic("register vm: cannot translate " + opcode_to_string(op));
+        }
+    }
+
+    u32 top() const { return stack.size() - 1; }
+
+    void push(slot::kind_t kind, u32 index = 0) {
+        stack.push_back(slot{ kind, index });
+        if (registers < stack.size()) registers = stack.size();
+    }
+
+    u64 emit(u32 word) {
+        code.push_back(word);
+        last_result = NO_RESULT;
+        return code.size() - 1;
+    }
+
+    void extra(u32 word) { code.push_back(word); }
+
+    // the instruction at word left its result in the new top of the stack.
+    void produced(u64 word) {
+        push(slot::HERE);
+        last_result = word;
+    }
+
+    void load_constant(u32 r, u32 index) {
+        if (index <= UINT16_MAX) {
+            emit(encode_abx(regop::LOAD_CONST, r, index));
+        } else {
+            emit(encode_abc(regop::LOAD_CONST_LONG, r));
+            extra(index);
+        }
+    }
+
+    // put the value of stack slot p in register p.
+    void flush(u32 p) {
+        slot& s = stack.at(p);
+        if (s.kind == slot::REGISTER) {
+            emit(encode_abc(regop::MOVE, p, s.index));
+        } else if (s.kind == slot::CONSTANT) {
+            load_constant(p, s.index);
+        }
+        s.kind = slot::HERE;
+    }
+
+    void flush_all() {
+        for (u64 p{}; p < stack.size(); p++) {
+            flush(p);
+        }
+    }
+
+    bool reading(u32 r) const {
+        for (u64 p{}; p < stack.size(); p++) {
+            if (stack.at(p).kind == slot::REGISTER && stack.at(p).index == r) return true;
+        }
+        return false;
+    }
+
+    // before r is written, the copies of it still on the stack get made.
+    void flush_reading(u32 r) {
+        for (u64 p{}; p < stack.size(); p++) {
+            if (stack.at(p).kind == slot::REGISTER && stack.at(p).index == r) flush(p);
+        }
+    }
+
+    // the register slot p's value is in, constants are loaded into p.
+    u32 reg(u32 p) {
+        const slot s = stack.at(p);
+        if (s.kind == slot::REGISTER) return s.index;
+        flush(p);
+        return p;
+    }
+
+    void get_local(u32 a) {
+        flush(a);
+        push(slot::REGISTER, a);
+    }
+
+    void set_local(u32 a, bool pop) {
+        const slot s = stack.at(top());
+        if (s.kind == slot::HERE && last_result != NO_RESULT && !reading(a)) {
+            // the instruction that made the value writes the local instead.
+            code.at(last_result) = (code.at(last_result) & ~0xff00u) | a << 8;
+        } else {
+            flush_reading(a);
+            const slot now = stack.at(top());
+            if (now.kind == slot::CONSTANT) {
+                load_constant(a, now.index);
+            } else {
+                emit(encode_abc(regop::MOVE, a, now.kind == slot::REGISTER ? now.index : top()));
+            }
+        }
+        stack.at(a).kind = slot::HERE;
+        stack.pop_back();
+        last_result = NO_RESULT;
+        if (!pop) push(slot::REGISTER, a);
+    }
+
+    // a constant right operand that fits in an operand field, for the ops
+    // that have a constant form.
+    bool constant_right(regop op) const {
+        const slot right = stack.at(top());
+        return with_constant(op) != regop::REGOP_COUNT && right.kind == slot::CONSTANT &&
+               right.index < MAX_REGISTERS;
+    }
+
+    void binary(regop op) {
+        if (constant_right(op)) {
+            const u32 k = stack.pop_back().index;
+            const u32 b = reg(top());
+            stack.pop_back();
+            produced(emit(encode_abc(with_constant(op), stack.size(), b, k)));
+            return;
+        }
+        const u32 c = reg(top());
+        const u32 b = reg(top() - 1);
+        stack.pop_back();
+        stack.pop_back();
+        produced(emit(encode_abc(op, stack.size(), b, c)));
+    }
+
+    void compare_branch(regop op, u64 target) {
+        if (constant_right(op)) {
+            const u32 k = stack.pop_back().index;
+            const u32 a = reg(top());
+            stack.pop_back();
+            flush_all();
+            branch(encode_abc(with_constant(op), a, k), target);
+            return;
+        }
+        const u32 b = reg(top());
+        const u32 a = reg(top() - 1);
+        stack.pop_back();
+        stack.pop_back();
+        flush_all();
+        branch(encode_abc(op, a, b), target);
+    }
+
+    void branch(u32 word, u64 target) {
+        emit(word);
+        fixups.push_back(fixup{ code.size(), target });
+        extra(0);
+    }
+
+    // the callee may change any local through an upvalue, so nothing stays
+    // pending across the call. the arguments are the top args slots, the
+    // result replaces them.
+    void call(u32 word, u32 args) {
+        flush_all();
+        for (u32 i{}; i < args; i++) {
+            stack.pop_back();
+        }
+        emit(word);
+        push(slot::HERE);
+    }
+
+    chunk& chk;
+    u64 arity; // the parameters are on the stack before the first instruction
+    dynarray<i64> depth_at;   // by bytecode offset
+    dynarray<bool> is_target; // by bytecode offset
+    dynarray<u64> labels;     // bytecode offset to word
+    dynarray<slot> stack;
+    dynarray<u32> code;
+    dynarray<fixup> fixups;
+    u64 registers;
+    u64 last_result; // word whose a is the top slot, when nothing came after it
+};
+
+} // namespace
+
+bool translate_to_registers(chunk& chk, u64 arity) {
+    return translator(chk, arity).run();
+}
+
+void print_registers(std::ostream& os, const chunk& chk) {
+    os << "---- REGISTERS: " << chk.name << " (" << chk.register_count << ") ---- \n";
+    const u32* code = chk.register_code.data();
+    for (u64 i{}; i < chk.register_code.size(); i += regop_size(code + i)) {
+        const u32 word = code[i];
+        const regop op = decode_op(word);
+        os << std::setw(4) << std::setfill('0') << i << ": " << regop_to_string(op) << ":";
+        if (op == regop::LOAD_CONST) {
+            os << " " << decode_a(word) << " " << decode_bx(word);
+        } else {
+            os << " " << decode_a(word) << " " << decode_b(word) << " " << decode_c(word);
+        }
+        switch (op) {
+            case regop::JUMP:
+            case regop::BRANCH_FALSE:
+            case regop::LESS_BRANCH_FALSE:
+            case regop::LESS_BRANCH_TRUE:
+            case regop::GREATER_BRANCH_FALSE:
+            case regop::GREATER_BRANCH_TRUE:
+            case regop::EQUAL_BRANCH_FALSE:
+            case regop::EQUAL_BRANCH_TRUE:
+            case regop::LESS_CONST_BRANCH_FALSE:
+            case regop::LESS_CONST_BRANCH_TRUE:
+            case regop::GREATER_CONST_BRANCH_FALSE:
+            case regop::GREATER_CONST_BRANCH_TRUE:
+            case regop::EQUAL_CONST_BRANCH_FALSE:
+            case regop::EQUAL_CONST_BRANCH_TRUE:
+                os << " -> " << std::setw(4) << i + 2 + static_cast<i32>(code[i + 1]);
+                break;
+            default:
+                for (u64 j = 1; j < regop_size(code + i); j++) {
+                    os << " " << code[i + j];
+                }
+        }
+        os << "\n";
+    }
+}
+
+} // namespace sting
@@ -0,0 +1,137 @@
+#ifndef REGISTERS_HPP
+#define REGISTERS_HPP
+
+#include "utilities.hpp"
+#include "chunk.hpp"
+
+namespace sting {
+
+/*
+ *  Register bytecode.
+ *
+ *  the same program as a chunk's stack bytecode, for vmachine::run_registers.
+ *  registers are the frame's value stack slots, so a local is the register
+ *  of its slot and temporaries get the slots the stack code would have
+ *  pushed them to. instructions name their sources and destination, most
+ *  GET_LOCALs and LOAD_CONSTs disappear into the instruction that uses them.
+ *
+ *  code is a list of 32 bit words, each instruction is one word
+ *
+ *      op (8) | a (8) | b (8) | c (8)      or      op (8) | a (8) | bx (16)
+ *
+ *  followed by the operands that don't fit (global slots, long constant
+ *  indices, branch offsets), a word each. branch offsets are signed and
+ *  relative to the word after them.
+ */
+enum class regop {
+    MOVE,               // a = b
+    LOAD_CONST,         // a = constant bx
+    LOAD_CONST_LONG,    // a = constant (next word)
+    LOAD_TRUE,          // a = true
+    LOAD_FALSE,         // a = false
+    LOAD_NIL,           // a = nil
+    NEGATE,             // a = -b
+    NOT,                // a = !b
+    ADD,                // a = b + c
+    SUBTRACT,           // a = b - c
+    MULTIPLY,           // a = b * c
+    DIVIDE,             // a = b / c
+    GREATER,            // a = b > c
+    LESS,               // a = b < c
+    EQUAL,              // a = b == c
+    ADD_CONST,          // a = b + constant c
+    SUBTRACT_CONST,     // a = b - constant c
+    PRINT,              // print a
+    DEFINE_GLOBAL,      // global (next word) = a
+    GET_GLOBAL,         // a = global (next word)
+    SET_GLOBAL,         // global (next word) = a
+    GET_GLOBAL_CHECKED,
+    SET_GLOBAL_CHECKED,
+    GET_UPVALUE,        // a = upvalue b
+    SET_UPVALUE,        // upvalue b = a
+    JUMP,               // by the next word
+    BRANCH_FALSE,       // if !a
+    LESS_BRANCH_FALSE,  // if !(a < b)
+    LESS_BRANCH_TRUE,   // if a < b
+    GREATER_BRANCH_FALSE,
+    GREATER_BRANCH_TRUE,
+    EQUAL_BRANCH_FALSE,
+    EQUAL_BRANCH_TRUE,
+    LESS_CONST_BRANCH_FALSE, // if !(a < constant b)
+    LESS_CONST_BRANCH_TRUE,
+    GREATER_CONST_BRANCH_FALSE,
+    GREATER_CONST_BRANCH_TRUE,
+    EQUAL_CONST_BRANCH_FALSE,
+    EQUAL_CONST_BRANCH_TRUE,
+    CALL,               // a = c(a .. a + b - 1)
+    CALL_GLOBAL,        // a = global (next word)(a .. a + b - 1)
+    MAKE_CLOSURE,       // a = closure of constant (next word), then the
+                        // upvalue count and a (local | index << 8) word each
+    CLOSE_VALUE,        // close the upvalue of a
+    SAVE_VALUE,         // scratch = a
+    LOAD_VALUE,         // a = scratch
+    RETURN,             // return a
+
+    REGOP_COUNT, // not an opcode, keep last.
+};
+
+const u64 MAX_REGISTERS = 256;
+
+std::string regop_to_string(regop op);
+
+inline u32 encode_abc(regop op, u32 a, u32 b = 0, u32 c = 0) {
+    return static_cast<u32>(op) | a << 8 | b << 16 | c << 24;
+}
+
+inline u32 encode_abx(regop op, u32 a, u32 bx) {
+    return static_cast<u32>(op) | a << 8 | bx << 16;
+}
+
+inline regop decode_op(u32 word) { return static_cast<regop>(word & 0xff); }
+inline u32 decode_a(u32 word) { return (word >> 8) & 0xff; }
+inline u32 decode_b(u32 word) { return (word >> 16) & 0xff; }
+inline u32 decode_c(u32 word) { return word >> 24; }
+inline u32 decode_bx(u32 word) { return word >> 16; }
+
+// size in words of the instruction starting at code.
+inline u64 regop_size(const u32* code) {
+    switch (decode_op(*code)) {
+        case regop::LOAD_CONST_LONG:
+        case regop::DEFINE_GLOBAL:
+        case regop::GET_GLOBAL:
+        case regop::SET_GLOBAL:
+        case regop::GET_GLOBAL_CHECKED:
+        case regop::SET_GLOBAL_CHECKED:
+        case regop::JUMP:
+        case regop::BRANCH_FALSE:
+        case regop::LESS_BRANCH_FALSE:
+        case regop::LESS_BRANCH_TRUE:
+        case regop::GREATER_BRANCH_FALSE:
+        case regop::GREATER_BRANCH_TRUE:
+        case regop::EQUAL_BRANCH_FALSE:
+        case regop::EQUAL_BRANCH_TRUE:
+        case regop::LESS_CONST_BRANCH_FALSE:
+        case regop::LESS_CONST_BRANCH_TRUE:
+        case regop::GREATER_CONST_BRANCH_FALSE:
+        case regop::GREATER_CONST_BRANCH_TRUE:
+        case regop::EQUAL_CONST_BRANCH_FALSE:
+        case regop::EQUAL_CONST_BRANCH_TRUE:
+        case regop::CALL_GLOBAL:
+            return 2;
+        case regop::MAKE_CLOSURE:
+            return 3 + code[2];
+        default:
+            return 1;
+    }
+}
+
+// fills in chk.register_code and chk.register_count from its bytecode, for
+// a function taking arity arguments. false if it needs more than
+// MAX_REGISTERS, nothing is filled in then.
+bool translate_to_registers(chunk& chk, u64 arity);
+
+void print_registers(std::ostream& os, const chunk& chk);
+
+} // namespace sting
+
+#endif
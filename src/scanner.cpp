@@ -1,9 +1,14 @@
 #include "scanner.hpp"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define STING_SIMD_SCANNER
+#endif
+
 /*
 
-Scanner as a class is probably no good. Should just be one function call,
-that returns dynarray<token>.
+The parser pulls tokens with next_token as it goes, tokenize is only for
+when all of them are wanted at once.
 
 Don't like my use of lambdas.
 
@@ -11,6 +16,137 @@ Don't like my use of lambdas.
 
 namespace sting {
 
+namespace {
+
+#ifdef STING_SIMD_SCANNER
+
+const u64 BLOCK = 16;
+
+inline __m128i load(const u8* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+
+inline u32 mask(__m128i m) { return static_cast<u32>(_mm_movemask_epi8(m)); }
+
+inline u32 equal(__m128i bytes, u8 ch) { return mask(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(ch))); }
+
+// lo <= byte < lo + n, unsigned.
+inline u32 in_range(__m128i bytes, u8 lo, u8 n) {
+    const __m128i d = _mm_sub_epi8(bytes, _mm_set1_epi8(lo));
+    return mask(_mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(n - 1)), d));
+}
+
+inline u32 digits(__m128i bytes) { return in_range(bytes, '0', 10); }
+
+// what is_alpha or is_digit takes. or'ing 0x20 only folds A-Z onto a-z.
+inline u32 word(__m128i bytes) {
+    return in_range(_mm_or_si128(bytes, _mm_set1_epi8(0x20)), 'a', 26) |
+           equal(bytes, '_') | digits(bytes);
+}
+
+inline u32 blanks(__m128i bytes) {
+    return equal(bytes, ' ') | equal(bytes, '\t') | equal(bytes, '\r') | equal(bytes, '\n');
+}
+
+// the first byte from p that stop (16 bytes -> a bit per byte) picks,
+// adding the newlines before it to line. only whole blocks before end are
+// looked at, if it runs out of those it's where they end, and the scalar
+// loops that come after do the rest.
+template <typename Stop>
+u8* scan(u8* p, const u8* end, u64& line, Stop stop) {
+    while (static_cast<u64>(end - p) >= BLOCK) {
+        const __m128i bytes = load(p);
+        const u32 stops = stop(bytes);
+        const u32 newlines = equal(bytes, '\n');
+        if (stops != 0) {
+            const u32 before = newlines & ((1u << __builtin_ctz(stops)) - 1);
+            if (before != 0) line += __builtin_popcount(before);
+            return p + __builtin_ctz(stops);
+        }
+        if (newlines != 0) line += __builtin_popcount(newlines);
+        p += BLOCK;
+    }
+    return p;
+}
+
+#endif
+
+// the keywords, in token_type's order from AND to WHILE.
+struct keyword {
+    const char* name = nullptr;
+    u64 length = 0;
+    token_type type = token_type::IDENTIFIER;
+};
+
+constexpr keyword kw(const char* name, token_type type) {
+    u64 length = 0;
+    while (name[length] != '\0') length++;
+    return keyword{ name, length, type };
+}
+
+constexpr keyword KEYWORDS[] = {
+    kw("and", token_type::AND),       kw("class", token_type::CLASS),
+    kw("else", token_type::ELSE),     kw("false", token_type::FALSE),
+    kw("for", token_type::FOR),       kw("fun", token_type::FUN),
+    kw("if", token_type::IF),         kw("nil", token_type::NIL),
+    kw("or", token_type::OR),         kw("print", token_type::PRINT),
+    kw("return", token_type::RETURN), kw("super", token_type::SUPER),
+    kw("this", token_type::THIS),     kw("true", token_type::TRUE),
+    kw("var", token_type::VAR),       kw("while", token_type::WHILE),
+};
+
+const u64 KEYWORD_COUNT = sizeof(KEYWORDS) / sizeof(KEYWORDS[0]);
+const u64 KEYWORD_SLOTS = 32;
+
+constexpr bool keywords_match_token_types() {
+    if (KEYWORD_COUNT != static_cast<u64>(token_type::WHILE) - static_cast<u64>(token_type::AND) + 1)
+        return false;
+    for (u64 i{}; i < KEYWORD_COUNT; i++) {
+        if (static_cast<u64>(KEYWORDS[i].type) != static_cast<u64>(token_type::AND) + i) return false;
+    }
+    return true;
+}
+
+static_assert(keywords_match_token_types(),
+              "KEYWORDS needs every keyword token_type, in order");
+
+// from the length and the first and last characters, no two keywords
+// share a slot (checked below), so an identifier can only be the keyword
+// in its slot.
+constexpr u64 keyword_slot(u8 first, u8 last, u64 length) {
+    return (static_cast<unsigned char>(first) + 5 * static_cast<unsigned char>(last) + length) &
+           (KEYWORD_SLOTS - 1);
+}
+
+struct keyword_table {
+    keyword slots[KEYWORD_SLOTS];
+    bool perfect; // every keyword has a slot to itself
+};
+
+constexpr keyword_table make_keyword_table() {
+    keyword_table table{};
+    table.perfect = true;
+    for (u64 i{}; i < KEYWORD_COUNT; i++) {
+        const keyword& k = KEYWORDS[i];
+        keyword& slot = table.slots[keyword_slot(k.name[0], k.name[k.length - 1], k.length)];
+        if (slot.length != 0) table.perfect = false;
+        slot = k;
+    }
+    return table;
+}
+
+constexpr keyword_table KEYWORD_TABLE = make_keyword_table();
+
+static_assert(KEYWORD_TABLE.perfect, "two keywords hash to the same slot, change keyword_slot");
+
+token_type keyword_type(const u8* ident, u64 length) {
+    const keyword& k = KEYWORD_TABLE.slots[keyword_slot(ident[0], ident[length - 1], length)];
+    if (k.length == length && memcmp(ident, k.name, length) == 0) return k.type;
+    return token_type::IDENTIFIER;
+}
+
+inline bool is_blank(u8 ch) { return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n'; }
+
+} // namespace
+
 bool scanner::tokenize(dynarray<token>& tokens) {
     for (;;) {
         token t = next_token();
@@ -27,8 +163,8 @@ bool scanner::tokenize(dynarray<token>& tokens) {
 token scanner::next_token() {
     skip_whitespace();
     u8* start = current;
-    u8 c = *current;
     if (at_end(start)) return build_token(token_type::END_OF_FILE, start);
+    u8 c = *current;
 
     auto build_token_start = [=](token_type type) -> token {
         return this->build_token(type, start);
@@ -37,12 +173,6 @@ token scanner::next_token() {
     if (is_digit(c)) return number_token();
     if (is_alpha(c)) return identifier_token();
 
-    // TODO: fix " " bug
-    // if (c == '\"') {
-    //     current++;
-    //     return string_token();
-    // }
-
     current++;
     switch (c) {
         case '(': return build_token_start(token_type::LEFT_PAREN);
@@ -81,21 +211,42 @@ u8 scanner::get_char() {
     return ret;
 }
 
+// the source needn't have a terminator, so nothing reads at its end.
+u8 scanner::peek() {
+    if (at_end(current)) return '\0';
+    return *current;
+}
+
 u8 scanner::peek_next() {
-    if (at_end(current + 1)) return '\0';
+    if (at_end(current) || at_end(current + 1)) return '\0';
     return current[1];
 }
 
 void scanner::skip_whitespace() {
     for (;;) {
-        u8 check = *current;
+#ifdef STING_SIMD_SCANNER
+        // a run of them, indentation mostly. one between tokens is quicker
+        // on its own.
+        if (vectorized && is_blank(peek()) && is_blank(peek_next())) {
+            current = scan(current, source + size, line,
+                           [](__m128i bytes) { return ~blanks(bytes) & 0xffff; });
+        }
+#endif
+        u8 check = peek();
         switch (check) {
             case '/': {
                 if (peek_next() == '/') {
+#ifdef STING_SIMD_SCANNER
+                    if (vectorized) {
+                        current = scan(current, source + size, line,
+                                       [](__m128i bytes) { return equal(bytes, '\n'); });
+                    }
+#endif
                     while (!at_end(current) && *current != '\n') {
                         current++;
                     }
-                    // while (!at_end(current) && get_char() != '\n');
+                    // a comment can end the file without a newline.
+                    if (at_end(current)) return;
                     current++;
                     line++;
                 } else {
@@ -119,8 +270,7 @@ void scanner::skip_whitespace() {
 }
 
 bool scanner::match_next_char(u8 next) {
-    u8 check = *current;
-    if (at_end(current) || check != next)
+    if (at_end(current) || peek() != next)
         return false;
     current++;
     return true;
@@ -145,67 +295,62 @@ token scanner::error_token(u8* message) {
     };
 }
 
+// current is just past the opening quote, the token is the contents
+// without the quotes (and can be empty).
 token scanner::string_token() {
-    u8* start = current++;
-    while (peek_next() != '\"') {
-        if (at_end(current)) return error_token(const_cast<u8*>("unterminated string."));
+    u8* start = current;
+#ifdef STING_SIMD_SCANNER
+    if (vectorized) {
+        current = scan(current, source + size, line,
+                       [](__m128i bytes) { return equal(bytes, '\"'); });
+    }
+#endif
+    while (!at_end(current) && *current != '\"') {
+        if (*current == '\n') line++;
         current++;
     }
-    current++;
+    if (at_end(current)) return error_token(const_cast<u8*>("unterminated string."));
+
     token t = build_token(token_type::STRING, start);
-    current++;
+    current++; // closing quote
     return t;
 }
 
 token scanner::number_token() {
     u8* start = current;
-    while (is_digit(*current)) current++;
+    skip_digits();
 
-    if (*current == '.' && is_digit(peek_next()))
+    if (peek() == '.' && is_digit(peek_next()))
         current++;
 
-    while (is_digit(*current)) current++;
+    skip_digits();
 
     return build_token(token_type::NUMBER, start);
 }
 
+void scanner::skip_digits() {
+#ifdef STING_SIMD_SCANNER
+    if (vectorized) {
+        current = scan(current, source + size, line,
+                       [](__m128i bytes) { return ~digits(bytes) & 0xffff; });
+    }
+#endif
+    while (is_digit(peek())) current++;
+}
+
 token scanner::identifier_token() {
     u8* start = current;
-    while (is_alpha(*current) || is_digit(*current)) {
+#ifdef STING_SIMD_SCANNER
+    if (vectorized) {
+        current = scan(current, source + size, line,
+                       [](__m128i bytes) { return ~word(bytes) & 0xffff; });
+    }
+#endif
+    while (is_alpha(peek()) || is_digit(peek())) {
         current++;
     }
 
-    token t = build_token(token_type::IDENTIFIER, start);
-
-    auto match = [&t, start, this](const char* keyword, token_type type) {
-        match_keyword(start, (this->current - start), keyword, type, t);
-    };
-
-    match("and", token_type::AND);
-    match("class", token_type::CLASS);
-    match("else", token_type::ELSE);
-    match("false", token_type::FALSE);
-    match("for", token_type::FOR);
-    match("fun", token_type::FUN);
-    match("if", token_type::IF);
-    match("nil", token_type::NIL);
-    match("or", token_type::OR);
-    match("print", token_type::PRINT);
-    match("return", token_type::RETURN);
-    match("super", token_type::SUPER);
-    match("this", token_type::THIS);
-    match("true", token_type::TRUE);
-    match("var", token_type::VAR);
-    match("while", token_type::WHILE);
-
-    return t;
-}
-
-void scanner::match_keyword(char* ident, u64 size, const char* keyword,
-                       token_type type, token& tok) {
-        if (strlen(keyword) != size) return;
-        if (strncmp(ident, keyword, size) != 0) return;
-        tok = build_token(type, ident);
+    return build_token(keyword_type(start, current - start), start);
 }
 
 bool scanner::is_alpha(u8 ch) {
@@ -19,7 +19,7 @@ enum class token_type {
   LESS, LESS_EQUAL,
   // Literals.
   IDENTIFIER, STRING, NUMBER,
-  // Keywords.
+  // Keywords, KEYWORDS in scanner.cpp has to have them all in this order.
   AND, CLASS, ELSE, FALSE,
   FOR, FUN, IF, NIL, OR,
   PRINT, RETURN, SUPER, THIS,
@@ -44,13 +44,18 @@ struct token {
 };
 
 // TODO: track column and do multi lines (nested) comments
+//
+// where the build has sse2, runs of whitespace, comments, identifiers,
+// numbers and strings are scanned 16 bytes at a time. vectorized = false
+// keeps to the byte at a time loops, which give the same tokens.
 class scanner {
 public:
-    scanner(u8* source, u64 size) :
+    scanner(u8* source, u64 size, bool vectorized = true) :
         source(source),
         current(source),
         line(1),
-        size(size) { }
+        size(size),
+        vectorized(vectorized) { }
 
     bool tokenize(dynarray<token>& tokens);
 
@@ -58,6 +63,8 @@ public:
 
     u8 get_char();
 
+    u8 peek();
+
     u8 peek_next();
 
     void skip_whitespace();
@@ -72,10 +79,9 @@ public:
 
     token number_token();
 
-    token identifier_token();
+    void skip_digits();
 
-    void match_keyword(char* ident, u64 size, const char* keyword,
-                       token_type type, token& tok);
+    token identifier_token();
 
     bool is_alpha(u8 ch);
 
@@ -88,6 +94,7 @@ private:
     u8* current;
     u64 line;
     u64 size;
+    bool vectorized;
 };
 
 
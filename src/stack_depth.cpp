@@ -0,0 +1,175 @@
+#include "stack_depth.hpp"
+
+namespace sting {
+
+namespace {
+
+bool is_branch(opcode op) {
+    switch (short_form(generic_form(op))) {
+        case opcode::BRANCH:
+        case opcode::LOOP:
+        case opcode::BRANCH_FALSE:
+        case opcode::POP_BRANCH_FALSE:
+        case opcode::LESS_BRANCH_FALSE:
+        case opcode::LESS_BRANCH_TRUE:
+        case opcode::GREATER_BRANCH_FALSE:
+        case opcode::GREATER_BRANCH_TRUE:
+        case opcode::EQUAL_BRANCH_FALSE:
+        case opcode::EQUAL_BRANCH_TRUE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool falls_through(opcode op) {
+    op = short_form(op);
+    return op != opcode::RETURN && op != opcode::BRANCH && op != opcode::LOOP;
+}
+
+// UINT64_MAX for a LOOP further back than the start of the chunk.
+u64 target_of(const u8* code, u64 offset) {
+    const opcode op = static_cast<opcode>(code[offset]);
+    const u64 end = offset + instruction_size(code + offset);
+    const u32 distance = read_operand(code + offset + 1, operand_width(op));
+    if (short_form(op) == opcode::LOOP)
+        return distance <= end ? end - distance : UINT64_MAX;
+    return end + distance;
+}
+
+// values an instruction takes off the stack.
+i64 takes(const u8* at, bool script) {
+    const u64 width = operand_width(static_cast<opcode>(*at));
+    switch (short_form(generic_form(static_cast<opcode>(*at)))) {
+        case opcode::RETURN:
+            return script ? 0 : 1;
+        case opcode::NEGATE:
+        case opcode::NOT:
+        case opcode::PRINT:
+        case opcode::POP:
+        case opcode::DEFINE_GLOBAL:
+        case opcode::SET_GLOBAL:
+        case opcode::SET_GLOBAL_CHECKED:
+        case opcode::SET_LOCAL:
+        case opcode::BRANCH_FALSE:
+        case opcode::MAKE_CLOSURE:
+        case opcode::SET_UPVALUE:
+        case opcode::CLOSE_VALUE:
+        case opcode::SAVE_VALUE:
+        case opcode::SET_LOCAL_POP:
+        case opcode::SET_GLOBAL_POP:
+        case opcode::POP_BRANCH_FALSE:
+            return 1;
+        case opcode::ADD:
+        case opcode::SUBTRACT:
+        case opcode::MULTIPLY:
+        case opcode::DIVIDE:
+        case opcode::GREATER:
+        case opcode::LESS:
+        case opcode::EQUAL:
+        case opcode::LESS_BRANCH_FALSE:
+        case opcode::LESS_BRANCH_TRUE:
+        case opcode::GREATER_BRANCH_FALSE:
+        case opcode::GREATER_BRANCH_TRUE:
+        case opcode::EQUAL_BRANCH_FALSE:
+        case opcode::EQUAL_BRANCH_TRUE:
+            return 2;
+        case opcode::POPN:
+            return read_operand(at + 1, width);
+        case opcode::CALL: // the arguments and the callable
+            return static_cast<i64>(read_operand(at + 1, width)) + 1;
+        case opcode::CALL_LOCAL:
+        case opcode::CALL_GLOBAL:
+            return read_operand(at + 1 + width, width);
+        default:
+            return 0;
+    }
+}
+
+// values it leaves in their place.
+i64 gives(opcode op) {
+    switch (short_form(generic_form(op))) {
+        case opcode::LOAD_CONST:
+        case opcode::NEGATE:
+        case opcode::NOT:
+        case opcode::ADD:
+        case opcode::SUBTRACT:
+        case opcode::MULTIPLY:
+        case opcode::DIVIDE:
+        case opcode::GREATER:
+        case opcode::LESS:
+        case opcode::EQUAL:
+        case opcode::TRUE:
+        case opcode::FALSE:
+        case opcode::NIL:
+        case opcode::GET_GLOBAL:
+        case opcode::GET_GLOBAL_CHECKED:
+        case opcode::SET_GLOBAL:
+        case opcode::SET_GLOBAL_CHECKED:
+        case opcode::GET_LOCAL:
+        case opcode::SET_LOCAL:
+        case opcode::BRANCH_FALSE:
+        case opcode::CALL:
+        case opcode::MAKE_CLOSURE:
+        case opcode::GET_UPVALUE:
+        case opcode::SET_UPVALUE:
+        case opcode::LOAD_VALUE:
+        case opcode::CALL_LOCAL:
+        case opcode::CALL_GLOBAL:
+            return 1;
+        case opcode::GET_LOCALS:
+        case opcode::GET_LOCAL_CONST:
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+} // namespace
+
+bool find_stack_depths(const chunk& chk, u64 arity, bool script, dynarray<i64>& depth_at, u32& peak) {
+    const u8* code = chk.bytecode.data();
+    const u64 size = chk.bytecode.size();
+    depth_at = dynarray<i64>();
+    for (u64 i{}; i <= size; i++) {
+        depth_at.push_back(-1);
+    }
+    peak = 0;
+    if (size == 0) return false;
+
+    bool ok = true;
+    dynarray<u64> work;
+    depth_at.at(0) = arity;
+    work.push_back(0);
+    // a path that disagrees isn't followed, the first one to get there wins.
+    const auto reach = [&](u64 offset, i64 depth) {
+        if (offset >= size) {
+            ok = false;
+        } else if (depth_at.at(offset) == -1) {
+            depth_at.at(offset) = depth;
+            work.push_back(offset);
+        } else if (depth_at.at(offset) != depth) {
+            ok = false;
+        }
+    };
+
+    while (work.size() > 0) {
+        const u64 offset = work.pop_back();
+        const u8* at = code + offset;
+        const opcode op = static_cast<opcode>(*at);
+        const i64 depth = depth_at.at(offset);
+        const i64 taken = takes(at, script);
+        if (taken > depth) {
+            ok = false;
+            continue;
+        }
+        const i64 after = depth - taken + gives(op);
+        if (after > static_cast<i64>(arity) + peak) peak = after - arity;
+
+        if (is_branch(op)) reach(target_of(code, offset), after);
+        if (falls_through(op)) reach(offset + instruction_size(at), after);
+    }
+    return ok;
+}
+
+} // namespace sting
@@ -0,0 +1,33 @@
+#ifndef STACK_DEPTH_HPP
+#define STACK_DEPTH_HPP
+
+#include "utilities.hpp"
+#include "dynarray.hpp"
+#include "chunk.hpp"
+
+namespace sting {
+
+/*
+ *  Value stack depth of a finished chunk.
+ *
+ *  follows every path through the bytecode from its first instruction,
+ *  where the arguments are on the stack, and records the depth before
+ *  each instruction (relative to the frame base, so locals count). the
+ *  compiler leaves the same depth on every path into an instruction, so
+ *  one visit each is enough.
+ *
+ *  the parser takes chunk::max_stack from this, and a cached file's code
+ *  has to pass it before it runs (bytecode_file.cpp).
+ */
+
+// depth_at gets the depth before every instruction, one entry per byte
+// and one past the end, -1 where no path reaches. peak is the most any
+// instruction leaves above the arguments. false when paths into an
+// instruction disagree, an instruction takes more than is on the stack,
+// a branch leaves the chunk or the code runs off its end. the script's
+// RETURN takes nothing, a function's takes its result.
+bool find_stack_depths(const chunk& chk, u64 arity, bool script, dynarray<i64>& depth_at, u32& peak);
+
+} // namespace sting
+
+#endif
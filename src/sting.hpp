@@ -10,5 +10,6 @@
 #include "hashmap.hpp"
 #include "function.hpp"
 #include "hash.hpp"
+#include "gc.hpp"
 
 #endif
@@ -1,4 +1,5 @@
 #include "string.hpp"
+#include "gc.hpp"
 
 namespace sting {
 
@@ -12,8 +13,18 @@ void string::copy(u8* dest, const u8* src, const u64 size) const {
         dest[i] = src[i];
 }
 
-string::string() : _data(nullptr), _size(0) {}
+void string::rehash() {
+    u64 hash = DEFAULT_FNV_OFFSET;
+    for (u64 i{}; i < _size; i++) {
+        hash ^= _data[i];
+        hash *= DEFAULT_FNV_PRIME;
+    }
+    _hash = hash;
+}
+
+string::string() : _data(nullptr), _size(0), _hash(DEFAULT_FNV_OFFSET) {}
 
+// contents are left for the caller to fill in, and rehash.
 string::string(u64 size) : string() {
     _size = size;
     allocate_size();
@@ -23,11 +34,12 @@ string::string(const u8* other) : string() {
     _size = strlen(other);
     allocate_size();
     copy(_data, other, _size);
+    rehash();
 }
 
 string::string(const u8* other, u64 size) : string(size) {
-    allocate_size();
     copy(_data, other, size);
+    rehash();
 }
 
 string::~string() {
@@ -35,7 +47,7 @@ string::~string() {
     _data = nullptr;
 }
 
-string::string(const string& other) : _size(other._size), _data(nullptr) {
+string::string(const string& other) : object(), _data(nullptr), _size(other._size), _hash(other._hash) {
     allocate_size();
     copy(_data, other._data, _size);
 }
@@ -43,11 +55,13 @@ string::string(const string& other) : _size(other._size), _data(nullptr) {
 string::string(string&& other) {
     _size = exchange(other._size, 0);
     _data = exchange(other._data, nullptr);
+    _hash = exchange(other._hash, DEFAULT_FNV_OFFSET);
 }
 
 string& string::operator=(const string& other) {
     if (this != &other) {
         _size = other._size;
+        _hash = other._hash;
         allocate_size();
         copy(_data, other._data, other.size());
     }
@@ -59,14 +73,23 @@ string& string::operator=(string&& other) {
         free(_data);
         _size = exchange(other._size, 0);
         _data = exchange(other._data, nullptr);
+        _hash = exchange(other._hash, DEFAULT_FNV_OFFSET);
     }
     return *this;
 }
 
+// strings on the heap are interned, cloning one gives back the canonical
+// string with the same contents.
 object* string::clone() const {
-    object *str = new string(*this);
-    object_list.push_back(str);
-    return str;
+    return interned_strings.intern(*this);
+}
+
+object* string::relocate() {
+    return new string(stealable(*this));
+}
+
+u64 string::footprint() const {
+    return sizeof(string) + _size;
 }
 
 u8* string::cstr() const {
@@ -84,6 +107,7 @@ string string::operator+(const string& other) const {
     string concat(_size + other.size());
     copy(concat._data, _data, _size);
     copy(concat._data + _size, other.data(), other.size());
+    concat.rehash();
     return concat;
 }
 
@@ -94,6 +118,7 @@ void string::operator+=(const string& other) {
 
     _size = exchange(concat._size, _size);
     _data = exchange(concat._data, _data);
+    rehash();
 }
 
 bool string::operator==(const string& other) {
@@ -104,14 +129,13 @@ bool string::operator!=(const string& other) {
     return !this->compare(other);
 }
 
+// interned strings can just compare pointers, this is for the rest.
 bool string::compare(const string& other) const {
-    if (this->size() != other.size())
+    if (this == &other)
+        return true;
+    if (this->size() != other.size() || this->hash() != other.hash())
         return false;
-    for (u64 i{}; i < this->size(); i++) {
-        if (this->at(i) != other.at(i))
-            return false;
-    }
-    return true;
+    return memcmp(_data, other._data, _size) == 0;
 }
 
 std::ostream& operator<<(std::ostream& os, const string& str) {
@@ -123,12 +147,140 @@ std::ostream& operator<<(std::ostream& os, const string& str) {
 
 template <>
 u64 fnv_1a_hash(const string& key) {
-    u64 hash = DEFAULT_FNV_OFFSET;
-    for (u64 i{}; i < key.size(); i++) {
-        hash ^= key.at(i);
-        hash *= DEFAULT_FNV_PRIME;
+    return key.hash();
+}
+
+// interned strings as keys, hashed by contents so it survives the
+// collector moving them.
+template <>
+u64 fnv_1a_hash(string* const& key) {
+    return key->hash();
+}
+
+string* const intern_table::TOMBSTONE = reinterpret_cast<string*>(1);
+
+const u64 INTERN_TABLE_CAPACITY = 256;
+
+intern_table::intern_table() :
+    _slots(static_cast<string**>(calloc(INTERN_TABLE_CAPACITY, sizeof(string*)))),
+    _capacity(INTERN_TABLE_CAPACITY),
+    _size(0),
+    _used(0),
+    _young()
+{}
+
+intern_table::~intern_table() {
+    free(_slots);
+}
+
+string* intern_table::find(const string& str) const {
+    const u64 mask = _capacity - 1;
+    for (u64 i = str.hash() & mask;; i = (i + 1) & mask) {
+        string* s = _slots[i];
+        if (s == nullptr)
+            return nullptr;
+        if (s != TOMBSTONE && s->compare(str))
+            return s;
     }
-    return hash;
+}
+
+// the slot holding exactly this string, which must be in the table.
+u64 intern_table::slot_of(const string* str, u64 hash) const {
+    const u64 mask = _capacity - 1;
+    for (u64 i = hash & mask;; i = (i + 1) & mask) {
+        panic_if(_slots[i] == nullptr, "intern_table: string is not interned");
+        if (_slots[i] == str)
+            return i;
+    }
+}
+
+void intern_table::insert(string* str) {
+    if ((_used + 1) * 2 > _capacity)
+        grow();
+
+    const u64 mask = _capacity - 1;
+    u64 i = str->hash() & mask;
+    while (_slots[i] != nullptr && _slots[i] != TOMBSTONE)
+        i = (i + 1) & mask;
+
+    if (_slots[i] == nullptr)
+        _used++;
+    _slots[i] = str;
+    _size++;
+
+    if (gc.is_young(str))
+        _young.push_back(str);
+}
+
+// doubles unless it's mostly tombstones, which get dropped either way.
+void intern_table::grow() {
+    string** old = _slots;
+    const u64 old_capacity = _capacity;
+    if (_size * 4 >= _capacity)
+        _capacity *= 2;
+
+    _slots = static_cast<string**>(calloc(_capacity, sizeof(string*)));
+    _used = _size;
+    const u64 mask = _capacity - 1;
+    for (u64 i{}; i < old_capacity; i++) {
+        string* s = old[i];
+        if (s == nullptr || s == TOMBSTONE)
+            continue;
+        u64 j = s->hash() & mask;
+        while (_slots[j] != nullptr)
+            j = (j + 1) & mask;
+        _slots[j] = s;
+    }
+    free(old);
+}
+
+string* intern_table::intern(const string& str) {
+    if (string* s = find(str))
+        return s;
+    string* s = gc.make<string>(str);
+    insert(s);
+    return s;
+}
+
+string* intern_table::intern(string&& str) {
+    if (string* s = find(str))
+        return s;
+    string* s = gc.make<string>(stealable(str));
+    insert(s);
+    return s;
+}
+
+// a promoted nursery object holds its new address in gc_next, and the
+// contents (and hash) got moved out of the nursery copy.
+void intern_table::sweep_young() {
+    for (u64 i{}; i < _young.size(); i++) {
+        string* s = _young.data()[i];
+        string* promoted = static_cast<string*>(s->gc_next);
+        if (promoted != nullptr) {
+            _slots[slot_of(s, promoted->hash())] = promoted;
+        } else {
+            _slots[slot_of(s, s->hash())] = TOMBSTONE;
+            _size--;
+        }
+    }
+    _young = dynarray<string*>();
+}
+
+void intern_table::sweep_old() {
+    for (u64 i{}; i < _capacity; i++) {
+        string* s = _slots[i];
+        if (s != nullptr && s != TOMBSTONE && !s->gc_marked) {
+            _slots[i] = TOMBSTONE;
+            _size--;
+        }
+    }
+}
+
+void intern_table::clear() {
+    memset(_slots, 0, _capacity * sizeof(string*));
+    _size = 0;
+    _used = 0;
+    _young = dynarray<string*>();
 }
 
 };
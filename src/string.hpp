@@ -19,7 +19,9 @@ public:
     ~string();
 
     object *clone() const override;
+    object *relocate() override;
     u8* cstr() const override;
+    u64 footprint() const override;
 
     u8 at (u64 index) const;
     bool compare(const string& other) const;
@@ -28,6 +30,7 @@ public:
     bool operator==(const string& other);
     bool operator!=(const string& other);
     u64 size() const { return _size; }
+    u64 hash() const { return _hash; }
     u8 *data() const { return _data; } // not good that it's const.
 
     friend std::ostream& operator<<(std::ostream& os, const string& str);
@@ -35,10 +38,58 @@ public:
 private:
     void allocate_size();
     void copy(u8* dest, const u8* src, const u64 size) const;
+    void rehash();
     u8 *_data;
     u64 _size;
+    u64 _hash; // fnv-1a of the contents, kept up to date by every mutation
 };
 
+/*
+ *  Intern table.
+ *
+ *  every string that ends up in a value goes through here (string::clone
+ *  interns), so there is exactly one heap string per contents and strings
+ *  can be compared by pointer. interned strings must never be mutated.
+ *
+ *  the table is weak: it does not keep its strings alive. the collector
+ *  calls sweep_young() after tracing a minor collection, to follow the
+ *  strings that got promoted and drop the ones that didn't, and
+ *  sweep_old() before the sweep of a major collection.
+ *
+ *  open addressing, linear probing, power of two capacity.
+ */
+class intern_table {
+public:
+    intern_table();
+    ~intern_table();
+    intern_table(const intern_table&) = delete;
+    intern_table& operator=(const intern_table&) = delete;
+
+    string* intern(const string& str);
+    string* intern(string&& str);
+
+    void sweep_young();
+    void sweep_old();
+    void clear();
+    u64 size() const { return _size; }
+
+private:
+    static string* const TOMBSTONE;
+
+    string* find(const string& str) const;
+    void insert(string* str);
+    u64 slot_of(const string* str, u64 hash) const;
+    void grow();
+
+    string** _slots;
+    u64 _capacity;
+    u64 _size;
+    u64 _used; // live entries and tombstones
+    dynarray<string*> _young; // interned strings still in the nursery
+};
+
+extern intern_table interned_strings;
+
 
 } // namespace sting
 
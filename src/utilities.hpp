@@ -38,14 +38,11 @@ inline void panic(const std::string& msg, const i32 code = -1) {
 }
 
 inline std::string read_file(const std::filesystem::path& path) {
-    std::ifstream f(path);
+    std::ifstream f(path, std::ios::binary);
 
-    const u64 size = std::filesystem::file_size(path);
-    u8* data = (u8*)malloc(size * sizeof(u8*));
-
-    f.read(data, size);
-    std::string str(data, size);
-    free(data);
+    std::string str(std::filesystem::file_size(path), '\0');
+    f.read(str.data(), str.size());
+    str.resize(f.gcount());
     return str;
 }
 
@@ -3,108 +3,102 @@
 
 namespace sting {
 
-value::value() {
-    type = vtype::NIL;
-    f = 0;
-}
-
-value::value(f32 f) {
-    type = vtype::NUMBER;
-    this->f = f;
-}
-
-value::value(u8 b) {
-    type = vtype::BOOLEAN;
-    this->b = b;
-}
+value::value(object const* o, vtype t) : value(heap_object(o->clone(), t)) {}
 
-value::value(object const* o, vtype t) {
-    type = t;
-    this->o = o->clone();
+value value::heap_object(object* o, vtype t) {
+    value v;
+#ifdef STING_NAN_BOXING
+    const u64 ptr = reinterpret_cast<u64>(o);
+    panic_if((ptr & ~POINTER_MASK) != 0, "value: object pointer does not fit in 48 bits");
+    v.bits = SIGN_BIT | QNAN |
+             (static_cast<u64>(t) - static_cast<u64>(vtype::STRING)) << OBJECT_TYPE_SHIFT |
+             ptr;
+#else
+    v._type = t;
+    v.o = o;
+#endif
+    return v;
 }
 
-value::~value() {
-    // this->o gets added to object_list via clone.
+value value::concat(const value& a, const value& b) {
+    string c = *static_cast<string*>(a.obj()) + *static_cast<string*>(b.obj());
+    return value(static_cast<object*>(&c), vtype::STRING);
 }
 
-value value::operator+(const value& other) const {
+value value::add(const value& other) const {
     check_type(*this, other);
-    if (this->type != vtype::NUMBER && this->type != vtype::STRING) {
+    if (this->type() != vtype::NUMBER && this->type() != vtype::STRING) {
         panic("Type error: cannot add type");
     }
 
-    if (this->type == vtype::NUMBER) {
+    if (this->type() == vtype::NUMBER) {
         return value(static_cast<f32>(this->number() + other.number()));
-    } else if (this->type == vtype::STRING) {
-        const string b = *static_cast<string*>(this->obj());
-        const string a = *static_cast<string*>(other.obj());
-        string c = a + b; // TODO: remove copy
-        return value(static_cast<object*>(&c), vtype::STRING);
+    } else if (this->type() == vtype::STRING) {
+        return concat(other, *this);
     } else {
         panic("Type error: unknown type.");
     }
     return value();
 }
 
-value value::operator-(const value& other) const {
+value value::subtract(const value& other) const {
     check_type(*this, other);
-    if (this->type != vtype::NUMBER || other.type != vtype::NUMBER) {
+    if (this->type() != vtype::NUMBER || other.type() != vtype::NUMBER) {
         panic("Type error: cannot subtract non-number type");
     }
     return value(static_cast<f32>(this->number() - other.number()));
 }
 
-value value::operator*(const value& other) const {
+value value::multiply(const value& other) const {
     check_type(*this, other);
-    if (this->type != vtype::NUMBER || other.type != vtype::NUMBER) {
+    if (this->type() != vtype::NUMBER || other.type() != vtype::NUMBER) {
         panic("Type error: cannot multiply non-number type");
     }
     return value(static_cast<f32>(this->number() * other.number()));
 }
 
-value value::operator/(const value& other) const {
+value value::divide(const value& other) const {
     check_type(*this, other);
-    if (this->type != vtype::NUMBER || other.type != vtype::NUMBER) {
+    if (this->type() != vtype::NUMBER || other.type() != vtype::NUMBER) {
         panic("Type error: cannot divide non-number type");
     }
     return value(static_cast<f32>(this->number() / other.number()));
 }
 
-value value::operator!() const {
-    if (this->type != vtype::BOOLEAN) {
+value value::logical_not() const {
+    if (this->type() != vtype::BOOLEAN) {
         panic("Type error: cannot logical-not non-boolean type");
     }
-    return value(static_cast<u8>(this->b ^ 0x1));
+    return value(static_cast<u8>(this->byte() ^ 0x1));
 }
 
-value value::operator-() const {
-    if (this->type != vtype::NUMBER) {
+value value::negate() const {
+    if (this->type() != vtype::NUMBER) {
         panic("Type error: cannot negate non-number type");
     }
-    return value(static_cast<f32>(-this->f));
+    return value(static_cast<f32>(-this->number()));
 }
 
-value value::operator==(const value& other) const {
+value value::equal(const value& other) const {
     check_type(*this, other);
 
-    switch(this->type) {
+    switch(this->type()) {
         case vtype::NIL: {
-            if (other.type == vtype::NIL) {
+            if (other.type() == vtype::NIL) {
                 return value(static_cast<u8>(true));
             } else {
                 return value(static_cast<u8>(false));
             }
         }
         case vtype::BOOLEAN: {
-            return value(static_cast<u8>(this->b == other.b));
+            return value(static_cast<u8>(this->byte() == other.byte()));
         }
         case vtype::NUMBER: {
-            return value(static_cast<u8>(this->f == other.f));
+            return value(static_cast<u8>(this->number() == other.number()));
         }
         case vtype::STRING: {
-            string* b = static_cast<string*>(this->o);
-            string* a = static_cast<string*>(other.o);
-            return value(static_cast<u8>(*a == *b));
+            // interned, same contents means same string.
+            return value(static_cast<u8>(this->obj() == other.obj()));
         }
         default:
             panic("Type error: cannot compare this type");
@@ -113,30 +107,30 @@ value value::operator==(const value& other) const {
     return value();
 }
 
-value value::operator>(const value& other) const {
+value value::greater(const value& other) const {
     check_type(*this, other);
-    if (this->type == vtype::NIL) {
+    if (this->type() == vtype::NIL) {
         panic("Type error: > not supported for nil type");
-    } else if (this->type == vtype::BOOLEAN) {
-        return value(static_cast<u8>(this->b > other.b));
+    } else if (this->type() == vtype::BOOLEAN) {
+        return value(static_cast<u8>(this->byte() > other.byte()));
     }
-    return value(static_cast<u8>(this->f > other.f));
+    return value(static_cast<u8>(this->number() > other.number()));
 }
 
-value value::operator<(const value& other) const {
+value value::less(const value& other) const {
     check_type(*this, other);
-    if (this->type == vtype::NIL) {
+    if (this->type() == vtype::NIL) {
         panic("Type error: > not supported for nil type");
-    } else if (this->type == vtype::BOOLEAN) {
-        return value(static_cast<u8>(this->b < other.b));
+    } else if (this->type() == vtype::BOOLEAN) {
+        return value(static_cast<u8>(this->byte() < other.byte()));
     }
-    return value(static_cast<u8>(this->f < other.f));
+    return value(static_cast<u8>(this->number() < other.number()));
 }
 
 std::ostream& operator<<(std::ostream& os, const value& v) {
-    switch (v.type) {
+    switch (v.type()) {
         case vtype::BOOLEAN: {
-            os << (v.b ? "true" : "false");
+            os << (v.byte() ? "true" : "false");
             break;
         }
         case vtype::NIL: {
@@ -144,14 +138,14 @@ std::ostream& operator<<(std::ostream& os, const value& v) {
             break;
         }
         case vtype::NUMBER: {
-            os << v.f;
+            os << v.number();
             break;
         }
         case vtype::STRING:
         case vtype::NATIVE_FUNCTION:
         case vtype::FUNCTION:
         case vtype::CLOSURE: {
-            u8* s = v.o->cstr();
+            u8* s = v.obj()->cstr();
             os << s;
             free(s);
             break;
@@ -165,8 +159,8 @@ std::ostream& operator<<(std::ostream& os, const value& v) {
 }
 
 void check_type(const value &a, const value &b) {
-    if (a.type == vtype::NIL || b.type == vtype::NIL) return;
-    panic_if(a.type != b.type, "Type Error", -1);
+    if (a.type() == vtype::NIL || b.type() == vtype::NIL) return;
+    panic_if(a.type() != b.type(), "Type Error", -1);
 }
 
 } // namespace sting
@@ -1,6 +1,8 @@
 #ifndef VALUE_HPP
 #define VALUE_HPP
 
+#include <type_traits>
+
 #include "utilities.hpp"
 #include "object.hpp"
 
@@ -16,14 +18,41 @@ enum class vtype {
     CLOSURE,
 };
 
-class value : public object {
+/*
+ *  values are plain data, copying one never copies the object it points to.
+ *
+ *  with -DSTING_NAN_BOXING a value is a single 64 bit word. numbers are
+ *  stored as doubles (always holding an f32), everything else lives in the
+ *  payload of a quiet NaN:
+ *
+ *    nil, false, true:  QNAN | 1, 2, 3
+ *    objects:           SIGN | QNAN | (vtype - STRING) << 48 | pointer
+ *
+ *  otherwise it is a tag + union.
+ */
+class value {
 public:
     value();
     value(f32 f);
     value(u8 b);
-    value(object const* o, vtype t);
-    // TODO: implement copy+move.
-    ~value();
+    value(object const* o, vtype t); // clones o onto the heap
+    // wrap an object that is already on the heap, without cloning.
+    static value heap_object(object* o, vtype t);
+    // a new string with a's characters, then b's. both must be strings.
+    static value concat(const value& a, const value& b);
+
+    vtype type() const;
+    bool is_nil() const;
+    bool is_bool() const;
+    bool is_number() const;
+    bool is_object() const;
+
+    f32 number() const; // 0 for nil
+    u8 byte() const;
+    object* obj() const;
+    // point an object value at o instead, without cloning. for the
+    // collector, when it moves the object.
+    void retarget(object* o);
 
     value operator+(const value& other) const;
     value operator-(const value& other) const;
@@ -35,29 +64,182 @@ public:
     value operator>(const value& other) const;
     value operator<(const value& other) const;
 
-    f32 number() const { return f; }
-    u8 byte() const { return b; }
-    object* obj() const { return o; }
+    friend void check_type(const value& a, const value& b);
+    friend std::ostream& operator<<(std::ostream& os, const value& v);
+private:
+    // type checked versions of the operators, for anything that isn't the
+    // number/number (or boolean) fast path.
+    value add(const value& other) const;
+    value subtract(const value& other) const;
+    value multiply(const value& other) const;
+    value divide(const value& other) const;
+    value logical_not() const;
+    value negate() const;
+    value equal(const value& other) const;
+    value greater(const value& other) const;
+    value less(const value& other) const;
 
-    u8 * cstr() const override { return strdup("<value>"); }
-    object * clone () const override {
-        object * v = new value(*this);
-        object_list.push_back(v);
-        return v;
+#ifdef STING_NAN_BOXING
+    static constexpr u64 SIGN_BIT = 0x8000000000000000;
+    static constexpr u64 QNAN = 0x7ffc000000000000;
+    static constexpr u64 CANONICAL_NAN = 0x7ff8000000000000;
+    static constexpr u64 TAG_NIL = 1;
+    static constexpr u64 TAG_FALSE = 2;
+    static constexpr u64 TAG_TRUE = 3;
+    static constexpr u64 OBJECT_TYPE_SHIFT = 48;
+    static constexpr u64 POINTER_MASK = (1ull << OBJECT_TYPE_SHIFT) - 1;
+
+    f32 as_number() const {
+        f64 d;
+        memcpy(&d, &bits, sizeof(d));
+        return static_cast<f32>(d);
     }
 
-    vtype type;
+    u64 bits;
+#else
+    f32 as_number() const { return f; }
 
-    friend void check_type(const value& a, const value& b);
-    friend std::ostream& operator<<(std::ostream& os, const value& v);
-private:
+    vtype _type;
     union {
         f32 f;
         u8 b;
         object* o;
     };
+#endif
 };
 
+#ifdef STING_NAN_BOXING
+
+inline value::value() : bits(QNAN | TAG_NIL) {}
+
+inline value::value(f32 f) {
+    const f64 d = f;
+    if (d != d) {
+        // keep NaN payloads out of the tag space, but keep the sign.
+        bits = CANONICAL_NAN | (std::signbit(d) ? SIGN_BIT : 0);
+    } else {
+        memcpy(&bits, &d, sizeof(bits));
+    }
+}
+
+inline value::value(u8 b) : bits(QNAN | (b ? TAG_TRUE : TAG_FALSE)) {}
+
+inline bool value::is_nil() const { return bits == (QNAN | TAG_NIL); }
+inline bool value::is_bool() const { return (bits | 1) == (QNAN | TAG_TRUE); }
+inline bool value::is_number() const { return (bits & QNAN) != QNAN; }
+inline bool value::is_object() const { return (bits & (SIGN_BIT | QNAN)) == (SIGN_BIT | QNAN); }
+
+inline vtype value::type() const {
+    if (is_number()) return vtype::NUMBER;
+    if (is_object()) {
+        return static_cast<vtype>(static_cast<u64>(vtype::STRING) +
+                                  ((bits >> OBJECT_TYPE_SHIFT) & 0x3));
+    }
+    return is_nil() ? vtype::NIL : vtype::BOOLEAN;
+}
+
+inline f32 value::number() const { return is_number() ? as_number() : 0.0f; }
+
+inline u8 value::byte() const {
+    if (is_bool()) return static_cast<u8>(bits & 1);
+    if (is_number()) {
+        // low byte of the f32, same as reading the union.
+        const f32 f = as_number();
+        u8 b;
+        memcpy(&b, &f, sizeof(b));
+        return b;
+    }
+    if (is_object()) return static_cast<u8>(bits & 0xff);
+    return 0;
+}
+
+inline object* value::obj() const {
+    return is_object() ? reinterpret_cast<object*>(bits & POINTER_MASK) : nullptr;
+}
+
+inline void value::retarget(object* o) {
+    bits = (bits & ~POINTER_MASK) | reinterpret_cast<u64>(o);
+}
+
+static_assert(sizeof(value) == sizeof(u64), "nan boxed value must be one word");
+
+#else
+
+inline value::value() : _type(vtype::NIL), o(nullptr) {}
+inline value::value(f32 f) : _type(vtype::NUMBER), o(nullptr) { this->f = f; }
+inline value::value(u8 b) : _type(vtype::BOOLEAN), o(nullptr) { this->b = b; }
+
+inline vtype value::type() const { return _type; }
+inline bool value::is_nil() const { return _type == vtype::NIL; }
+inline bool value::is_bool() const { return _type == vtype::BOOLEAN; }
+inline bool value::is_number() const { return _type == vtype::NUMBER; }
+inline bool value::is_object() const { return _type > vtype::NUMBER; }
+
+inline f32 value::number() const { return f; }
+inline u8 value::byte() const { return b; }
+inline object* value::obj() const { return o; }
+inline void value::retarget(object* o) { this->o = o; }
+
+#endif
+
+static_assert(std::is_trivially_copyable<value>::value, "value must stay plain data");
+
+// fast paths, both operands numbers (or a boolean for !). anything else
+// goes through the type checked out of line version.
+
+inline value value::operator+(const value& other) const {
+    if (is_number() && other.is_number())
+        return value(static_cast<f32>(as_number() + other.as_number()));
+    return add(other);
+}
+
+inline value value::operator-(const value& other) const {
+    if (is_number() && other.is_number())
+        return value(static_cast<f32>(as_number() - other.as_number()));
+    return subtract(other);
+}
+
+inline value value::operator*(const value& other) const {
+    if (is_number() && other.is_number())
+        return value(static_cast<f32>(as_number() * other.as_number()));
+    return multiply(other);
+}
+
+inline value value::operator/(const value& other) const {
+    if (is_number() && other.is_number())
+        return value(static_cast<f32>(as_number() / other.as_number()));
+    return divide(other);
+}
+
+inline value value::operator!() const {
+    if (is_bool())
+        return value(static_cast<u8>(byte() ^ 0x1));
+    return logical_not();
+}
+
+inline value value::operator-() const {
+    if (is_number())
+        return value(static_cast<f32>(-as_number()));
+    return negate();
+}
+
+inline value value::operator==(const value& other) const {
+    if (is_number() && other.is_number())
+        return value(static_cast<u8>(as_number() == other.as_number()));
+    return equal(other);
+}
+
+inline value value::operator>(const value& other) const {
+    if (is_number() && other.is_number())
+        return value(static_cast<u8>(as_number() > other.as_number()));
+    return greater(other);
+}
+
+inline value value::operator<(const value& other) const {
+    if (is_number() && other.is_number())
+        return value(static_cast<u8>(as_number() < other.as_number()));
+    return less(other);
+}
 
 } // namespace sting
 
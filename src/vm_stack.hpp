@@ -0,0 +1,65 @@
+#ifndef VM_STACK_HPP
+#define VM_STACK_HPP
+
+#include <type_traits>
+
+#include "utilities.hpp"
+
+namespace sting {
+
+/*
+ *  Fixed capacity stack for the vm (values and call frames).
+ *
+ *  one region allocated up front that never moves, so pointers into it
+ *  stay valid for the whole run. push/pop are a raw pointer bump with no
+ *  checks: the vm makes sure there is room with has_room() once per call,
+ *  using the callee's worst case stack use (chunk::max_stack).
+ */
+template <typename T>
+class vm_stack {
+    static_assert(std::is_trivially_copyable<T>::value, "vm_stack is for plain data");
+public:
+    vm_stack(u64 capacity) :
+        _data(static_cast<T*>(calloc(capacity, sizeof(T)))),
+        _top(_data),
+        _end(_data + capacity)
+    {
+        panic_if(_data == nullptr, "vm_stack: could not allocate the stack");
+    }
+
+    vm_stack(const vm_stack&) = delete;
+    vm_stack& operator=(const vm_stack&) = delete;
+
+    ~vm_stack() { free(_data); }
+
+    void push_back(const T& x) { *_top++ = x; }
+    T pop_back() { return *--_top; }
+    T& back() const { return _top[-1]; }
+    T& back(u64 from_top) const { return _top[-1 - static_cast<i64>(from_top)]; }
+
+    // drop everything above size
+    void truncate(u64 size) { _top = _data + size; }
+    // grow or shrink to size, slots it grows into are reset to T().
+    void resize(u64 size) {
+        while (_top < _data + size) *_top++ = T();
+        _top = _data + size;
+    }
+    bool has_room(u64 count) const { return count <= static_cast<u64>(_end - _top); }
+
+    // jit code keeps the top in a register, and hands it back on exit.
+    T* top() const { return _top; }
+    void set_top(T* top) { _top = top; }
+
+    u64 size() const { return _top - _data; }
+    u64 capacity() const { return _end - _data; }
+    T* data() const { return _data; }
+
+private:
+    T* _data;
+    T* _top; // first free slot
+    T* _end;
+};
+
+} // namespace sting
+
+#endif
@@ -8,6 +8,8 @@ std::string opcode_to_string(opcode op) {
             return "RETURN";
         case opcode::LOAD_CONST:
             return "CONST";
+        case opcode::LOAD_CONST_LONG:
+            return "CONST LONG";
         case opcode::NEGATE:
             return "NEGATE";
         case opcode::NOT:
@@ -44,6 +46,10 @@ std::string opcode_to_string(opcode op) {
             return "GET GLOBAL";
         case opcode::SET_GLOBAL:
             return "SET GLOBAL";
+        case opcode::GET_GLOBAL_CHECKED:
+            return "GET GLOBAL (checked)";
+        case opcode::SET_GLOBAL_CHECKED:
+            return "SET GLOBAL (checked)";
         case opcode::GET_LOCAL:
             return "GET LOCAL";
         case opcode::SET_LOCAL:
@@ -68,6 +74,84 @@ std::string opcode_to_string(opcode op) {
             return "SAVE VALUE";
         case opcode::LOAD_VALUE:
             return "LOAD VALUE";
+        case opcode::POPN_LONG:
+            return "POP N LONG";
+        case opcode::GET_LOCAL_LONG:
+            return "GET LOCAL LONG";
+        case opcode::SET_LOCAL_LONG:
+            return "SET LOCAL LONG";
+        case opcode::BRANCH_FALSE_LONG:
+            return "BRANCH (if false) LONG";
+        case opcode::BRANCH_LONG:
+            return "BRANCH LONG";
+        case opcode::LOOP_LONG:
+            return "LOOP LONG";
+        case opcode::CALL_LONG:
+            return "CALL LONG";
+        case opcode::MAKE_CLOSURE_LONG:
+            return "MAKE CLOSURE LONG";
+        case opcode::GET_UPVALUE_LONG:
+            return "GET UPVALUE LONG";
+        case opcode::SET_UPVALUE_LONG:
+            return "SET UPVALUE LONG";
+        case opcode::GET_LOCALS:
+            return "GET LOCALS";
+        case opcode::GET_LOCAL_CONST:
+            return "GET LOCAL, CONST";
+        case opcode::ADD_LOCAL_CONST:
+            return "ADD CONST TO LOCAL";
+        case opcode::SET_LOCAL_POP:
+            return "SET LOCAL, POP";
+        case opcode::SET_GLOBAL_POP:
+            return "SET GLOBAL, POP";
+        case opcode::CALL_LOCAL:
+            return "CALL LOCAL";
+        case opcode::CALL_GLOBAL:
+            return "CALL GLOBAL";
+        case opcode::POP_BRANCH_FALSE:
+            return "POP, BRANCH (if false)";
+        case opcode::LESS_BRANCH_FALSE:
+            return "BRANCH (if not less)";
+        case opcode::LESS_BRANCH_TRUE:
+            return "BRANCH (if less)";
+        case opcode::GREATER_BRANCH_FALSE:
+            return "BRANCH (if not greater)";
+        case opcode::GREATER_BRANCH_TRUE:
+            return "BRANCH (if greater)";
+        case opcode::EQUAL_BRANCH_FALSE:
+            return "BRANCH (if not equal)";
+        case opcode::EQUAL_BRANCH_TRUE:
+            return "BRANCH (if equal)";
+        case opcode::ADD_NUMBERS:
+            return "ADD (num)";
+        case opcode::ADD_STRINGS:
+            return "ADD (str)";
+        case opcode::SUBTRACT_NUMBERS:
+            return "SUBTRACT (num)";
+        case opcode::MULTIPLY_NUMBERS:
+            return "MULTIPLY (num)";
+        case opcode::DIVIDE_NUMBERS:
+            return "DIVIDE (num)";
+        case opcode::GREATER_NUMBERS:
+            return "GREATER (num)";
+        case opcode::LESS_NUMBERS:
+            return "LESS (num)";
+        case opcode::EQUAL_NUMBERS:
+            return "EQUAL (num)";
+        case opcode::ADD_LOCAL_CONST_NUMBERS:
+            return "ADD CONST TO LOCAL (num)";
+        case opcode::LESS_BRANCH_FALSE_NUMBERS:
+            return "BRANCH (!<, num)";
+        case opcode::LESS_BRANCH_TRUE_NUMBERS:
+            return "BRANCH (<, num)";
+        case opcode::GREATER_BRANCH_FALSE_NUMBERS:
+            return "BRANCH (!>, num)";
+        case opcode::GREATER_BRANCH_TRUE_NUMBERS:
+            return "BRANCH (>, num)";
+        case opcode::EQUAL_BRANCH_FALSE_NUMBERS:
+            return "BRANCH (!=, num)";
+        case opcode::EQUAL_BRANCH_TRUE_NUMBERS:
+            return "BRANCH (==, num)";
         default:
             return "WARNING: UNKNOWN OPCODE";
     }
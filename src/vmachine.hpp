@@ -12,50 +12,98 @@
 #include "function.hpp"
 #include "native_function.hpp"
 #include "closure.hpp"
+#include "gc.hpp"
+#include "vm_stack.hpp"
+#include "profiler.hpp"
+#include "registers.hpp"
+#include "jit.hpp"
+
+// direct threaded dispatch (labels as values) where the compiler has it.
+// build with -DSTING_SWITCH_DISPATCH to get the portable switch loop.
+#if defined(__GNUC__) && !defined(STING_SWITCH_DISPATCH)
+#define STING_COMPUTED_GOTO
+#endif
+
+// recording a trace swaps the dispatch table (see record_step), so there
+// are only traces with computed goto.
+#if defined(STING_JIT) && defined(STING_COMPUTED_GOTO)
+#define STING_TRACE
+#endif
 
 namespace sting {
 
+const u64 DEFAULT_MAX_FRAMES = 1 << 14;   // call depth, STING_MAX_FRAMES
+const u64 DEFAULT_STACK_SIZE = 1 << 18;   // values, STING_STACK_SIZE
+
 enum class vm_result { // just result?
     OK,
     COMPILE_ERROR,
     RUNTIME_ERROR
 };
 
+// frames point at the heap closure they run, calling never copies it.
 struct call_frame {
-    closure c;
-    u64 pc;
+    closure* c;
+    // cached from c, reload() after anything that can move it (the collector).
+    u8 const* code;
+    u32 const* register_code;
+    value const* constants;
+    u64 pc; // in words under run_registers
     u64 bp; // base pointer of function call on value_stack
     // bp is the first value not accessible by the function call.
 
-    call_frame(const closure& c, u64 bp = 0) : c(c), bp(bp), pc(0) {}
-    call_frame(const call_frame& other) : c(other.c), bp(other.bp), pc(other.pc) {}
+    call_frame(closure* c, u64 bp = 0) :
+        c(c), code(nullptr), register_code(nullptr), constants(nullptr), pc(0), bp(bp) {
+        reload();
+    }
+
+    void reload() {
+        code = c->get_chunk().bytecode.data();
+        register_code = c->get_chunk().register_code.data();
+        constants = c->get_chunk().constant_pool.data();
+    }
 };
 
 struct vmachine {
-    vmachine(const function& f) : call_frames(), value_stack(), return_slot(), globals(), open_upvalues(nullptr) {
-        call_frame cf = call_frame(f);
-        call_frames.push_back(cf);
+    vmachine(const function& f, const dynarray<value>& global_names,
+             u64 max_frames = DEFAULT_MAX_FRAMES, u64 stack_size = DEFAULT_STACK_SIZE) :
+        call_frames(max_frames),
+        value_stack(stack_size),
+        return_slot(),
+        globals(),
+        global_defined(),
+        global_names(global_names),
+        open_upvalues(nullptr),
+        young_globals(),
+        globals_dirty(true) // the names are still young
+    {
+        function* script = static_cast<function*>(f.clone());
+        push_frame(gc.make<closure>(script), 0);
+        // sized once, remembered slots point into it.
+        for (u64 i{}; i < global_names.size(); i++) {
+            globals.push_back(value());
+            global_defined.push_back(false);
+        }
+        // the natives' slots, the compiler gave them the first ones.
+        const dynarray<native_function>& natives = native_functions();
+        for (u64 i{}; i < natives.size() && i < globals.size(); i++) {
+            globals.data()[i] = value(static_cast<object const*>(&natives.at(i)), vtype::NATIVE_FUNCTION);
+            global_defined.data()[i] = true;
+        }
     }
 
     void call(const value& callable, const u64 num_args) {
-        switch (callable.type) {
+        switch (callable.type()) {
             case vtype::CLOSURE: {
-                closure c = *static_cast<closure*>(callable.obj());
-                panic_if(c.get_arity() != num_args, "Wrong number of args to function call");
-                call_frame frame(c, value_stack.size() - c.get_arity());
-                call_frames.push_back(frame);
+                closure* c = static_cast<closure*>(callable.obj());
+                panic_if(c->get_arity() != num_args, "Wrong number of args to function call");
+                call_closure(c, num_args);
                 break;
             }
             case vtype::NATIVE_FUNCTION: {
-                // no return, so have to fix the stack here.
-                // pop off args
-                native_function nf = *static_cast<native_function*>(callable.obj());
+                native_function& nf = *static_cast<native_function*>(callable.obj());
                 panic_if(nf.get_arity() != num_args, "Wrong number of args to native function call");
-                dynarray<value> args;
-                for (u64 i = 0; i < num_args; i++) {
-                    args.push_back(value_stack.pop_back()); // reverse order
-                }
-                value_stack.push_back(nf.call(args));
+                call_native(nf, num_args);
                 break;
             }
             default: {
@@ -64,6 +112,50 @@ struct vmachine {
         }
     }
 
+    // call from the running frame's call site, see chunk::call_cache. the
+    // callee the site called last time skips the checks in call.
+    void call_cached(const value& callable, const u64 num_args, const u32 site) {
+        function* caller = call_frames.back().c->get_function();
+        value& cached = caller->get_chunk().call_cache.data()[site];
+        if (callable.is_object() && callable.obj() == cached.obj()) {
+            if (cached.type() == vtype::CLOSURE)
+                call_closure(static_cast<closure*>(cached.obj()), num_args);
+            else
+                call_native(*static_cast<native_function*>(cached.obj()), num_args);
+            return;
+        }
+        call(callable, num_args);
+        cached = callable;
+        gc.write_barrier(caller, cached);
+    }
+
+    void call_closure(closure* c, const u64 num_args) {
+        push_frame(c, value_stack.size() - num_args);
+#ifdef STING_JIT
+        chunk& callee = c->get_chunk();
+        if (callee.jit == nullptr && ++callee.calls == jit_threshold)
+            callee.jit = jit_compile(callee);
+#endif
+    }
+
+    void call_native(native_function& nf, const u64 num_args) {
+        // no return, so have to fix the stack here.
+        // pop off args
+        dynarray<value> args;
+        for (u64 i = 0; i < num_args; i++) {
+            args.push_back(value_stack.pop_back()); // reverse order
+        }
+        value_stack.push_back(nf.call(args));
+    }
+
+    // the only overflow check: after this, nothing the callee does can run
+    // past the end of either stack.
+    void push_frame(closure* c, u64 bp) {
+        panic_if(!call_frames.has_room(1), "Stack overflow: too many nested calls");
+        panic_if(!value_stack.has_room(c->get_chunk().max_stack), "Stack overflow: value stack is full");
+        call_frames.push_back(call_frame(c, bp));
+    }
+
     rtupvalue * capture_value(const u64 value_stack_index) {
         rtupvalue * previous = nullptr;
         rtupvalue * current = open_upvalues;
@@ -77,6 +169,7 @@ struct vmachine {
         }
 
         rtupvalue * uv = rtupvalue::new_upvalue(value_stack_index);
+        uv->next() = current;
         if (previous == nullptr) {
             open_upvalues = uv;
         } else {
@@ -86,61 +179,300 @@ struct vmachine {
         return uv;
     }
 
+    void undefined_global(u32 slot) {
+        std::stringstream errMessage;
+        errMessage << "Undefined global: " << global_names.at(slot);
+        panic(errMessage.str());
+    }
+
+    // write barrier for globals: the table is a root, but a minor collection
+    // only looks at the slots that got a young value since the last one.
+    void remember_global(value& slot) {
+        if (gc.is_young(slot))
+            young_globals.push_back(&slot);
+    }
+
+    // everything the running program can still reach. a minor collection
+    // rewrites the slots of objects it moves out of the nursery.
+    void mark_roots(bool minor) {
+        for (u64 i{}; i < value_stack.size(); i++) {
+            gc.mark_value(value_stack.data()[i]);
+        }
+        for (u64 i{}; i < call_frames.size(); i++) {
+            gc.mark(call_frames.data()[i].c);
+        }
+        if (!minor || globals_dirty) {
+            for (u64 i{}; i < globals.size(); i++) {
+                gc.mark_value(globals.data()[i]);
+                gc.mark_value(global_names.data()[i]);
+            }
+        } else {
+            for (u64 i{}; i < young_globals.size(); i++) {
+                gc.mark_value(*young_globals.data()[i]);
+            }
+        }
+        // the open upvalues are linked through the heap, walk the slots so
+        // each link gets rewritten.
+        for (rtupvalue** uv = &open_upvalues; *uv != nullptr; uv = &(*uv)->next()) {
+            gc.mark(*uv);
+        }
+        gc.mark_value(return_slot);
+    }
+
+    // the nursery is always emptied first, a major collection needs it empty.
+    void collect_garbage() {
+        gc.begin_minor();
+        mark_roots(true);
+        gc.finish_minor();
+        young_globals = dynarray<value*>();
+        globals_dirty = false;
+
+        if (gc.old_full()) {
+            gc.begin_major();
+            mark_roots(false);
+            gc.finish_major();
+        }
+
+        for (u64 i{}; i < call_frames.size(); i++) {
+            call_frames.data()[i].reload();
+        }
+    }
+
+    // from a LOOP, with the frame's pc at the loop's header. true when the
+    // loop's trace ran, then the frames have to be loaded again. otherwise
+    // it counts the iteration, and the recorder may have started.
+    bool hot_loop(call_frame& frame) {
+        if (recorder.active())
+            return false;
+        loop_record& loop = frame.c->get_chunk().loop_at(frame.pc);
+        if (loop.trace != nullptr) {
+            if (jit_run_trace(*this, frame, *loop.trace))
+                return true;
+            // the locals' types changed since the recording, make a new one.
+            loop.trace = nullptr;
+            loop.count = 0;
+        }
+        if (loop.recordings < MAX_TRACE_RECORDINGS && ++loop.count == trace_threshold) {
+            loop.recordings++;
+            recorder.start(*this, frame.pc);
+        }
+        return false;
+    }
+
+    // pc, frame base, the current chunk and the top of the value stack live
+    // in locals between instructions. SAVE_FRAME writes pc back to the frame
+    // and the top back to value_stack, around anything that looks at them:
+    // calls, returns, the collector and the jit. LOAD_FRAME must be used
+    // after anything that pushes to or pops from call_frames, since that
+    // changes the current frame, or that moves the top of the stack.
     vm_result run_chunk() {
-        for (;;) {
-            u64 *const pc = &call_frames.back().pc;
-            instruction const& current = call_frames.back().c.get_chunk().bytecode.at(*pc);
-            call_frames.back().pc++;
-
-            // std::cout << "<" << value_stack.size() << ">" << "\n";
-            // std::cout << opcode_to_string(current.op) << ": ";
-
-            switch(current.op) {
-                case opcode::RETURN: {
-                    if (call_frames.size() == 1) {
-                        // std::cout << "stack size: " << value_stack.size() << "\n";
-                        // for (u64 i = 0; i < value_stack.size(); i++) {
-                        //     std::cout << i << ": " << value_stack.at(i) << "\n";
-                        // }
-                        call_frames.pop_back();
-                        return vm_result::OK;
-                    }
+        call_frame* frame;
+        u8 const* code;
+        value const* constants;
+        u8 const* ip;
+        u64 bp;
+        value* sp; // value_stack's top
+// build with -DSTING_PROFILE to count and time every instruction, the
+// report goes to stderr at exit.
+#ifdef STING_PROFILE
+        chunk_profile* profile;
+#define PROFILE_ENTER() (profile = prof.enter(frame->c->get_chunk()))
+#define PROFILE_STEP() prof.step(profile, ip - code)
+#else
+#define PROFILE_ENTER() ((void)0)
+#define PROFILE_STEP() ((void)0)
+#endif
 
-                    // TODO: should be 1 if not script, else 0. fix this.
-                    const value v = value_stack.pop_back();
-                    for (u64 i = value_stack.size(); i > call_frames.back().bp; i--) {
-                        value_stack.pop_back();
-                    }
-                    value_stack.push_back(v);
+#define LOAD_FRAME()                                                   \
+        do {                                                           \
+            frame = &call_frames.back();                               \
+            code = frame->code;                                        \
+            constants = frame->constants;                              \
+            ip = code + frame->pc;                                     \
+            bp = frame->bp;                                            \
+            sp = value_stack.top();                                    \
+            PROFILE_ENTER();                                           \
+        } while (0)
+#define SAVE_FRAME() (frame->pc = ip - code, value_stack.set_top(sp))
+// only between instructions, once every live value is reachable from a root.
+#define GC_SAFEPOINT()                                                 \
+        do {                                                           \
+            if (gc.should_collect()) {                                 \
+                SAVE_FRAME();                                          \
+                collect_garbage();                                     \
+                LOAD_FRAME();                                          \
+            }                                                          \
+        } while (0)
+// runs the frame's native code if it has some (jit.hpp), up to the next
+// instruction it leaves to us. only after LOAD_FRAME.
+#ifdef STING_JIT
+#define JIT_ENTER()                                                    \
+        do {                                                           \
+            if (frame->c->get_chunk().jit != nullptr) {                \
+                SAVE_FRAME();                                          \
+                jit_run(*this, *frame);                                \
+                LOAD_FRAME();                                          \
+            }                                                          \
+        } while (0)
+#else
+#define JIT_ENTER() ((void)0)
+#endif
+// after a LOOP, see hot_loop. recording sends every instruction through
+// record_step first.
+#ifdef STING_TRACE
+#define TRACE_LOOP()                                                   \
+        do {                                                           \
+            if (trace_threshold != 0) {                                \
+                SAVE_FRAME();                                          \
+                if (hot_loop(*frame)) {                                \
+                    LOAD_FRAME();                                      \
+                    JIT_ENTER();                                       \
+                } else if (recorder.active()) {                        \
+                    for (u64 i{}; i < OPCODE_COUNT; i++)               \
+                        dispatch[i] = &&record_step;                   \
+                }                                                      \
+            }                                                          \
+        } while (0)
+#else
+#define TRACE_LOOP() ((void)0)
+#endif
+// QUICKEN rewrites the running instruction to its quickened form, for the
+// next time it runs. DEOPTIMIZE puts the generic form back and runs that
+// instead. both only before the instruction's operands are read. no
+// do-while around DEOPTIMIZE, VM_NEXT is a continue with switch dispatch.
+#define QUICKEN(op) (const_cast<u8*>(ip)[-1] = static_cast<u8>(opcode::op))
+#define DEOPTIMIZE(op)                                                 \
+        {                                                              \
+            QUICKEN(op);                                               \
+            ip--;                                                      \
+            VM_NEXT();                                                 \
+        }
+#define BOTH_NUMBERS(a, b) ((a).is_number() && (b).is_number())
+#define PUSH(v) (*sp++ = (v))
+#define POP() (*--sp)
+#define PEEK(n) (sp[-1 - (n)])
+#define NUMBERS_ON_TOP() BOTH_NUMBERS(PEEK(1), PEEK(0))
+#define BOTH_STRINGS(a, b) ((a).type() == vtype::STRING && (b).type() == vtype::STRING)
+#define READ_BYTE() (ip += 1, read_operand(ip - 1, 1))
+#define READ_SHORT() (ip += 2, read_operand(ip - 2, 2))
+#define READ_WORD() (ip += 4, read_operand(ip - 4, 4))
+
+#ifdef STING_COMPUTED_GOTO
+        // must be in the same order as opcode.
+        static void* const dispatch_table[] = {
+            &&op_RETURN, &&op_LOAD_CONST, &&op_LOAD_CONST_LONG, &&op_NEGATE,
+            &&op_NOT, &&op_ADD, &&op_MULTIPLY, &&op_DIVIDE,
+            &&op_SUBTRACT, &&op_TRUE, &&op_FALSE, &&op_NIL,
+            &&op_GREATER, &&op_LESS, &&op_EQUAL, &&op_PRINT,
+            &&op_POP, &&op_POPN, &&op_DEFINE_GLOBAL, &&op_GET_GLOBAL,
+            &&op_SET_GLOBAL, &&op_GET_GLOBAL_CHECKED, &&op_SET_GLOBAL_CHECKED, &&op_GET_LOCAL,
+            &&op_SET_LOCAL, &&op_BRANCH_FALSE, &&op_BRANCH, &&op_LOOP,
+            &&op_CALL, &&op_MAKE_CLOSURE, &&op_GET_UPVALUE, &&op_SET_UPVALUE,
+            &&op_CLOSE_VALUE, &&op_SAVE_VALUE, &&op_LOAD_VALUE, &&op_POPN_LONG,
+            &&op_GET_LOCAL_LONG, &&op_SET_LOCAL_LONG, &&op_BRANCH_FALSE_LONG, &&op_BRANCH_LONG,
+            &&op_LOOP_LONG, &&op_CALL_LONG, &&op_MAKE_CLOSURE_LONG, &&op_GET_UPVALUE_LONG,
+            &&op_SET_UPVALUE_LONG, &&op_GET_LOCALS, &&op_GET_LOCAL_CONST, &&op_ADD_LOCAL_CONST,
+            &&op_SET_LOCAL_POP, &&op_SET_GLOBAL_POP, &&op_CALL_LOCAL, &&op_CALL_GLOBAL,
+            &&op_POP_BRANCH_FALSE, &&op_LESS_BRANCH_FALSE, &&op_LESS_BRANCH_TRUE, &&op_GREATER_BRANCH_FALSE,
+            &&op_GREATER_BRANCH_TRUE, &&op_EQUAL_BRANCH_FALSE, &&op_EQUAL_BRANCH_TRUE, &&op_ADD_NUMBERS,
+            &&op_ADD_STRINGS, &&op_SUBTRACT_NUMBERS, &&op_MULTIPLY_NUMBERS, &&op_DIVIDE_NUMBERS,
+            &&op_GREATER_NUMBERS, &&op_LESS_NUMBERS, &&op_EQUAL_NUMBERS, &&op_ADD_LOCAL_CONST_NUMBERS,
+            &&op_LESS_BRANCH_FALSE_NUMBERS, &&op_LESS_BRANCH_TRUE_NUMBERS, &&op_GREATER_BRANCH_FALSE_NUMBERS, &&op_GREATER_BRANCH_TRUE_NUMBERS,
+            &&op_EQUAL_BRANCH_FALSE_NUMBERS, &&op_EQUAL_BRANCH_TRUE_NUMBERS,
+        };
+        static_assert(sizeof(dispatch_table) / sizeof(dispatch_table[0]) ==
+                      static_cast<u64>(opcode::OPCODE_COUNT),
+                      "dispatch_table is out of sync with opcode");
+#ifdef STING_TRACE
+        // the table VM_DISPATCH goes through, dispatch_table unless a trace
+        // is being recorded.
+        const u64 OPCODE_COUNT = static_cast<u64>(opcode::OPCODE_COUNT);
+        static void* dispatch[OPCODE_COUNT];
+        memcpy(dispatch, dispatch_table, sizeof(dispatch));
+#else
+        void* const* const dispatch = dispatch_table;
+#endif
+
+#define VM_DISPATCH()                                                  \
+        do {                                                           \
+            PROFILE_STEP();                                            \
+            goto *dispatch[static_cast<uint8_t>(*ip++)];               \
+        } while (0)
+#define VM_LOOP() VM_DISPATCH();
+#define VM_CASE(name) op_##name
+#define VM_NEXT() VM_DISPATCH()
+#else
+#define VM_LOOP() for (;;) switch (PROFILE_STEP(), static_cast<opcode>(*ip++))
+#define VM_CASE(name) case opcode::name
+#define VM_NEXT() continue
+#endif
+
+        LOAD_FRAME();
+        JIT_ENTER();
+
+        VM_LOOP() {
+            VM_CASE(RETURN): {
+                if (call_frames.size() == 1) {
+#ifdef STING_PROFILE
+                    prof.finish();
+#endif
+                    SAVE_FRAME();
                     call_frames.pop_back();
-                    break;
+                    return vm_result::OK;
                 }
 
-                case opcode::CALL: {
-                    // value_stack: arg1, arg2, arg3, fn, {}
-                    // fn gets popped before execution.
-                    const u64 num_args = current.operands.at(0);
-                    const value& callable = value_stack.pop_back();
-                    call(callable, num_args);
-                    break;
-                }
+                const value v = POP();
+                sp = value_stack.data() + bp;
+                PUSH(v);
+                value_stack.set_top(sp);
+                call_frames.pop_back();
+                LOAD_FRAME();
+                JIT_ENTER();
+                VM_NEXT();
+            }
+
+            VM_CASE(CALL): {
+                // value_stack: arg1, arg2, arg3, fn, {}
+                // fn gets popped before execution.
+                const u64 num_args = READ_SHORT();
+                const u32 site = READ_SHORT();
+                const value callable = POP();
+                SAVE_FRAME();
+                call_cached(callable, num_args, site);
+                LOAD_FRAME();
+                JIT_ENTER();
+                VM_NEXT();
+            }
+
+            VM_CASE(CALL_LONG): {
+                const u64 num_args = READ_WORD();
+                const u32 site = READ_WORD();
+                const value callable = POP();
+                SAVE_FRAME();
+                call_cached(callable, num_args, site);
+                LOAD_FRAME();
+                JIT_ENTER();
+                VM_NEXT();
+            }
 
-                case opcode::MAKE_CLOSURE: {
-                    const value& v = value_stack.pop_back();
-                    const vtype type = v.type;
+            VM_CASE(MAKE_CLOSURE_LONG):
+            VM_CASE(MAKE_CLOSURE): {
+                // the computed goto in VM_NEXT leaves this block without running
+                // destructors, so anything that owns memory lives in an inner scope.
+                {
+                    const u64 width = operand_width(static_cast<opcode>(ip[-1]));
+                    const value v = POP();
+                    const vtype type = v.type();
                     panic_if(type != vtype::FUNCTION, "Cannot make closure from non-function");
-                    const function f = *static_cast<function*>(v.obj());
-                    closure c = closure(f);
-                    const u64 num_upvalues = current.operands.at(0);
-                    panic_if((num_upvalues != (current.operands.size() - 1) / 2) &&
-                             (current.operands.size() % 2 == 1),
-                             "num_upvalues does not match number of upvalues passed to MAKE_CLOSURE");
-
-                    dynarray<rtupvalue*>& uv = c.get_upvalues();
-                    const u64 bp = call_frames.back().bp;
+                    closure* c = gc.make<closure>(static_cast<function*>(v.obj()));
+                    const u64 num_upvalues = read_operand(ip, width);
+                    ip += width;
+
+                    dynarray<rtupvalue*>& uv = c->get_upvalues();
                     for (u64 i{}; i < num_upvalues; i++) {
-                        const u32 local = current.operands.at(i * 2 + 1);
-                        const u32 index = current.operands.at(i * 2 + 2);
+                        const u32 local = read_operand(ip, width);
+                        const u32 index = read_operand(ip + width, width);
+                        ip += 2 * width;
                         if (local) {
                             // there is no upvalue for this local, so call capture_value
                             // makes a new upvalue and puts it in the current closure.
@@ -149,262 +481,1054 @@ struct vmachine {
                         } else {
                             // the current frame is guaranteed to have an upvalue pointing
                             // to the data. if it doesn't exist, the compiler or runtime is broken somewhere.
-                            dynarray<rtupvalue*>& prev_uv = call_frames.back().c.get_upvalues();
+                            dynarray<rtupvalue*>& prev_uv = frame->c->get_upvalues();
                             uv.push_back(prev_uv.at(index));
-                            // isn't its location in the upvalues array the index?
                         }
                     }
-                    const value cv = value(static_cast<object*>(c.clone()), vtype::CLOSURE);
-                    value_stack.push_back(cv);
-                    break;
+                    PUSH(value::heap_object(c, vtype::CLOSURE));
                 }
+                GC_SAFEPOINT();
+                VM_NEXT();
+            }
 
-                case opcode::LOAD_CONST: {
-                    u64 index = current.operands.at(0);
-                    const value& val = get_current_chunk().constant_pool.at(index);
-                    value_stack.push_back(val);
-                    break;
-                }
+            VM_CASE(LOAD_CONST): {
+                PUSH(constants[READ_SHORT()]);
+                VM_NEXT();
+            }
 
-                case opcode::NEGATE: {
-                    value a = value_stack.pop_back();
-                    value_stack.push_back(-a);
-                    break;
-                }
+            VM_CASE(LOAD_CONST_LONG): {
+                PUSH(constants[READ_WORD()]);
+                VM_NEXT();
+            }
 
-                case opcode::NOT: {
-                    value a = value_stack.pop_back();
-                    value_stack.push_back(!a);
-                    break;
-                }
+            VM_CASE(NEGATE): {
+                value a = POP();
+                PUSH(-a);
+                VM_NEXT();
+            }
 
-                case opcode::ADD: {
-                    const value b = value_stack.pop_back();
-                    const value a = value_stack.pop_back();
-                    const value c = b + a;
-                    value_stack.push_back(c);
-                    break;
-                }
+            VM_CASE(NOT): {
+                value a = POP();
+                PUSH(!a);
+                VM_NEXT();
+            }
 
-                case opcode::MULTIPLY: {
-                    const value b = value_stack.pop_back();
-                    const value a = value_stack.pop_back();
-                    const value c = a * b;
-                    value_stack.push_back(c);
-                    break;
-                }
+            VM_CASE(ADD): {
+                const value b = POP();
+                const value a = POP();
+                if (BOTH_NUMBERS(a, b)) QUICKEN(ADD_NUMBERS);
+                else if (BOTH_STRINGS(a, b)) QUICKEN(ADD_STRINGS);
+                const value c = b + a;
+                PUSH(c);
+                GC_SAFEPOINT();
+                VM_NEXT();
+            }
 
-                case opcode::DIVIDE: {
-                    const value b = value_stack.pop_back();
-                    const value a = value_stack.pop_back();
-                    const value c = a / b;
-                    value_stack.push_back(c);
-                    break;
-                }
+            VM_CASE(MULTIPLY): {
+                const value b = POP();
+                const value a = POP();
+                if (BOTH_NUMBERS(a, b)) QUICKEN(MULTIPLY_NUMBERS);
+                const value c = a * b;
+                PUSH(c);
+                VM_NEXT();
+            }
 
-                case opcode::SUBTRACT: {
-                    const value b = value_stack.pop_back();
-                    const value a = value_stack.pop_back();
-                    const value c = a - b;
-                    value_stack.push_back(c);
-                    break;
-                }
+            VM_CASE(DIVIDE): {
+                const value b = POP();
+                const value a = POP();
+                if (BOTH_NUMBERS(a, b)) QUICKEN(DIVIDE_NUMBERS);
+                const value c = a / b;
+                PUSH(c);
+                VM_NEXT();
+            }
 
-                case opcode::TRUE: {
-                    const value t = value(static_cast<u8>(true));
-                    value_stack.push_back(t);
-                    break;
-                }
+            VM_CASE(SUBTRACT): {
+                const value b = POP();
+                const value a = POP();
+                if (BOTH_NUMBERS(a, b)) QUICKEN(SUBTRACT_NUMBERS);
+                const value c = a - b;
+                PUSH(c);
+                VM_NEXT();
+            }
 
-                case opcode::FALSE: {
-                    const value t = value(static_cast<u8>(false));
-                    value_stack.push_back(t);
-                    break;
-                }
+            VM_CASE(TRUE): {
+                const value t = value(static_cast<u8>(true));
+                PUSH(t);
+                VM_NEXT();
+            }
 
-                case opcode::NIL: {
-                    value_stack.push_back(value());
-                    break;
-                }
+            VM_CASE(FALSE): {
+                const value t = value(static_cast<u8>(false));
+                PUSH(t);
+                VM_NEXT();
+            }
+
+            VM_CASE(NIL): {
+                PUSH(value());
+                VM_NEXT();
+            }
+
+            VM_CASE(EQUAL): {
+                const value b = POP();
+                const value a = POP();
+                if (BOTH_NUMBERS(a, b)) QUICKEN(EQUAL_NUMBERS);
+                PUSH(a == b);
+                VM_NEXT();
+            }
+
+            VM_CASE(GREATER): {
+                const value b = POP();
+                const value a = POP();
+                if (BOTH_NUMBERS(a, b)) QUICKEN(GREATER_NUMBERS);
+                PUSH(a > b);
+                VM_NEXT();
+            }
+
+            VM_CASE(LESS): {
+                const value b = POP();
+                const value a = POP();
+                if (BOTH_NUMBERS(a, b)) QUICKEN(LESS_NUMBERS);
+                PUSH(a < b);
+                VM_NEXT();
+            }
+
+            VM_CASE(PRINT): {
+                std::cout << POP() << "\n" << std::flush;
+                VM_NEXT();
+            }
+
+            VM_CASE(POP): {
+                sp--;
+                VM_NEXT();
+            }
+
+            VM_CASE(POPN): {
+                const u32 num = READ_BYTE();
+                sp -= num;
+                VM_NEXT();
+            }
+
+            VM_CASE(CLOSE_VALUE): {
+                const u32 value_stack_index = sp - 1 - value_stack.data();
+                rtupvalue * const top = open_upvalues;
+                top->is_closed = true;
 
-                case opcode::EQUAL: {
-                    const value b = value_stack.pop_back();
-                    const value a = value_stack.pop_back();
-                    value_stack.push_back(a == b);
-                    break;
+                panic_if(value_stack_index != top->value_stack_index(), "stack indicies should be identical");
+
+                open_upvalues = open_upvalues->next();
+                top->next() = nullptr;
+
+                top->closed = POP();
+                gc.write_barrier(top, top->closed);
+                VM_NEXT();
+            }
+
+            // the compiler rejects redefinitions, and only emits the
+            // unchecked ops once a global is known to be defined.
+            VM_CASE(DEFINE_GLOBAL): {
+                const u32 slot = READ_WORD();
+                globals.data()[slot] = POP();
+                global_defined.data()[slot] = true;
+                remember_global(globals.data()[slot]);
+                VM_NEXT();
+            }
+
+            VM_CASE(GET_GLOBAL): {
+                PUSH(globals.data()[READ_WORD()]);
+                VM_NEXT();
+            }
+
+            VM_CASE(SET_GLOBAL): {
+                value& slot = globals.data()[READ_WORD()];
+                slot = PEEK(0);
+                remember_global(slot);
+                VM_NEXT();
+            }
+
+            VM_CASE(GET_GLOBAL_CHECKED): {
+                const u32 slot = READ_WORD();
+                if (!global_defined.data()[slot]) undefined_global(slot);
+                PUSH(globals.data()[slot]);
+                VM_NEXT();
+            }
+
+            VM_CASE(SET_GLOBAL_CHECKED): {
+                const u32 slot = READ_WORD();
+                if (!global_defined.data()[slot]) undefined_global(slot);
+                globals.data()[slot] = PEEK(0);
+                remember_global(globals.data()[slot]);
+                VM_NEXT();
+            }
+
+            VM_CASE(GET_LOCAL): {
+                PUSH(value_stack.data()[bp + READ_BYTE()]);
+                VM_NEXT();
+            }
+
+            VM_CASE(SET_LOCAL): {
+                value_stack.data()[bp + READ_BYTE()] = PEEK(0);
+                VM_NEXT();
+            }
+
+            VM_CASE(BRANCH_FALSE): {
+                const u32 increment = READ_SHORT();
+                if (!PEEK(0).byte()) {
+                    ip += increment;
                 }
+                VM_NEXT();
+            }
 
-                case opcode::GREATER: {
-                    const value b = value_stack.pop_back();
-                    const value a = value_stack.pop_back();
-                    value_stack.push_back(a > b);
-                    break;
+            VM_CASE(BRANCH): {
+                const u32 increment = READ_SHORT();
+                ip += increment;
+                VM_NEXT();
+            }
+
+            VM_CASE(LOOP): {
+                const u32 decrement = READ_SHORT();
+                ip -= decrement;
+                TRACE_LOOP();
+                VM_NEXT();
+            }
+
+            VM_CASE(GET_UPVALUE): {
+                rtupvalue const * const uv = frame->c->get_upvalues().data()[READ_BYTE()];
+                if (uv->is_closed) {
+                    PUSH(uv->closed);
+                } else {
+                    PUSH(value_stack.data()[uv->value_stack_index()]);
                 }
+                VM_NEXT();
+            }
 
-                case opcode::LESS: {
-                    const value b = value_stack.pop_back();
-                    const value a = value_stack.pop_back();
-                    value_stack.push_back(a < b);
-                    break;
+            VM_CASE(SET_UPVALUE): {
+                rtupvalue * const uv = frame->c->get_upvalues().data()[READ_BYTE()];
+                if (uv->is_closed) {
+                    uv->closed = PEEK(0);
+                    gc.write_barrier(uv, uv->closed);
+                } else {
+                    value_stack.data()[uv->value_stack_index()] = PEEK(0);
                 }
+                VM_NEXT();
+            }
+
+            VM_CASE(SAVE_VALUE): {
+                return_slot = POP();
+                VM_NEXT();
+            }
+
+            VM_CASE(LOAD_VALUE): {
+                PUSH(return_slot);
+                VM_NEXT();
+            }
+
+            // the wide forms, same as the short ops above with u32 operands.
 
-                case opcode::PRINT: {
-                    std::cout << value_stack.pop_back() << "\n" << std::flush;
-                    break;
+            VM_CASE(POPN_LONG): {
+                const u32 num = READ_WORD();
+                sp -= num;
+                VM_NEXT();
+            }
+
+            VM_CASE(GET_LOCAL_LONG): {
+                PUSH(value_stack.data()[bp + READ_WORD()]);
+                VM_NEXT();
+            }
+
+            VM_CASE(SET_LOCAL_LONG): {
+                value_stack.data()[bp + READ_WORD()] = PEEK(0);
+                VM_NEXT();
+            }
+
+            VM_CASE(BRANCH_FALSE_LONG): {
+                const u32 increment = READ_WORD();
+                if (!PEEK(0).byte()) {
+                    ip += increment;
                 }
+                VM_NEXT();
+            }
 
-                case opcode::POP: {
-                    value_stack.pop_back();
-                    break;
+            VM_CASE(BRANCH_LONG): {
+                const u32 increment = READ_WORD();
+                ip += increment;
+                VM_NEXT();
+            }
+
+            VM_CASE(LOOP_LONG): {
+                const u32 decrement = READ_WORD();
+                ip -= decrement;
+                TRACE_LOOP();
+                VM_NEXT();
+            }
+
+            VM_CASE(GET_UPVALUE_LONG): {
+                rtupvalue const * const uv = frame->c->get_upvalues().data()[READ_WORD()];
+                if (uv->is_closed) {
+                    PUSH(uv->closed);
+                } else {
+                    PUSH(value_stack.data()[uv->value_stack_index()]);
                 }
+                VM_NEXT();
+            }
 
-                case opcode::POPN: {
-                    u32 num = current.operands.at(0);
-                    for (u32 i{}; i < num; i++) {
-                        value_stack.pop_back();
-                    }
-                    break;
+            VM_CASE(SET_UPVALUE_LONG): {
+                rtupvalue * const uv = frame->c->get_upvalues().data()[READ_WORD()];
+                if (uv->is_closed) {
+                    uv->closed = PEEK(0);
+                    gc.write_barrier(uv, uv->closed);
+                } else {
+                    value_stack.data()[uv->value_stack_index()] = PEEK(0);
                 }
+                VM_NEXT();
+            }
 
-                case opcode::CLOSE_VALUE: {
-                    const u32 value_stack_index = value_stack.size() - 1;
-                    rtupvalue * const top = open_upvalues;
-                    top->is_closed = true;
+            // superinstructions, each does exactly what its sequence did.
 
-                    panic_if(value_stack_index != top->value_stack_index(), "stack indicies should be identical");
+            VM_CASE(GET_LOCALS): {
+                const u32 a = READ_BYTE();
+                const u32 b = READ_BYTE();
+                PUSH(value_stack.data()[bp + a]);
+                PUSH(value_stack.data()[bp + b]);
+                VM_NEXT();
+            }
 
-                    open_upvalues = open_upvalues->next();
-                    top->next() = nullptr;
+            VM_CASE(GET_LOCAL_CONST): {
+                const u32 a = READ_SHORT();
+                PUSH(value_stack.data()[bp + a]);
+                PUSH(constants[READ_SHORT()]);
+                VM_NEXT();
+            }
 
-                    top->closed = value_stack.pop_back();
-                    break;
-                }
+            VM_CASE(ADD_LOCAL_CONST): {
+                value& slot = value_stack.data()[bp + read_operand(ip, 2)];
+                const value& c = constants[read_operand(ip + 2, 2)];
+                if (BOTH_NUMBERS(slot, c)) QUICKEN(ADD_LOCAL_CONST_NUMBERS);
+                ip += 4;
+                slot = c + slot; // same order as ADD
+                GC_SAFEPOINT();
+                VM_NEXT();
+            }
 
-                case opcode::DEFINE_GLOBAL: {
-                    u32 index = current.operands.at(0);
-                    const value& v = script().constant_pool.at(index);
-                    const string *name = static_cast<string*>(v.obj());
-                    // this looks really bad but guaranteed to be a string.
-                    panic_if(globals.contains(*name), "Already defined global");
-                    globals.insert(*name, value_stack.pop_back());
-                    break;
-                }
+            VM_CASE(SET_LOCAL_POP): {
+                const u32 a = READ_BYTE();
+                value_stack.data()[bp + a] = POP();
+                VM_NEXT();
+            }
 
-                case opcode::GET_GLOBAL: {
-                    u32 index = current.operands.at(0);
+            VM_CASE(SET_GLOBAL_POP): {
+                value& slot = globals.data()[READ_WORD()];
+                slot = POP();
+                remember_global(slot);
+                VM_NEXT();
+            }
 
-                    const value& v = script().constant_pool.at(index);
-                    const string *name = static_cast<string*>(v.obj());
+            VM_CASE(CALL_LOCAL): {
+                const value callable = value_stack.data()[bp + READ_SHORT()];
+                const u64 num_args = READ_SHORT();
+                const u32 site = READ_SHORT();
+                SAVE_FRAME();
+                call_cached(callable, num_args, site);
+                LOAD_FRAME();
+                JIT_ENTER();
+                VM_NEXT();
+            }
 
-                    panic_if(!globals.contains(*name), "Cannot get undefined global");
+            VM_CASE(CALL_GLOBAL): {
+                const value callable = globals.data()[READ_WORD()];
+                const u64 num_args = READ_WORD();
+                const u32 site = READ_WORD();
+                SAVE_FRAME();
+                call_cached(callable, num_args, site);
+                LOAD_FRAME();
+                JIT_ENTER();
+                VM_NEXT();
+            }
 
-                    value_stack.push_back(globals.at(*name));
-                    break;
+            // the fused branches dispatch separately on each path. with a
+            // single dispatch the compiler picks the next ip with a cmov,
+            // and the next opcode can't be fetched until the condition is.
+            VM_CASE(POP_BRANCH_FALSE): {
+                const u32 increment = READ_SHORT();
+                if (!POP().byte()) {
+                    ip += increment;
+                    VM_NEXT();
                 }
+                VM_NEXT();
+            }
 
-                case opcode::SET_GLOBAL: {
-                    u32 index = current.operands.at(0);
-                    const value& v = script().constant_pool.at(index);
-                    const string *name =static_cast<string*>(v.obj());
-                    panic_if(!globals.contains(*name), "Cannot set undefined global");
+// pops both operands, branches when the comparison's byte is taken_when.
+#define COMPARE_BRANCH(op, taken_when, quickened)                      \
+            do {                                                       \
+                if (NUMBERS_ON_TOP()) QUICKEN(quickened);              \
+                const u32 increment = READ_SHORT();                    \
+                const value b = POP();                                 \
+                const value a = POP();                                 \
+                if ((a op b).byte() == taken_when) {                   \
+                    ip += increment;                                   \
+                    VM_NEXT();                                         \
+                }                                                      \
+            } while (0)
+
+            VM_CASE(LESS_BRANCH_FALSE): {
+                COMPARE_BRANCH(<, 0, LESS_BRANCH_FALSE_NUMBERS);
+                VM_NEXT();
+            }
 
-                    globals.at(*name) = value_stack.pop_back();
+            VM_CASE(LESS_BRANCH_TRUE): {
+                COMPARE_BRANCH(<, 1, LESS_BRANCH_TRUE_NUMBERS);
+                VM_NEXT();
+            }
 
-                    break;
-                }
+            VM_CASE(GREATER_BRANCH_FALSE): {
+                COMPARE_BRANCH(>, 0, GREATER_BRANCH_FALSE_NUMBERS);
+                VM_NEXT();
+            }
 
-                case opcode::GET_LOCAL: {
-                    const u32 index = current.operands.at(0) + call_frames.back().bp;
-                    value_stack.push_back(value_stack.at(index));
-                    break;
-                }
+            VM_CASE(GREATER_BRANCH_TRUE): {
+                COMPARE_BRANCH(>, 1, GREATER_BRANCH_TRUE_NUMBERS);
+                VM_NEXT();
+            }
 
-                case opcode::SET_LOCAL: {
-                    const u32 index = current.operands.at(0) + call_frames.back().bp;
-                    value_stack.at(index) = value_stack.pop_back();
-                    break;
-                }
+            VM_CASE(EQUAL_BRANCH_FALSE): {
+                COMPARE_BRANCH(==, 0, EQUAL_BRANCH_FALSE_NUMBERS);
+                VM_NEXT();
+            }
 
-                case opcode::BRANCH_FALSE: {
-                    u32 increment = current.operands.at(0);
-                    if (!value_stack.back().byte()) {
-                        *pc += increment;
-                    }
-                    break;
+            VM_CASE(EQUAL_BRANCH_TRUE): {
+                COMPARE_BRANCH(==, 1, EQUAL_BRANCH_TRUE_NUMBERS);
+                VM_NEXT();
+            }
+#undef COMPARE_BRANCH
+
+            // the quickened forms, see opcode. they work on the stack in place.
+            VM_CASE(ADD_NUMBERS): {
+                value& a = PEEK(1);
+                const value& b = PEEK(0);
+                if (!BOTH_NUMBERS(a, b)) DEOPTIMIZE(ADD);
+                a = value(static_cast<f32>(b.number() + a.number()));
+                sp--;
+                VM_NEXT();
+            }
+
+            VM_CASE(ADD_STRINGS): {
+                value& a = PEEK(1);
+                const value& b = PEEK(0);
+                if (!BOTH_STRINGS(a, b)) DEOPTIMIZE(ADD);
+                a = value::concat(a, b);
+                sp--;
+                GC_SAFEPOINT();
+                VM_NEXT();
+            }
+
+// a op b on the two numbers on top, into a's slot. result is f32 or u8.
+#define NUMBERS(op, result)                                            \
+            do {                                                       \
+                value& a = PEEK(1);                                    \
+                a = value(static_cast<result>(a.number() op PEEK(0).number())); \
+                sp--;                                                  \
+            } while (0)
+
+            VM_CASE(SUBTRACT_NUMBERS): {
+                if (!NUMBERS_ON_TOP()) DEOPTIMIZE(SUBTRACT);
+                NUMBERS(-, f32);
+                VM_NEXT();
+            }
+
+            VM_CASE(MULTIPLY_NUMBERS): {
+                if (!NUMBERS_ON_TOP()) DEOPTIMIZE(MULTIPLY);
+                NUMBERS(*, f32);
+                VM_NEXT();
+            }
+
+            VM_CASE(DIVIDE_NUMBERS): {
+                if (!NUMBERS_ON_TOP()) DEOPTIMIZE(DIVIDE);
+                NUMBERS(/, f32);
+                VM_NEXT();
+            }
+
+            VM_CASE(GREATER_NUMBERS): {
+                if (!NUMBERS_ON_TOP()) DEOPTIMIZE(GREATER);
+                NUMBERS(>, u8);
+                VM_NEXT();
+            }
+
+            VM_CASE(LESS_NUMBERS): {
+                if (!NUMBERS_ON_TOP()) DEOPTIMIZE(LESS);
+                NUMBERS(<, u8);
+                VM_NEXT();
+            }
+
+            VM_CASE(EQUAL_NUMBERS): {
+                if (!NUMBERS_ON_TOP()) DEOPTIMIZE(EQUAL);
+                NUMBERS(==, u8);
+                VM_NEXT();
+            }
+#undef NUMBERS
+
+            VM_CASE(ADD_LOCAL_CONST_NUMBERS): {
+                value& slot = value_stack.data()[bp + read_operand(ip, 2)];
+                const value& c = constants[read_operand(ip + 2, 2)];
+                if (!BOTH_NUMBERS(slot, c)) DEOPTIMIZE(ADD_LOCAL_CONST);
+                ip += 4;
+                slot = value(static_cast<f32>(c.number() + slot.number()));
+                VM_NEXT();
+            }
+
+#define COMPARE_BRANCH_NUMBERS(op, taken_when)                         \
+            do {                                                       \
+                const u32 increment = READ_SHORT();                    \
+                const f32 b = POP().number();                          \
+                const f32 a = POP().number();                          \
+                if ((a op b) == taken_when) {                          \
+                    ip += increment;                                   \
+                    VM_NEXT();                                         \
+                }                                                      \
+            } while (0)
+
+            VM_CASE(LESS_BRANCH_FALSE_NUMBERS): {
+                if (!NUMBERS_ON_TOP()) DEOPTIMIZE(LESS_BRANCH_FALSE);
+                COMPARE_BRANCH_NUMBERS(<, 0);
+                VM_NEXT();
+            }
+
+            VM_CASE(LESS_BRANCH_TRUE_NUMBERS): {
+                if (!NUMBERS_ON_TOP()) DEOPTIMIZE(LESS_BRANCH_TRUE);
+                COMPARE_BRANCH_NUMBERS(<, 1);
+                VM_NEXT();
+            }
+
+            VM_CASE(GREATER_BRANCH_FALSE_NUMBERS): {
+                if (!NUMBERS_ON_TOP()) DEOPTIMIZE(GREATER_BRANCH_FALSE);
+                COMPARE_BRANCH_NUMBERS(>, 0);
+                VM_NEXT();
+            }
+
+            VM_CASE(GREATER_BRANCH_TRUE_NUMBERS): {
+                if (!NUMBERS_ON_TOP()) DEOPTIMIZE(GREATER_BRANCH_TRUE);
+                COMPARE_BRANCH_NUMBERS(>, 1);
+                VM_NEXT();
+            }
+
+            VM_CASE(EQUAL_BRANCH_FALSE_NUMBERS): {
+                if (!NUMBERS_ON_TOP()) DEOPTIMIZE(EQUAL_BRANCH_FALSE);
+                COMPARE_BRANCH_NUMBERS(==, 0);
+                VM_NEXT();
+            }
+
+            VM_CASE(EQUAL_BRANCH_TRUE_NUMBERS): {
+                if (!NUMBERS_ON_TOP()) DEOPTIMIZE(EQUAL_BRANCH_TRUE);
+                COMPARE_BRANCH_NUMBERS(==, 1);
+                VM_NEXT();
+            }
+#undef COMPARE_BRANCH_NUMBERS
+
+#ifdef STING_TRACE
+            // every instruction while a trace is recorded, before it runs.
+            record_step: {
+                value_stack.set_top(sp);
+                if (!recorder.record(*this, ip - 1 - code))
+                    memcpy(dispatch, dispatch_table, sizeof(dispatch));
+                goto *dispatch_table[static_cast<uint8_t>(ip[-1])];
+            }
+#endif
+
+#ifndef STING_COMPUTED_GOTO
+            default: {
+                std::stringstream errMessage;
+                errMessage << "Unknown opcode: " << static_cast<u64>(static_cast<uint8_t>(ip[-1]));
+                panic(errMessage.str());
+            }
+#endif
+        }
+
+#undef VM_NEXT
+#undef VM_CASE
+#undef VM_LOOP
+#undef VM_DISPATCH
+#undef READ_WORD
+#undef READ_SHORT
+#undef READ_BYTE
+#undef BOTH_STRINGS
+#undef NUMBERS_ON_TOP
+#undef PEEK
+#undef POP
+#undef PUSH
+#undef BOTH_NUMBERS
+#undef DEOPTIMIZE
+#undef QUICKEN
+#undef TRACE_LOOP
+#undef JIT_ENTER
+#undef GC_SAFEPOINT
+#undef SAVE_FRAME
+#undef LOAD_FRAME
+#undef PROFILE_STEP
+#undef PROFILE_ENTER
+        return vm_result::RUNTIME_ERROR;
+    }
+
+    // call for run_registers. the arguments are already in the registers
+    // from base on, and the callee's registers start there too. the value
+    // stack always covers every register of the running frame.
+    void call_registers(const value& callable, const u64 base, const u64 num_args) {
+        switch (callable.type()) {
+            case vtype::CLOSURE: {
+                closure* c = static_cast<closure*>(callable.obj());
+                panic_if(c->get_arity() != num_args, "Wrong number of args to function call");
+                panic_if(!call_frames.has_room(1), "Stack overflow: too many nested calls");
+                const u64 top = base + c->get_chunk().register_count;
+                panic_if(top > value_stack.capacity(), "Stack overflow: value stack is full");
+                call_frames.push_back(call_frame(c, base));
+                if (value_stack.size() < top)
+                    value_stack.resize(top);
+                break;
+            }
+            case vtype::NATIVE_FUNCTION: {
+                native_function& nf = *static_cast<native_function*>(callable.obj());
+                panic_if(nf.get_arity() != num_args, "Wrong number of args to native function call");
+                dynarray<value> args;
+                for (u64 i = 0; i < num_args; i++) {
+                    args.push_back(value_stack.data()[base + num_args - 1 - i]); // same order as call
                 }
+                value_stack.data()[base] = nf.call(args);
+                break;
+            }
+            default: {
+                panic("Cannot call non-callable object.");
+            }
+        }
+    }
+
+    // the register vm, runs the chunks' register_code (see registers.hpp)
+    // instead of their bytecode. same frames, globals, upvalues and
+    // collector as run_chunk, only the value stack is used differently:
+    // every frame's registers are its slots from bp on, and instead of
+    // pushing and popping, the stack is sized to the running frame's
+    // register count. the profiler only sees run_chunk.
+    vm_result run_registers() {
+        call_frame* frame;
+        u32 const* code;
+        value const* constants;
+        u32 const* ip;
+        u64 bp;
+        value* regs;
+        u32 inst;
+
+#define LOAD_FRAME()                                                   \
+        do {                                                           \
+            frame = &call_frames.back();                               \
+            code = frame->register_code;                               \
+            constants = frame->constants;                              \
+            ip = code + frame->pc;                                     \
+            bp = frame->bp;                                            \
+            regs = value_stack.data() + bp;                            \
+        } while (0)
+#define SAVE_FRAME() (frame->pc = ip - code)
+#define GC_SAFEPOINT()                                                 \
+        do {                                                           \
+            if (gc.should_collect()) {                                 \
+                SAVE_FRAME();                                          \
+                collect_garbage();                                     \
+                LOAD_FRAME();                                          \
+            }                                                          \
+        } while (0)
+#define RA regs[decode_a(inst)]
+#define RB regs[decode_b(inst)]
+#define RC regs[decode_c(inst)]
+#define READ_WORD() (*ip++)
+
+#ifdef STING_COMPUTED_GOTO
+        // must be in the same order as regop.
+        static void* const dispatch_table[] = {
+            &&op_MOVE, &&op_LOAD_CONST, &&op_LOAD_CONST_LONG, &&op_LOAD_TRUE,
+            &&op_LOAD_FALSE, &&op_LOAD_NIL, &&op_NEGATE, &&op_NOT,
+            &&op_ADD, &&op_SUBTRACT, &&op_MULTIPLY, &&op_DIVIDE,
+            &&op_GREATER, &&op_LESS, &&op_EQUAL, &&op_ADD_CONST,
+            &&op_SUBTRACT_CONST, &&op_PRINT, &&op_DEFINE_GLOBAL, &&op_GET_GLOBAL,
+            &&op_SET_GLOBAL, &&op_GET_GLOBAL_CHECKED, &&op_SET_GLOBAL_CHECKED, &&op_GET_UPVALUE,
+            &&op_SET_UPVALUE, &&op_JUMP, &&op_BRANCH_FALSE, &&op_LESS_BRANCH_FALSE,
+            &&op_LESS_BRANCH_TRUE, &&op_GREATER_BRANCH_FALSE, &&op_GREATER_BRANCH_TRUE, &&op_EQUAL_BRANCH_FALSE,
+            &&op_EQUAL_BRANCH_TRUE, &&op_LESS_CONST_BRANCH_FALSE, &&op_LESS_CONST_BRANCH_TRUE, &&op_GREATER_CONST_BRANCH_FALSE,
+            &&op_GREATER_CONST_BRANCH_TRUE, &&op_EQUAL_CONST_BRANCH_FALSE, &&op_EQUAL_CONST_BRANCH_TRUE, &&op_CALL,
+            &&op_CALL_GLOBAL, &&op_MAKE_CLOSURE, &&op_CLOSE_VALUE, &&op_SAVE_VALUE,
+            &&op_LOAD_VALUE, &&op_RETURN,
+        };
+        static_assert(sizeof(dispatch_table) / sizeof(dispatch_table[0]) ==
+                      static_cast<u64>(regop::REGOP_COUNT),
+                      "dispatch_table is out of sync with regop");
+
+#define VM_DISPATCH()                                                  \
+        do {                                                           \
+            inst = *ip++;                                              \
+            goto *dispatch_table[inst & 0xff];                         \
+        } while (0)
+#define VM_LOOP() VM_DISPATCH();
+#define VM_CASE(name) op_##name
+#define VM_NEXT() VM_DISPATCH()
+#else
+#define VM_LOOP() for (;;) switch (inst = *ip++, decode_op(inst))
+#define VM_CASE(name) case regop::name
+#define VM_NEXT() continue
+#endif
+
+        LOAD_FRAME();
+        if (value_stack.size() < bp + frame->c->get_chunk().register_count)
+            value_stack.resize(bp + frame->c->get_chunk().register_count);
+
+        VM_LOOP() {
+            VM_CASE(MOVE): {
+                RA = RB;
+                VM_NEXT();
+            }
+
+            VM_CASE(LOAD_CONST): {
+                RA = constants[decode_bx(inst)];
+                VM_NEXT();
+            }
+
+            VM_CASE(LOAD_CONST_LONG): {
+                RA = constants[READ_WORD()];
+                VM_NEXT();
+            }
+
+            VM_CASE(LOAD_TRUE): {
+                RA = value(static_cast<u8>(true));
+                VM_NEXT();
+            }
+
+            VM_CASE(LOAD_FALSE): {
+                RA = value(static_cast<u8>(false));
+                VM_NEXT();
+            }
+
+            VM_CASE(LOAD_NIL): {
+                RA = value();
+                VM_NEXT();
+            }
+
+            VM_CASE(NEGATE): {
+                RA = -RB;
+                VM_NEXT();
+            }
+
+            VM_CASE(NOT): {
+                RA = !RB;
+                VM_NEXT();
+            }
+
+            VM_CASE(ADD): {
+                RA = RC + RB; // same order as run_chunk's ADD
+                GC_SAFEPOINT();
+                VM_NEXT();
+            }
+
+            VM_CASE(SUBTRACT): {
+                RA = RB - RC;
+                VM_NEXT();
+            }
+
+            VM_CASE(MULTIPLY): {
+                RA = RB * RC;
+                VM_NEXT();
+            }
+
+            VM_CASE(DIVIDE): {
+                RA = RB / RC;
+                VM_NEXT();
+            }
+
+            VM_CASE(GREATER): {
+                RA = RB > RC;
+                VM_NEXT();
+            }
+
+            VM_CASE(LESS): {
+                RA = RB < RC;
+                VM_NEXT();
+            }
+
+            VM_CASE(EQUAL): {
+                RA = RB == RC;
+                VM_NEXT();
+            }
+
+            VM_CASE(ADD_CONST): {
+                RA = constants[decode_c(inst)] + RB;
+                GC_SAFEPOINT();
+                VM_NEXT();
+            }
+
+            VM_CASE(SUBTRACT_CONST): {
+                RA = RB - constants[decode_c(inst)];
+                VM_NEXT();
+            }
+
+            VM_CASE(PRINT): {
+                std::cout << RA << "\n" << std::flush;
+                VM_NEXT();
+            }
+
+            VM_CASE(DEFINE_GLOBAL): {
+                const u32 slot = READ_WORD();
+                globals.data()[slot] = RA;
+                global_defined.data()[slot] = true;
+                remember_global(globals.data()[slot]);
+                VM_NEXT();
+            }
+
+            VM_CASE(GET_GLOBAL): {
+                RA = globals.data()[READ_WORD()];
+                VM_NEXT();
+            }
+
+            VM_CASE(SET_GLOBAL): {
+                value& slot = globals.data()[READ_WORD()];
+                slot = RA;
+                remember_global(slot);
+                VM_NEXT();
+            }
+
+            VM_CASE(GET_GLOBAL_CHECKED): {
+                const u32 slot = READ_WORD();
+                if (!global_defined.data()[slot]) undefined_global(slot);
+                RA = globals.data()[slot];
+                VM_NEXT();
+            }
 
-                case opcode::BRANCH: {
-                    u32 increment = current.operands.at(0);
-                    *pc += increment;
-                    break;
+            VM_CASE(SET_GLOBAL_CHECKED): {
+                const u32 slot = READ_WORD();
+                if (!global_defined.data()[slot]) undefined_global(slot);
+                globals.data()[slot] = RA;
+                remember_global(globals.data()[slot]);
+                VM_NEXT();
+            }
+
+            VM_CASE(GET_UPVALUE): {
+                rtupvalue const * const uv = frame->c->get_upvalues().data()[decode_b(inst)];
+                RA = uv->is_closed ? uv->closed : value_stack.data()[uv->value_stack_index()];
+                VM_NEXT();
+            }
+
+            VM_CASE(SET_UPVALUE): {
+                rtupvalue * const uv = frame->c->get_upvalues().data()[decode_b(inst)];
+                if (uv->is_closed) {
+                    uv->closed = RA;
+                    gc.write_barrier(uv, uv->closed);
+                } else {
+                    value_stack.data()[uv->value_stack_index()] = RA;
                 }
+                VM_NEXT();
+            }
 
-                case opcode::LOOP: {
-                    u32 increment = current.operands.at(0);
-                    *pc -= increment;
-                    break;
+            VM_CASE(JUMP): {
+                const i32 offset = static_cast<i32>(READ_WORD());
+                ip += offset;
+                VM_NEXT();
+            }
+
+            // dispatched separately on each path, like run_chunk's fused branches.
+            VM_CASE(BRANCH_FALSE): {
+                const i32 offset = static_cast<i32>(READ_WORD());
+                if (!RA.byte()) {
+                    ip += offset;
+                    VM_NEXT();
                 }
+                VM_NEXT();
+            }
 
-                case opcode::GET_UPVALUE: {
-                    const u32 upvalue_index = current.operands.at(0);
-                    rtupvalue const * const uv =
-                        call_frames.back().c.get_upvalues().at(upvalue_index);
+#define COMPARE_BRANCH(op, right, taken_when)                          \
+            do {                                                       \
+                const i32 offset = static_cast<i32>(READ_WORD());      \
+                if ((RA op right).byte() == taken_when) {              \
+                    ip += offset;                                      \
+                    VM_NEXT();                                         \
+                }                                                      \
+            } while (0)
+
+            VM_CASE(LESS_BRANCH_FALSE): {
+                COMPARE_BRANCH(<, RB, 0);
+                VM_NEXT();
+            }
 
-                    const u32 stack_index = uv->value_stack_index() + call_frames.back().bp;
-                    if (uv->is_closed) {
-                        value_stack.push_back(uv->closed);
-                    } else {
-                        value_stack.push_back(value_stack.at(stack_index));
-                    }
+            VM_CASE(LESS_BRANCH_TRUE): {
+                COMPARE_BRANCH(<, RB, 1);
+                VM_NEXT();
+            }
 
-                    break;
-                }
+            VM_CASE(GREATER_BRANCH_FALSE): {
+                COMPARE_BRANCH(>, RB, 0);
+                VM_NEXT();
+            }
+
+            VM_CASE(GREATER_BRANCH_TRUE): {
+                COMPARE_BRANCH(>, RB, 1);
+                VM_NEXT();
+            }
 
-                case opcode::SET_UPVALUE: {
-                    const u32 upvalue_index = current.operands.at(0);
-                    rtupvalue * const uv =
-                        call_frames.back().c.get_upvalues().at(upvalue_index);
-                    const u32 stack_index = uv->value_stack_index() + call_frames.back().bp;
-                    if (uv->is_closed) {
-                        uv->closed = value_stack.pop_back();
-                    } else {
-                        value_stack.at(stack_index) = value_stack.pop_back();
+            VM_CASE(EQUAL_BRANCH_FALSE): {
+                COMPARE_BRANCH(==, RB, 0);
+                VM_NEXT();
+            }
+
+            VM_CASE(EQUAL_BRANCH_TRUE): {
+                COMPARE_BRANCH(==, RB, 1);
+                VM_NEXT();
+            }
+
+            VM_CASE(LESS_CONST_BRANCH_FALSE): {
+                COMPARE_BRANCH(<, constants[decode_b(inst)], 0);
+                VM_NEXT();
+            }
+
+            VM_CASE(LESS_CONST_BRANCH_TRUE): {
+                COMPARE_BRANCH(<, constants[decode_b(inst)], 1);
+                VM_NEXT();
+            }
+
+            VM_CASE(GREATER_CONST_BRANCH_FALSE): {
+                COMPARE_BRANCH(>, constants[decode_b(inst)], 0);
+                VM_NEXT();
+            }
+
+            VM_CASE(GREATER_CONST_BRANCH_TRUE): {
+                COMPARE_BRANCH(>, constants[decode_b(inst)], 1);
+                VM_NEXT();
+            }
+
+            VM_CASE(EQUAL_CONST_BRANCH_FALSE): {
+                COMPARE_BRANCH(==, constants[decode_b(inst)], 0);
+                VM_NEXT();
+            }
+
+            VM_CASE(EQUAL_CONST_BRANCH_TRUE): {
+                COMPARE_BRANCH(==, constants[decode_b(inst)], 1);
+                VM_NEXT();
+            }
+#undef COMPARE_BRANCH
+
+            VM_CASE(CALL): {
+                const value callable = RC;
+                SAVE_FRAME();
+                call_registers(callable, bp + decode_a(inst), decode_b(inst));
+                LOAD_FRAME();
+                VM_NEXT();
+            }
+
+            VM_CASE(CALL_GLOBAL): {
+                const value callable = globals.data()[READ_WORD()];
+                SAVE_FRAME();
+                call_registers(callable, bp + decode_a(inst), decode_b(inst));
+                LOAD_FRAME();
+                VM_NEXT();
+            }
+
+            VM_CASE(MAKE_CLOSURE): {
+                {
+                    const value v = constants[READ_WORD()];
+                    panic_if(v.type() != vtype::FUNCTION, "Cannot make closure from non-function");
+                    closure* c = gc.make<closure>(static_cast<function*>(v.obj()));
+                    const u64 num_upvalues = READ_WORD();
+
+                    dynarray<rtupvalue*>& uv = c->get_upvalues();
+                    for (u64 i{}; i < num_upvalues; i++) {
+                        const u32 pair = READ_WORD();
+                        const u32 index = pair >> 8;
+                        if (pair & 0xff) {
+                            uv.push_back(capture_value(bp + index));
+                        } else {
+                            uv.push_back(frame->c->get_upvalues().at(index));
+                        }
                     }
-                    break;
+                    RA = value::heap_object(c, vtype::CLOSURE);
                 }
+                GC_SAFEPOINT();
+                VM_NEXT();
+            }
 
-                case opcode::SAVE_VALUE: {
-                    return_slot = value_stack.pop_back();
-                    break;
-                }
+            VM_CASE(CLOSE_VALUE): {
+                rtupvalue * const top = open_upvalues;
+                panic_if(bp + decode_a(inst) != top->value_stack_index(), "stack indicies should be identical");
+                top->is_closed = true;
+                open_upvalues = open_upvalues->next();
+                top->next() = nullptr;
+                top->closed = RA;
+                gc.write_barrier(top, top->closed);
+                VM_NEXT();
+            }
 
-                case opcode::LOAD_VALUE: {
-                    value_stack.push_back(return_slot);
-                    break;
-                }
+            VM_CASE(SAVE_VALUE): {
+                return_slot = RA;
+                VM_NEXT();
+            }
+
+            VM_CASE(LOAD_VALUE): {
+                RA = return_slot;
+                VM_NEXT();
+            }
 
-                default: {
-                    std::stringstream errMessage;
-                    errMessage << "Unknown opcode: " << static_cast<u64>(current.op);
-                    panic(errMessage.str());
+            VM_CASE(RETURN): {
+                if (call_frames.size() == 1) {
+                    SAVE_FRAME();
+                    call_frames.pop_back();
+                    return vm_result::OK;
                 }
+
+                // the result goes where the callee's registers started, the
+                // caller's register a of the CALL.
+                value_stack.data()[bp] = RA;
+                call_frames.pop_back();
+                LOAD_FRAME();
+                value_stack.resize(bp + frame->c->get_chunk().register_count);
+                VM_NEXT();
+            }
+
+#ifndef STING_COMPUTED_GOTO
+            default: {
+                std::stringstream errMessage;
+                errMessage << "Unknown register opcode: " << (inst & 0xff);
+                panic(errMessage.str());
             }
+#endif
         }
+
+#undef VM_NEXT
+#undef VM_CASE
+#undef VM_LOOP
+#undef VM_DISPATCH
+#undef READ_WORD
+#undef RC
+#undef RB
+#undef RA
+#undef GC_SAFEPOINT
+#undef SAVE_FRAME
+#undef LOAD_FRAME
+        return vm_result::RUNTIME_ERROR;
     }
 
-    chunk& get_current_chunk() { return call_frames.back().c.get_chunk(); }
+    chunk& get_current_chunk() { return call_frames.back().c->get_chunk(); }
 
     const chunk& script() {
-        return call_frames.at(0).c.get_chunk();
+        return call_frames.data()[0].c->get_chunk();
     }
 
-    dynarray<call_frame> call_frames;
-    dynarray<value> value_stack;
+    vm_stack<call_frame> call_frames;
+    vm_stack<value> value_stack;
     value return_slot;
-    hashmap<string, value> globals; // builtins get stored here too?
+    // indexed by the slots the compiler assigned. builtins get stored here too.
+    dynarray<value> globals;
+    dynarray<bool> global_defined;
+    dynarray<value> global_names;
 
     // not sorted.
     rtupvalue * open_upvalues;
+
+    dynarray<value*> young_globals;
+    bool globals_dirty;
+
+    // calls before a function gets native code, 0 never compiles any.
+    u32 jit_threshold = DEFAULT_JIT_THRESHOLD;
+    // LOOPs to a header before its loop gets recorded, 0 never records any.
+    u32 trace_threshold = DEFAULT_TRACE_THRESHOLD;
+    trace_recorder recorder;
 };
 
 } // namespace sting
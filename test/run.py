@@ -0,0 +1,318 @@
+#!/usr/bin/env python3
+"""
+test runner for the .sting programs in this directory.
+
+    python3 test/run.py ./sting [test ...]
+
+every test/*.sting lists the output it expects in "// expect:" lines, like
+the workloads in bench/. each one runs under every configuration in
+CONFIGS and has to print exactly that, and exit 0, every time. a
+"// exit: N" line expects exit status N instead, "// skip: <config>"
+lines leave configurations out and "// env: NAME=VALUE" lines are set for
+every configuration. the generated tests write their program to a temporary directory first, they
+are too big to keep in the tree. the cache tests run with the .stingc
+cache on, in that directory too.
+
+exits 1 if anything failed.
+"""
+
+import os
+import random
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+TEST_DIR = os.path.dirname(os.path.abspath(__file__))
+
+# the cache is off here, each program is compiled by every run.
+CONFIGS = [
+    ("default", {}),
+    ("no optimizer", {"STING_NO_OPTIMIZE": "1"}),
+    ("register vm", {"STING_REGISTER_VM": "1"}),
+    ("no jit", {"STING_NO_JIT": "1"}),
+    ("jit everything", {"STING_JIT_THRESHOLD": "1", "STING_TRACE_THRESHOLD": "1"}),
+]
+
+
+# the "// name:" lines in the file, without the prefix.
+def directives(path, name):
+    prefix = "// %s:" % name
+    lines = []
+    with open(path) as f:
+        for line in f:
+            if line.startswith(prefix):
+                lines.append(line[len(prefix):].strip())
+    return lines
+
+
+def expected_output(path):
+    return directives(path, "expect")
+
+
+def run(binary, path, env, cache=False, timeout=None):
+    full = dict(os.environ)
+    full.pop("STING_NO_CACHE", None)
+    if not cache:
+        full["STING_NO_CACHE"] = "1"
+    full.update(env)
+    return subprocess.run([binary, path], capture_output=True, text=True, env=full,
+                          timeout=timeout)
+
+
+# best of a few runs, in seconds. None if one of them went wrong.
+def best_time(binary, path, expected, cache, runs=3):
+    best = None
+    for _ in range(runs):
+        start = time.perf_counter()
+        proc = run(binary, path, {}, cache)
+        elapsed = time.perf_counter() - start
+        if problem(proc, expected) is not None:
+            return None
+        best = elapsed if best is None else min(best, elapsed)
+    return best
+
+
+# the first way the run went wrong, None if it didn't.
+def problem(proc, expected, status=0):
+    if proc.returncode != status:
+        return "exit %d:\n%s" % (proc.returncode, proc.stderr.strip())
+    got = [line.strip() for line in proc.stdout.splitlines()]
+    if got != expected:
+        for i in range(max(len(got), len(expected))):
+            want = expected[i] if i < len(expected) else "(nothing)"
+            have = got[i] if i < len(got) else "(nothing)"
+            if want != have:
+                return "line %d: expected %s, got %s" % (i + 1, want, have)
+    return None
+
+
+def check(binary, name, path, expected, skip=(), status=0, extra={}):
+    failed = 0
+    for config, env in CONFIGS:
+        if config in skip:
+            continue
+        why = problem(run(binary, path, dict(extra, **env)), expected, status)
+        if why is not None:
+            print("FAIL %s (%s): %s" % (name, config, why))
+            failed += 1
+    return failed
+
+
+# 50000 if/else statements at the top level. the value stack needs room
+# for the deepest point of the script, not for every push in it.
+def many_branches():
+    count = 50000
+    source = ["var x = 0;", "var i = 10;"]
+    x = 0
+    for _ in range(count):
+        source.append("if (x < i) { x = x + 1; } else { x = x - 1; }")
+        x = x + 1 if x < 10 else x - 1
+    source.append("print x;")
+    return "\n".join(source) + "\n", [str(x)]
+
+
+GENERATED = {
+    "many_branches": many_branches,
+}
+
+
+# 6000 functions with a closure each, and a few calls.
+def many_functions():
+    count = 6000
+    source = []
+    for i in range(count):
+        source.append("fun f%d(a) { var b = a + %d; fun g(c) { return b + c; } return g; }" % (i, i))
+    source.append("var t = 0;")
+    total = 0
+    for i in range(0, count, 1000):
+        source.append("var h%d = f%d(1);" % (i, i))
+        source.append("t = t + h%d(2);" % i)
+        total += 1 + i + 2
+    source.append("print t;")
+    return "\n".join(source) + "\n", [str(total)]
+
+
+# loading the file has to be faster than compiling the source, that's what
+# it's for. checking a cached file is linear in its size.
+def cache_load_time(binary, tmp):
+    source, expected = many_functions()
+    path = os.path.join(tmp, "cache_load_time.sting")
+    with open(path, "w") as f:
+        f.write(source)
+    compiled = best_time(binary, path, expected, cache=False)
+    why = problem(run(binary, path, {}, cache=True), expected)
+    if compiled is None or why is not None:
+        return "wrong output: %s" % why
+    if not os.path.exists(path + "c"):
+        return "no cache file written"
+    cached = best_time(binary, path, expected, cache=True)
+    if cached is None:
+        return "wrong output from the cache"
+    if cached >= compiled:
+        return "loading took %.0f ms, compiling %.0f ms" % (cached * 1000, compiled * 1000)
+    return None
+
+
+# the test/ programs that run the same in every configuration.
+def plain_programs():
+    for f in sorted(os.listdir(TEST_DIR)):
+        path = os.path.join(TEST_DIR, f)
+        if f.endswith(".sting") and not directives(path, "skip") and not directives(path, "exit"):
+            yield path
+
+
+# changes when the file is rewritten, it's renamed into place.
+def stamp(path):
+    st = os.stat(path)
+    return (st.st_ino, st.st_mtime_ns)
+
+
+# every program written to the cache and run again from it, for both vms.
+# the second run has to print the same thing and leave the file alone.
+def cache_round_trip(binary, tmp):
+    for config, env in [("default", {}), ("register vm", {"STING_REGISTER_VM": "1"})]:
+        for source in plain_programs():
+            path = os.path.join(tmp, os.path.basename(source))
+            shutil.copy(source, path)
+            if os.path.exists(path + "c"):
+                os.remove(path + "c")
+            expected = expected_output(source)
+            env = dict(dict(e.split("=", 1) for e in directives(source, "env")), **env)
+            why = problem(run(binary, path, env, cache=True), expected)
+            if why is not None:
+                return "%s (%s), writing the cache: %s" % (source, config, why)
+            written = stamp(path + "c")
+            why = problem(run(binary, path, env, cache=True), expected)
+            if why is not None:
+                return "%s (%s), from the cache: %s" % (source, config, why)
+            if stamp(path + "c") != written:
+                return "%s (%s): the cache was rewritten, it didn't load" % (source, config)
+    return None
+
+
+# the layout of a .stingc header, see write_header in bytecode_file.cpp.
+HEADER_SIZE = 41
+CHECKSUM_AT = 33
+
+
+def fnv(data):
+    h = 0xcbf29ce484222325
+    for b in data:
+        h = ((h ^ b) * 0x100000001b3) & 0xffffffffffffffff
+    return h
+
+
+# damaged cache files. one the header's checksum catches, or that's cut
+# short, has to be ignored: the source is compiled again and runs as
+# usual. one with the checksum fixed up gets as far as the verifier, it
+# may be valid code that does something else, but it must not crash.
+def cache_corruption(binary, tmp):
+    source = os.path.join(TEST_DIR, "peephole.sting")
+    path = os.path.join(tmp, "corrupt.sting")
+    shutil.copy(source, path)
+    expected = expected_output(source)
+    why = problem(run(binary, path, {}, cache=True), expected)
+    if why is not None:
+        return "writing the cache: %s" % why
+    with open(path + "c", "rb") as f:
+        good = f.read()
+
+    r = random.Random(1)
+    damaged = []
+    for at in range(HEADER_SIZE):
+        data = bytearray(good)
+        data[at] ^= 0xff
+        damaged.append(("header byte %d" % at, bytes(data), False))
+    for size in sorted(r.sample(range(len(good)), 20)):
+        damaged.append(("cut to %d bytes" % size, good[:size], False))
+    for at in sorted(r.sample(range(HEADER_SIZE, len(good)), min(150, len(good) - HEADER_SIZE))):
+        data = bytearray(good)
+        data[at:at + 4] = bytes(r.randrange(256) for _ in range(4))
+        data = bytes(data[:len(good)])
+        damaged.append(("bytes at %d" % at, data, False))
+        payload = data[HEADER_SIZE:]
+        fixed = data[:CHECKSUM_AT] + struct.pack("<Q", fnv(payload)) + payload
+        damaged.append(("bytes at %d, checksum fixed" % at, fixed, True))
+
+    for what, data, verified in damaged:
+        with open(path + "c", "wb") as f:
+            f.write(data)
+        try:
+            proc = run(binary, path, {}, cache=True, timeout=5)
+        except subprocess.TimeoutExpired:
+            # a branch turned into an endless loop is valid code.
+            if verified:
+                continue
+            return "%s: timed out" % what
+        if proc.returncode < 0 or "Sanitizer" in proc.stderr:
+            return "%s: crashed, exit %d:\n%s" % (what, proc.returncode, proc.stderr.strip())
+        if verified:
+            continue
+        why = problem(proc, expected)
+        if why is not None:
+            return "%s: %s" % (what, why)
+        with open(path + "c", "rb") as f:
+            if f.read() != good:
+                return "%s: the cache wasn't rewritten" % what
+    return None
+
+
+CACHE_TESTS = {
+    "cache_corruption": cache_corruption,
+    "cache_load_time": cache_load_time,
+    "cache_round_trip": cache_round_trip,
+}
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit("usage: run.py ./sting [test ...]")
+    binary = os.path.abspath(sys.argv[1])
+    wanted = sys.argv[2:]
+
+    programs = sorted(f[:-len(".sting")] for f in os.listdir(TEST_DIR) if f.endswith(".sting"))
+    names = programs + sorted(GENERATED) + sorted(CACHE_TESTS)
+    missing = [n for n in wanted if n not in names]
+    if missing:
+        sys.exit("unknown test(s): " + ", ".join(missing))
+
+    failed = 0
+    ran = 0
+    with tempfile.TemporaryDirectory() as tmp:
+        for name in names:
+            if wanted and name not in wanted:
+                continue
+            ran += 1
+            if name in CACHE_TESTS:
+                why = CACHE_TESTS[name](binary, tmp)
+                if why is not None:
+                    print("FAIL %s: %s" % (name, why))
+                    failed += 1
+                continue
+            if name in GENERATED:
+                source, expected = GENERATED[name]()
+                path = os.path.join(tmp, name + ".sting")
+                with open(path, "w") as f:
+                    f.write(source)
+                failed += check(binary, name, path, expected)
+                continue
+            path = os.path.join(TEST_DIR, name + ".sting")
+            skip = directives(path, "skip")
+            unknown = [c for c in skip if c not in dict(CONFIGS)]
+            if unknown:
+                sys.exit("%s: unknown configuration(s): %s" % (name, ", ".join(unknown)))
+            status = [int(s) for s in directives(path, "exit")] or [0]
+            extra = dict(e.split("=", 1) for e in directives(path, "env"))
+            failed += check(binary, name, path, expected_output(path), skip, status[-1], extra)
+
+    if failed:
+        print("%d failed" % failed)
+        sys.exit(1)
+    print("tests: %d passed" % ran)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,116 @@
+/*
+ *  Checks that the scanner's vectorized loops give the same tokens as its
+ *  scalar ones.
+ *
+ *      make test, or ./build/scanner_test [file.sting ...]
+ *
+ *  each file named, 20000 random sources and some generated code are
+ *  tokenized both ways. the tokens, their places and their lines have to
+ *  match. prints the first source that differs and exits 1, a file that
+ *  can't be read fails too.
+ */
+
+#include <string>
+
+#include "utilities.hpp"
+#include "dynarray.hpp"
+#include "scanner.hpp"
+
+using namespace sting;
+
+namespace {
+
+// xorshift, the same sources every run.
+struct rng {
+    u64 state = 0x9e3779b97f4a7c15;
+    u64 next() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+};
+
+dynarray<token> tokenize(std::string& source, bool vectorized) {
+    dynarray<token> tokens;
+    scanner scan(source.data(), source.size(), vectorized);
+    scan.tokenize(tokens);
+    return tokens;
+}
+
+u64 failures = 0;
+
+// the same tokens, at the same places and lines. error tokens point at
+// their message.
+void check_tokens(const std::string& name, std::string& source) {
+    const dynarray<token> a = tokenize(source, true);
+    const dynarray<token> b = tokenize(source, false);
+    bool same = a.size() == b.size();
+    for (u64 i{}; same && i < a.size(); i++) {
+        const token& x = a.at(i);
+        const token& y = b.at(i);
+        same = x == y && x.line == y.line &&
+               (x.type == token_type::ERROR || x.start == y.start);
+    }
+    if (same) return;
+    // one is enough to go on, the rest are usually the same bug.
+    if (failures++ == 0)
+        std::cerr << "vectorized and scalar tokens differ for " << name << ":\n" << source << "\n";
+}
+
+// bits of source that cross the 16 byte blocks in different ways.
+std::string random_source(rng& r, u64 pieces) {
+    static const char* const parts[] = {
+        " ", "  ", "                    ", "\t", "\n", "\r\n", "\n\n\n",
+        "// a comment\n", "//", "// a longer comment, longer than a block or two\n",
+        "x", "foo_bar", "a_rather_long_identifier_Name123", "_", "while", "print",
+        "1", "3.25", "12345678901234567890", "7.", ".5", "\"\"", "\"str\"",
+        "\"a string that goes on\nfor more than one line\"", "\"unterminated",
+        "(", ")", "{", "}", ";", ",", ".", "-", "+", "/", "*", "!", "!=", "=",
+        "==", "<", "<=", ">", ">=", "#",
+    };
+    const u64 count = sizeof(parts) / sizeof(parts[0]);
+    std::string source;
+    for (u64 i{}; i < pieces; i++) {
+        // the last few parts end the tokens early, so they're rarer.
+        u64 part = r.next() % count;
+        if (part >= count - 1 || parts[part][0] == '"') part = r.next() % count;
+        source += parts[part];
+    }
+    return source;
+}
+
+} // namespace
+
+i32 main(i32 argc, char** argv) {
+    for (i32 i = 1; i < argc; i++) {
+        if (!std::filesystem::exists(argv[i])) {
+            std::cerr << "no such file: " << argv[i] << "\n";
+            failures++;
+            continue;
+        }
+        std::string source = read_file(argv[i]);
+        check_tokens(argv[i], source);
+    }
+
+    rng r;
+    for (u64 i{}; i < 20000; i++) {
+        std::string source = random_source(r, 1 + r.next() % 40);
+        check_tokens("a random source", source);
+    }
+
+    std::string code;
+    for (u64 i{}; i < 2000; i++) {
+        code += "    // add the next one to the running total\n";
+        code += "    var running_total_" + std::to_string(i) + " = previous_value + 12345.5;\n";
+        code += "    print \"the running total is now\";\n\n";
+    }
+    check_tokens("generated code", code);
+
+    if (failures > 0) {
+        std::cerr << "scanner: " << failures << " failed\n";
+        return 1;
+    }
+    std::cout << "scanner: " << argc - 1 << " files and 20001 generated sources scan the same both ways\n";
+    return 0;
+}